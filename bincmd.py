@@ -0,0 +1,94 @@
+#!/usr/bin/env python
+
+# Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+# Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Encodes binary commands and decodes their replies, see
+# main/core/cmd/cmd_bin.c for the format.
+#
+# USAGE:
+#   ./bincmd.py geti <id> <KEY>          prints the request frame as hex
+#   ./bincmd.py seti <id> <KEY> <value>
+#   ./bincmd.py gets <id> <KEY>
+#   ./bincmd.py sets <id> <KEY> <value>
+#   ./bincmd.py decode <hex> ...         decodes reply frames
+#
+# On the terminal, send the hex prefixed with '~', replies come back the same
+# way. Over MQTT, sign and send the raw bytes.
+
+import struct
+import sys
+
+REQUEST = 0xB5
+REPLY = 0xB6
+OPCODES = {'geti': 1, 'seti': 2, 'gets': 3, 'sets': 4}
+NAMES = dict((v, k) for k, v in OPCODES.items())
+
+
+def checksum(data):
+  s = 0
+  for b in bytearray(data):
+    s ^= b
+  return s
+
+
+def frame(magic, payload):
+  return struct.pack('<BH', magic, len(payload)) + payload + struct.pack('<B', checksum(payload))
+
+
+def encode(op, req_id, key, value=None):
+  key = key.encode()
+  payload = struct.pack('<BHB', OPCODES[op], req_id, len(key)) + key
+  if op == 'seti':
+    payload += struct.pack('<i', int(value))
+  elif op == 'sets':
+    value = value.encode()
+    payload += struct.pack('<H', len(value)) + value
+  return frame(REQUEST, payload)
+
+
+def decode(data):
+  data = bytearray(data)
+  if len(data) < 4 or data[0] != REPLY:
+    raise ValueError('not a reply frame')
+  length, = struct.unpack('<H', bytes(data[1:3]))
+  payload = bytes(data[3:3 + length])
+  if len(data) != length + 4 or checksum(payload) != data[-1]:
+    raise ValueError('bad length or checksum')
+  op, req_id, code = struct.unpack('<BHi', payload[:7])
+  reply = {'op': NAMES.get(op, op), 'id': req_id, 'code': code}
+  value = payload[7:]
+  if code == 0 and op == OPCODES['geti']:
+    reply['value'], = struct.unpack('<i', value)
+  elif code == 0 and op == OPCODES['gets']:
+    n, = struct.unpack('<H', value[:2])
+    reply['value'] = value[2:2 + n].decode('utf-8', 'replace')
+  return reply
+
+
+def main():
+  if len(sys.argv) < 3:
+    print(open(__file__).read().split('# USAGE:')[1].split('\n\n')[0])
+    sys.exit(1)
+  if sys.argv[1] == 'decode':
+    for h in sys.argv[2:]:
+      print(decode(bytearray.fromhex(h.lstrip('~'))))
+    return
+  print(''.join('%02x' % b for b in bytearray(encode(sys.argv[1], int(sys.argv[2]), *sys.argv[3:]))))
+
+
+if __name__ == '__main__':
+  main()
@@ -1,3 +1,28 @@
 package config
 
 modules cmd: _CORE_MODULE
+
+modules cmd fields queued: _UINT16 & _HTTP & {
+  default: 0
+}
+
+modules cmd fields max_queued: _UINT16 & _HTTP & {
+  default: 0
+}
+
+modules cmd fields rejected: _UINT32 & _HTTP & {
+  default: 0
+}
+
+modules cmd fields latency: _UINT32 & _HTTP & {
+  default: 0
+}
+
+modules cmd fields max_latency: _UINT32 & _HTTP & {
+  default: 0
+}
+
+modules cmd fields boot_script_delete: _INT8 & _NVS & _HTTP_RW & {
+  nvs key: "CMD_BOOT_DEL"
+  default: 0
+}
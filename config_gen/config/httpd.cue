@@ -6,5 +6,6 @@ modules httpd fields auth: _STRING & _NVS & _HTTP_RW & {
   nosend: true
   remote: false
   nvs key: "AUTH_HDR"
+  write_cb: true
   default: ""
 }
@@ -0,0 +1,15 @@
+package config
+
+modules log: _CORE_MODULE
+
+modules log fields binary: _INT8 & _NVS & _HTTP_RW & {
+  nvs key: "LOG_BIN"
+  write_cb: true
+  default: 0
+}
+
+modules log fields levels: _STRING & _NVS & _HTTP_RW & {
+  nvs key: "LOG_LVLS"
+  write_cb: true
+  default: ""
+}
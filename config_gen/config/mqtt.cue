@@ -18,3 +18,25 @@ modules mqtt fields clientid: _STRING & _NVS & _HTTP_RW & {
   nvs key: "BRKR_CLID"
   default: ""
 }
+
+modules mqtt fields log_dropped: _UINT32 & _HTTP & {
+  default: 0
+}
+
+modules mqtt fields log_truncated: _UINT32 & _HTTP & {
+  default: 0
+}
+
+modules mqtt fields log_overflowed: _UINT32 & _HTTP & {
+  default: 0
+}
+
+modules mqtt fields compress: _INT8 & _NVS & _HTTP_RW & {
+  nvs key: "BRKR_CMPR"
+  default: 0
+}
+
+// raw bytes / sent bytes, x100
+modules mqtt fields compress_ratio: _UINT32 & _HTTP & {
+  default: 0
+}
@@ -40,3 +40,15 @@ modules ota fields ota_start: _INT8 & _HTTP_RW & {
   write_cb: true
   default: 0
 }
+
+modules ota fields progress: _INT8 & _HTTP & {
+  default: 0
+}
+
+modules ota fields received: _UINT32 & _HTTP & {
+  default: 0
+}
+
+modules ota fields speed: _UINT32 & _HTTP & {
+  default: 0
+}
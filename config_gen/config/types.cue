@@ -16,6 +16,7 @@ _MODULE: {
   core: bool | *false
   i2c: bool | *false
   array_len: int | *0
+  log_level: "none" | "error" | "warn" | *"info" | "debug" | "verbose"
   fields: {}
 }
 
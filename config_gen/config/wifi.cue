@@ -42,3 +42,11 @@ modules wifi fields mdns_domain: _STRING & _NVS & _HTTP_RW & {
 
 modules wifi fields ip: _STRING & _HTTP & {
 }
+
+modules wifi fields reconnects: _UINT32 & _HTTP & {
+  default: 0
+}
+
+modules wifi fields connect_time: _UINT32 & _HTTP & {
+  default: 0
+}
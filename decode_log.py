@@ -0,0 +1,149 @@
+#!/usr/bin/env python
+
+# Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+# Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Turns binary structured log records back into the usual text lines, and
+# unpacks the batched (optionally LZ4 compressed) frames sent when
+# BROKER_COMPRESS is set.
+#
+# Input is one record or frame per line, as hex, which is what
+#   mosquitto_sub -t <channel> -F %x
+# prints. Lines that are neither are printed as-is.
+#
+# USAGE: ./decode_log.py [captured_log.txt ...]
+
+import os
+import re
+import struct
+import sys
+
+MARKER = 0xB1
+FRAME_RAW = 0xC0
+FRAME_LZ = 0xC1
+TAGS = ['NOSEND', 'MSG', 'EVENT', 'METRIC']
+CATALOG = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'main', 'core', 'log', 'log_messages.h')
+
+
+def load_catalog(path):
+  messages = []
+  with open(path) as f:
+    for m in re.finditer(r'SGO_LOG_MESSAGE\((\w+),\s*"(\w*)",\s*"((?:[^"\\]|\\.)*)"\)', f.read()):
+      if m.group(1) == 'id':
+        continue
+      messages.append((m.group(1), m.group(2), m.group(3)))
+  return messages
+
+
+def decode_record(data, messages):
+  tag, msg, timestamp = struct.unpack_from('<BHI', data, 1)
+  if msg >= len(messages):
+    raise ValueError('unknown message id %d' % msg)
+  _, args, fmt = messages[msg]
+  values = []
+  p = 8
+  for a in args:
+    if a == 's':
+      l = data[p]
+      values.append(data[p + 1:p + 1 + l].decode('utf-8', 'replace'))
+      p += 1 + l
+    elif p + 4 <= len(data):
+      values.append(struct.unpack_from('<I' if a == 'u' else '<i', data, p)[0])
+      p += 4
+  fmt = re.sub(r'%[0-9]*[dui]', '%d', fmt)
+  return 'I (%d) %s: %s' % (timestamp, TAGS[tag], fmt % tuple(values))
+
+
+def lz_decompress(src, size):
+  dst = bytearray()
+  p = 0
+  while p < len(src):
+    token = src[p]
+    p += 1
+    n = token >> 4
+    if n == 15:
+      while True:
+        n += src[p]
+        p += 1
+        if src[p - 1] != 255:
+          break
+    dst += src[p:p + n]
+    p += n
+    if p >= len(src):
+      break
+    offset = src[p] | (src[p + 1] << 8)
+    p += 2
+    n = token & 15
+    if n == 15:
+      while True:
+        n += src[p]
+        p += 1
+        if src[p - 1] != 255:
+          break
+    n += 4
+    if offset == 0 or offset > len(dst):
+      raise ValueError('bad match offset %d' % offset)
+    for _ in range(n):
+      dst.append(dst[-offset])
+  if len(dst) != size:
+    raise ValueError('decompressed %d bytes, expected %d' % (len(dst), size))
+  return dst
+
+
+def decode_frame(data, messages):
+  size = struct.unpack_from('<H', data, 1)[0]
+  batch = lz_decompress(data[3:], size) if data[0] == FRAME_LZ else data[3:3 + size]
+  lines = []
+  p = 0
+  while p < len(batch):
+    l = struct.unpack_from('<H', batch, p)[0]
+    record = batch[p + 2:p + 2 + l]
+    p += 2 + l
+    if len(record) and record[0] == MARKER:
+      lines.append(decode_record(record, messages))
+    else:
+      lines.append(record.decode('utf-8', 'replace').rstrip('\n'))
+  return lines
+
+
+def decode_line(line, messages):
+  hexline = line.strip()
+  if len(hexline) >= 8 and len(hexline) % 2 == 0 and re.match(r'^[0-9a-fA-F]+$', hexline):
+    data = bytearray.fromhex(hexline)
+    if data[0] in (FRAME_RAW, FRAME_LZ):
+      return decode_frame(data, messages)
+    if data[0] == MARKER and len(data) >= 8:
+      return [decode_record(data, messages)]
+  return [line.rstrip('\n')]
+
+
+def main():
+  messages = load_catalog(CATALOG)
+  files = sys.argv[1:] or ['-']
+  for name in files:
+    f = sys.stdin if name == '-' else open(name)
+    for line in f:
+      try:
+        for decoded in decode_line(line, messages):
+          print(decoded)
+      except (ValueError, IndexError, struct.error) as e:
+        sys.stderr.write('Could not decode record %s: %s\n' % (line.strip(), e))
+    if f is not sys.stdin:
+      f.close()
+
+
+if __name__ == '__main__':
+  main()
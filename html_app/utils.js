@@ -36,54 +36,119 @@ const schedule_promise = (n, retries) => {
 }
 const fetchQueue = schedule_promise(3, 3)
 
+// /schema keys are compacted, see main/core/httpd/schema.json.template
+const expandSchema = function(schema) {
+  return {
+    name: schema.name,
+    keys: schema.keys.map(k => ({
+      core: !!k.c,
+      name: k.n,
+      type: k.t == 'i' ? 'integer' : 'string',
+      integer: k.t == 'i',
+      caps_name: k.n.toUpperCase(),
+      module: k.m,
+      helper: k.h,
+      write: !!k.w,
+      array: k.a ? {name: k.a[0], len: k.a[1], index: k.a[2], param: k.a[3]} : undefined,
+      indir: k.x ? {values: k.x[0], helpers: k.x[1]} : undefined,
+      default: k.d,
+    })),
+  }
+}
+
 const fetchConfig = async function() {
   return new Promise(function(resolve, reject) {
     const r = new XMLHttpRequest()
-    r.open('GET', DEBUG ? '/config.json' : '/fs/config.json', true)
+    r.open('GET', `${DEBUG ? URL : ''}/schema`, true)
     r.onreadystatechange = function () {
       if (r.readyState != 4) return
       if (r.status != 200) {
         reject(r.status, r.responseText)
         return
       }
-      resolve(JSON.parse(r.responseText))
+      resolve(expandSchema(JSON.parse(r.responseText)))
     }
     r.send()
   })
 }
 
-const fetchParam = async function(type, paramName) {
+// Values are fetched in batches through /kv, requests made in the same tick are grouped
+const MAX_KV_QUERY_LENGTH = 400
+let pendingParams = {}
+let pendingTimeout = null
+
+const fetchParams = async function(names) {
   return fetchQueue(() => new Promise(function(resolve, reject) {
     const r = new XMLHttpRequest()
-    r.open('GET', `${DEBUG ? URL : ''}/${type}?k=${paramName}`, true)
+    r.open('GET', `${DEBUG ? URL : ''}/kv?k=${names.join(',')}`, true)
     r.onreadystatechange = function () {
       if (r.readyState != 4) return
       if (r.status != 200) {
-        reject(r.status, r.responseText)
+        reject({status: r.status})
         return
       }
-      if (type == 'i') {
-        resolve(parseInt(r.responseText))
-      } else {
-        resolve(r.responseText);
-      }
+      resolve(JSON.parse(r.responseText))
     }
     r.send()
   }))
 }
 
+const flushParams = function() {
+  const params = pendingParams
+  pendingParams = {}
+  pendingTimeout = null
+
+  const groups = [[]]
+  let length = 0
+  Object.keys(params).forEach(n => {
+    if (length + n.length + 1 > MAX_KV_QUERY_LENGTH) {
+      groups.push([])
+      length = 0
+    }
+    groups[groups.length - 1].push(n)
+    length += n.length + 1
+  })
+
+  groups.forEach(names => {
+    fetchParams(names)
+      .then(values => names.forEach(n => {
+        if (values[n] === null || values[n] === undefined) {
+          params[n].forEach(p => p.reject({status: 404}))
+        } else {
+          params[n].forEach(p => p.resolve(values[n]))
+        }
+      }))
+      .catch(e => names.forEach(n => params[n].forEach(p => p.reject(e))))
+  })
+}
+
+const fetchParam = async function(type, paramName) {
+  return new Promise(function(resolve, reject) {
+    pendingParams[paramName] = pendingParams[paramName] || []
+    pendingParams[paramName].push({resolve, reject})
+    if (!pendingTimeout) {
+      pendingTimeout = setTimeout(flushParams, 0)
+    }
+  })
+}
+
 const updateParam = async function(type, paramName, value) {
   return fetchQueue(() => new Promise(function(resolve, reject) {
     const r = new XMLHttpRequest()
-    r.open('POST', `${DEBUG ? URL : ''}/${type}?k=${paramName}&v=${encodeURIComponent(value)}`, true)
+    r.open('POST', `${DEBUG ? URL : ''}/kv`, true)
     r.onreadystatechange = function () {
       if (r.readyState != 4) return
       if (r.status != 200) {
-        reject(r.status, r.responseText)
+        reject({status: r.status})
         return
       }
-      resolve(r.responseText);
+      const res = JSON.parse(r.responseText)
+      if (res.failed.length) {
+        reject({status: 404})
+        return
+      }
+      resolve(res);
     }
-    r.send()
+    r.send(`${paramName}=${encodeURIComponent(value)}`)
   }))
 }
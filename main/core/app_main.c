@@ -47,6 +47,7 @@ void app_main() {
   mqtt_intercept_log();
 
   init_kv();
+  init_log();
   set_n_restarts(get_n_restarts()+1);
 
   preinit_app();
@@ -75,5 +76,7 @@ void app_main() {
 
   init_httpd();
 
+  run_boot_script();
+
   fflush(stdout);
 }
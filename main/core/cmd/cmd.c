@@ -18,50 +18,297 @@
 
 #include "cmd.h"
 
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
 #include "esp_console.h"
 #include "argtable3/argtable3.h"
 
 #include "../log/log.h"
 #include "../kv/kv.h"
 #include "../kv/kv_mapping.h"
+#include "../mqtt/mqtt.h"
 
-static QueueHandle_t cmd;
-static char buf_cmd[MAX_CMD_LENGTH] = {0};
+/*
+ * Commands are run in order, one at a time, by cmd_task. Remote commands
+ * get a JSON reply on the MQTT reply channel, keyed by their id:
+ *
+ *   {"id":"<id>","status":"ok","code":0,"value":<value>}
+ *   {"id":"<id>","status":"error","code":<esp_err_t>,"error":"<message>"}
+ *
+ * Batches run all their commands in one go and only reply with a summary:
+ *
+ *   {"id":"<batch id>","status":"ok"|"error","total":<n>,"failed":<n>,
+ *    "errors":[{"id":"<id>","code":<esp_err_t>,"error":"<message>"},...]}
+ */
+
+#define MAX_CMD_ID_LENGTH 64
+#define MAX_BATCH_ERRORS 8
+#define MAX_CMD_REPLY_LENGTH (MAX_KVALUE_SIZE * 2 + 128)
+
+#define CMD_SCRIPT_DIR "/spiffs"
+#define CMD_BOOT_SCRIPT "boot"
+#define MAX_SCRIPT_PATH_LENGTH 64
+#define MAX_SCRIPT_SIZE 16384
+
+/*
+ * Pending commands are stored back to back in one ring buffer per source,
+ * and cmd_task takes them from each source in turn, so a burst from one
+ * source doesn't hold back the other. When a buffer is full, local commands
+ * wait for room (backpressure on the terminal or script feeding them), remote
+ * commands are rejected with an error reply. Each command gets a sequence
+ * number, which follows it in the logs until it's done.
+ */
+#define CMD_BUFFER_SIZE CONFIG_SGO_CMD_BUFFER_SIZE
+#define CMD_LOCAL_TIMEOUT (5000 / portTICK_PERIOD_MS)
+
+typedef enum {
+  CMD_SOURCE_LOCAL,
+  CMD_SOURCE_REMOTE,
+  N_CMD_SOURCES,
+} cmd_source;
+
+typedef struct {
+  uint32_t seq;
+  TickType_t queued_at;
+  bool remote;
+  char *batch; // newline separated commands, owned by the item
+  size_t batch_len;
+  size_t bin_len; // set for binary commands
+  // the command, the batch id, or the binary frame, only stored up to its end
+  char str[MAX_CMD_BIN_LENGTH];
+} cmd_item;
+
+#define CMD_ITEM_SIZE(item) (offsetof(cmd_item, str) + ((item)->bin_len ? (item)->bin_len : strlen((item)->str) + 1))
+// as many as both queues can hold of the smallest item, so giving never fails
+#define MAX_PENDING_CMDS (N_CMD_SOURCES * CMD_BUFFER_SIZE / (offsetof(cmd_item, str) + 1))
+
+static RingbufHandle_t queues[N_CMD_SOURCES] = {0};
+// counts the items in all queues, cmd_task waits on it
+static SemaphoreHandle_t pending;
+
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t next_seq = 0;
+static uint32_t n_rejected = 0;
+static uint16_t n_max_queued = 0;
+
+// filled by the command functions, only accessed from cmd_task
+static struct {
+  bool has_value;
+  bool is_str;
+  int ivalue;
+  char svalue[MAX_KVALUE_SIZE];
+  const char *error;
+} result;
+
+static void cmd_result_int(int value) {
+  result.has_value = true;
+  result.is_str = false;
+  result.ivalue = value;
+}
+
+static void cmd_result_str(const char *value) {
+  result.has_value = true;
+  result.is_str = true;
+  strncpy(result.svalue, value, MAX_KVALUE_SIZE - 1);
+}
+
+static int cmd_error(int code, const char *error) {
+  result.error = error;
+  return code;
+}
 
-void execute_cmd(int length, const char *cmdData, bool remote) {
+// esp_console doesn't expose the parsed arguments, so the id is looked up before running the command
+static void find_cmd_id(const char *str, char *id, size_t len) {
+  id[0] = 0;
+  while (*str) {
+    while (*str == ' ') ++str;
+    const char *end = strchr(str, ' ');
+    if (!end) end = str + strlen(str);
+
+    const char *value = NULL;
+    if (end - str == 2 && strncmp(str, "-i", 2) == 0) {
+      value = end;
+    } else if (end - str == 4 && strncmp(str, "--id", 4) == 0) {
+      value = end;
+    } else if (end - str > 5 && strncmp(str, "--id=", 5) == 0) {
+      value = str + 5;
+    }
+    if (value) {
+      while (*value == ' ') ++value;
+      size_t n = strcspn(value, " ");
+      n = n < len - 1 ? n : len - 1;
+      memcpy(id, value, n);
+      id[n] = 0;
+      return;
+    }
+    str = end;
+  }
+}
+
+static size_t json_escape(char *dst, size_t len, const char *src) {
+  size_t n = 0;
+  for (; *src && n + 7 < len; ++src) {
+    unsigned char c = *src;
+    if (c == '"' || c == '\\') {
+      dst[n++] = '\\';
+      dst[n++] = c;
+    } else if (c < 0x20) {
+      n += sprintf(&dst[n], "\\u%04x", c);
+    } else {
+      dst[n++] = c;
+    }
+  }
+  dst[n] = 0;
+  return n;
+}
+
+static void reply_cmd(const char *id, int code, const char *error) {
+  char reply[MAX_CMD_REPLY_LENGTH] = {0};
+  size_t n = 0;
+
+  n += snprintf(&reply[n], sizeof(reply) - n, "{\"id\":\"");
+  n += json_escape(&reply[n], sizeof(reply) - n, id);
+  if (code != ESP_OK) {
+    n += snprintf(&reply[n], sizeof(reply) - n, "\",\"status\":\"error\",\"code\":%d,\"error\":\"", code);
+    n += json_escape(&reply[n], sizeof(reply) - n, error ? error : esp_err_to_name(code));
+    n += snprintf(&reply[n], sizeof(reply) - n, "\"}");
+  } else if (result.has_value && result.is_str) {
+    n += snprintf(&reply[n], sizeof(reply) - n, "\",\"status\":\"ok\",\"code\":0,\"value\":\"");
+    n += json_escape(&reply[n], sizeof(reply) - n, result.svalue);
+    n += snprintf(&reply[n], sizeof(reply) - n, "\"}");
+  } else if (result.has_value) {
+    n += snprintf(&reply[n], sizeof(reply) - n, "\",\"status\":\"ok\",\"code\":0,\"value\":%d}", result.ivalue);
+  } else {
+    n += snprintf(&reply[n], sizeof(reply) - n, "\",\"status\":\"ok\",\"code\":0}");
+  }
+  mqtt_reply(reply, n);
+}
+
+static bool prepare_cmd(cmd_item *item, int length, const char *cmdData, bool remote) {
   if (length > MAX_CMD_LENGTH-1) {
     ESP_LOGE(SGO_LOG_EVENT, "@CMD Sending command failed, too long.");
-  } else {
-    char cmdStr[MAX_CMD_LENGTH] = {0};
-    memcpy(cmdStr, cmdData, length);
-    for (int i = 0; i < length; ++i) {
-      if (cmdStr[i] == ';') {
-        cmdStr[i] = ' ';
-      }
-      if (remote == true && i > 0 && cmdStr[i] == 'r' && cmdStr[i-1] == '-') {
-        cmdStr[i-1] = ' ';
-        cmdStr[i] = ' ';
-        int ifrom = i;
-        for (++i; i < length; ++i) {
-          if (cmdStr[i] == ' ' && cmdStr[i-1] != ' ') {
-            break;
-          }
+    return false;
+  }
+  memset(item->str, 0, MAX_CMD_LENGTH);
+  item->remote = remote;
+  char *cmdStr = item->str;
+  memcpy(cmdStr, cmdData, length);
+  for (int i = 0; i < length; ++i) {
+    if (cmdStr[i] == ';') {
+      cmdStr[i] = ' ';
+    }
+    if (remote == true && i > 0 && cmdStr[i] == 'r' && cmdStr[i-1] == '-') {
+      cmdStr[i-1] = ' ';
+      cmdStr[i] = ' ';
+      int ifrom = i;
+      for (++i; i < length; ++i) {
+        if (cmdStr[i] == ' ' && cmdStr[i-1] != ' ') {
+          break;
         }
-        memset(&(cmdStr[ifrom]), ' ', i - ifrom);
       }
+      memset(&(cmdStr[ifrom]), ' ', i - ifrom);
     }
-    if (remote == true) {
-      strcpy(&(cmdStr[length]), " -r 1");
-    } else {
-      strcpy(&(cmdStr[length]), " -r 0");
+  }
+  if (remote == true) {
+    strcpy(&(cmdStr[length]), " -r 1");
+  } else {
+    strcpy(&(cmdStr[length]), " -r 0");
+  }
+  return true;
+}
+
+static bool enqueue_cmd(cmd_item *item) {
+  cmd_source source = item->remote ? CMD_SOURCE_REMOTE : CMD_SOURCE_LOCAL;
+  portENTER_CRITICAL(&stats_mux);
+  item->seq = ++next_seq;
+  portEXIT_CRITICAL(&stats_mux);
+  item->queued_at = xTaskGetTickCount();
+
+  TickType_t timeout = item->remote ? 0 : CMD_LOCAL_TIMEOUT;
+  if (queues[source] == NULL || xRingbufferSend(queues[source], item, CMD_ITEM_SIZE(item), timeout) != pdTRUE) {
+    portENTER_CRITICAL(&stats_mux);
+    uint32_t rejected = ++n_rejected;
+    portEXIT_CRITICAL(&stats_mux);
+    set_cmd_rejected(rejected);
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD (#%u) Command queue full", item->seq);
+    return false;
+  }
+  if (xSemaphoreGive(pending) != pdTRUE) {
+    // can't happen with MAX_PENDING_CMDS, the item would wait for the next one
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD (#%u) Pending count full", item->seq);
+  }
+
+  uint16_t queued = uxSemaphoreGetCount(pending);
+  bool is_max = false;
+  portENTER_CRITICAL(&stats_mux);
+  if (queued > n_max_queued) {
+    n_max_queued = queued;
+    is_max = true;
+  }
+  portEXIT_CRITICAL(&stats_mux);
+  if (is_max) {
+    set_cmd_max_queued(queued);
+  }
+  set_cmd_queued(queued);
+  return true;
+}
+
+bool execute_cmd(int length, const char *cmdData, bool remote) {
+  cmd_item new_item = {0};
+  if (!prepare_cmd(&new_item, length, cmdData, remote)) {
+    return false;
+  }
+  if (!enqueue_cmd(&new_item)) {
+    if (remote) {
+      char id[MAX_CMD_ID_LENGTH] = {0};
+      find_cmd_id(new_item.str, id, sizeof(id));
+      reply_cmd(id, ESP_ERR_NO_MEM, "command queue full");
     }
-    xQueueSend(cmd, cmdStr, 0);
+    return false;
   }
+  return true;
+}
+
+bool execute_cmd_bin(const uint8_t *frame, size_t len, bool remote) {
+  if (!check_cmd_bin(frame, len)) {
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD Malformed binary command frame");
+    return false;
+  }
+  cmd_item new_item = {.remote = remote, .bin_len = len};
+  memcpy(new_item.str, frame, len);
+  if (!enqueue_cmd(&new_item)) {
+    reject_cmd_bin(frame, len, remote, ESP_ERR_NO_MEM);
+    return false;
+  }
+  return true;
+}
+
+bool execute_cmd_batch(const char *id, int length, const char *cmds) {
+  cmd_item new_item = {.remote = true, .batch_len = length};
+  strncpy(new_item.str, id, MAX_CMD_ID_LENGTH - 1);
+  new_item.batch = malloc(length);
+  if (new_item.batch == NULL) {
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD (%s) Unable to allocate batch", id);
+    reply_cmd(id, ESP_ERR_NO_MEM, "unable to allocate batch");
+    return false;
+  }
+  memcpy(new_item.batch, cmds, length);
+  if (!enqueue_cmd(&new_item)) {
+    free(new_item.batch);
+    reply_cmd(id, ESP_ERR_NO_MEM, "command queue full");
+    return false;
+  }
+  return true;
 }
 
 static struct {
@@ -77,7 +324,7 @@ static int seti_cmd_fn(int argc, char **argv) {
   if (nerrors != 0) {
     arg_print_errors(stderr, seti_args.end, argv[0]);
     ESP_LOGE(SGO_LOG_EVENT, "@CMD (%s) parameter error", seti_args.id->sval[0]);
-    return 1;
+    return cmd_error(ESP_ERR_INVALID_ARG, "parameter error");
   }
 
   bool remote = seti_args.remote->ival[0] == 1;
@@ -98,7 +345,7 @@ static int seti_cmd_fn(int argc, char **argv) {
 
   if (!is_i8 && !is_ui8 && !is_i16 && !is_ui16 && !is_i32 && !is_ui32) {
     ESP_LOGE(SGO_LOG_EVENT, "@CMD (%s) %s: Key not found or readonly", seti_args.id->sval[0], name);
-    return 1;
+    return cmd_error(ESP_ERR_NOT_FOUND, "key not found or readonly");
   }
 
   const int value = seti_args.value->ival[0];
@@ -118,8 +365,9 @@ static int seti_cmd_fn(int argc, char **argv) {
     hui32->setter((uint32_t)value);
   }
 
-  ESP_LOGI(SGO_LOG_METRIC, "@KV %s=%d", name, value);
-  ESP_LOGI(SGO_LOG_EVENT, "@CMD (%s) done", seti_args.id->sval[0]);
+  cmd_result_int(value);
+  SGO_LOGI_STRUCT(SGO_LOG_METRIC, SGO_MSG_KV_INT, name, value);
+  SGO_LOGI_STRUCT(SGO_LOG_EVENT, SGO_MSG_CMD_DONE, seti_args.id->sval[0]);
   return 0;
 }
 
@@ -135,7 +383,7 @@ static int geti_cmd_fn(int argc, char **argv) {
   if (nerrors != 0) {
     arg_print_errors(stderr, geti_args.end, argv[0]);
     ESP_LOGE(SGO_LOG_EVENT, "@CMD (%s) parameter error", geti_args.id->sval[0]);
-    return 1;
+    return cmd_error(ESP_ERR_INVALID_ARG, "parameter error");
   }
 
   bool remote = geti_args.remote->ival[0] == 1;
@@ -150,7 +398,7 @@ static int geti_cmd_fn(int argc, char **argv) {
 
   if (!hi8 && !hui8 && !hi16 && !hui16 && !hi32 && !hui32) {
     ESP_LOGE(SGO_LOG_EVENT, "@CMD (%s) %s: Key not found or readonly", geti_args.id->sval[0], name);
-    return 1;
+    return cmd_error(ESP_ERR_NOT_FOUND, "key not found or readonly");
   }
 
   int v = 0;
@@ -168,8 +416,9 @@ static int geti_cmd_fn(int argc, char **argv) {
     v = hui32->getter();
   }
 
-  ESP_LOGI(SGO_LOG_METRIC, "@KV %s=%d", name, v);
-  ESP_LOGI(SGO_LOG_EVENT, "@CMD (%s) done", geti_args.id->sval[0]);
+  cmd_result_int(v);
+  SGO_LOGI_STRUCT(SGO_LOG_METRIC, SGO_MSG_KV_INT, name, v);
+  SGO_LOGI_STRUCT(SGO_LOG_EVENT, SGO_MSG_CMD_DONE, geti_args.id->sval[0]);
   return ESP_OK;
 }
 
@@ -187,7 +436,7 @@ static int sets_cmd_fn(int argc, char **argv) {
   if (nerrors != 0) {
     arg_print_errors(stderr, sets_args.end, argv[0]);
     ESP_LOGE(SGO_LOG_EVENT, "@CMD (%s) parameter error", sets_args.id->sval[0]);
-    return 1;
+    return cmd_error(ESP_ERR_INVALID_ARG, "parameter error");
   }
 
   bool remote = sets_args.remote->ival[0] == 1;
@@ -196,15 +445,16 @@ static int sets_cmd_fn(int argc, char **argv) {
   const kvs_mapping *h = get_kvs_mapping(name, remote);
   if (!h || !h->setter) {
     ESP_LOGE(SGO_LOG_EVENT, "@CMD (%s) %s: Key not found or readonly", sets_args.id->sval[0], name);
-    return 1;
+    return cmd_error(ESP_ERR_NOT_FOUND, "key not found or readonly");
   }
 
   const char *value = sets_args.value->sval[0];
   // TODO use return value
   h->setter(value);
 
-  ESP_LOGI(SGO_LOG_METRIC, "@KV %s=%s", name, value);
-  ESP_LOGI(SGO_LOG_EVENT, "@CMD (%s) done", sets_args.id->sval[0]);
+  cmd_result_str(value);
+  SGO_LOGI_STRUCT(SGO_LOG_METRIC, SGO_MSG_KV_STR, name, value);
+  SGO_LOGI_STRUCT(SGO_LOG_EVENT, SGO_MSG_CMD_DONE, sets_args.id->sval[0]);
   return 0;
 }
 
@@ -220,7 +470,7 @@ static int gets_cmd_fn(int argc, char **argv) {
   if (nerrors != 0) {
     arg_print_errors(stderr, gets_args.end, argv[0]);
     ESP_LOGE(SGO_LOG_EVENT, "@CMD (%s) parameter error", gets_args.id->sval[0]);
-    return 1;
+    return cmd_error(ESP_ERR_INVALID_ARG, "parameter error");
   }
 
   bool remote = gets_args.remote->ival[0] == 1;
@@ -229,17 +479,223 @@ static int gets_cmd_fn(int argc, char **argv) {
   const kvs_mapping *h = get_kvs_mapping(name, remote);
   if (!h) {
     ESP_LOGE(SGO_LOG_EVENT, "@CMD (%s) %s: Key not found or readonly", gets_args.id->sval[0], name);
-    return 1;
+    return cmd_error(ESP_ERR_NOT_FOUND, "key not found or readonly");
   }
 
   char v[MAX_KVALUE_SIZE] = {0};
   h->getter(v, MAX_KVALUE_SIZE - 1);
 
-  ESP_LOGI(SGO_LOG_METRIC, "@KV %s=%s", name, v);
-  ESP_LOGI(SGO_LOG_EVENT, "@CMD (%s) done", gets_args.id->sval[0]);
+  cmd_result_str(v);
+  SGO_LOGI_STRUCT(SGO_LOG_METRIC, SGO_MSG_KV_STR, name, v);
+  SGO_LOGI_STRUCT(SGO_LOG_EVENT, SGO_MSG_CMD_DONE, gets_args.id->sval[0]);
+  return ESP_OK;
+}
+
+
+// returns false if there was nothing to run
+static bool run_cmd(char *str, int *code) {
+  memset(&result, 0, sizeof(result));
+
+  int ret;
+  esp_err_t err = esp_console_run(str, &ret);
+  if (err == ESP_ERR_NOT_FOUND) {
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD Unrecognized command\n");
+    result.error = "unknown command";
+  } else if (err == ESP_ERR_INVALID_ARG) {
+    // command was empty
+    return false;
+  } else if (err == ESP_OK && ret != ESP_OK) {
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD Command returned non-zero error code: 0x%x (%s)\n", ret, esp_err_to_name(ret));
+  } else if (err != ESP_OK) {
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD Internal error: %s\n", esp_err_to_name(err));
+  }
+  *code = err == ESP_OK ? ret : err;
+  return true;
+}
+
+// runs all the commands in one NVS commit, fills reply with the batch summary,
+// returns the number of failed commands
+static int run_batch(const char *batch_id, const char *batch, size_t len, bool remote, char *reply, size_t reply_len) {
+  static cmd_item batch_item;
+  char errors[MAX_CMD_REPLY_LENGTH / 2] = {0};
+  size_t n_errors = 0;
+  int n_cmds = 0, n_failed = 0, n_line = 0;
+
+  begin_kv_batch();
+  const char *end = batch + len;
+  for (const char *line = batch; line < end;) {
+    const char *eol = memchr(line, '\n', end - line);
+    if (!eol) eol = end;
+    int length = eol - line;
+    const char *cmd_str = line;
+    line = eol + 1;
+    ++n_line;
+
+    if (length > 0 && cmd_str[length - 1] == '\r') {
+      --length;
+    }
+    if (length == 0 || cmd_str[0] == '#') {
+      continue;
+    }
+    char id[MAX_CMD_ID_LENGTH] = {0};
+    int code;
+    const char *error;
+    if (!prepare_cmd(&batch_item, length, cmd_str, remote)) {
+      // counted as failed, a skipped line must not look like a success
+      snprintf(id, sizeof(id), "line %d", n_line);
+      code = ESP_ERR_INVALID_SIZE;
+      error = "command too long";
+    } else {
+      find_cmd_id(batch_item.str, id, sizeof(id));
+      if (id[0] == 0) {
+        snprintf(id, sizeof(id), "line %d", n_line);
+      }
+      if (!run_cmd(batch_item.str, &code)) {
+        continue;
+      }
+      error = result.error ? result.error : esp_err_to_name(code);
+    }
+    ++n_cmds;
+    if (code == ESP_OK) {
+      continue;
+    }
+    if (++n_failed > MAX_BATCH_ERRORS || n_errors + 2 * MAX_CMD_ID_LENGTH + 64 > sizeof(errors)) {
+      continue;
+    }
+    n_errors += snprintf(&errors[n_errors], sizeof(errors) - n_errors, "%s{\"id\":\"", n_failed > 1 ? "," : "");
+    n_errors += json_escape(&errors[n_errors], MAX_CMD_ID_LENGTH, id);
+    n_errors += snprintf(&errors[n_errors], sizeof(errors) - n_errors, "\",\"code\":%d,\"error\":\"%s\"}", code, error);
+  }
+  esp_err_t err = end_kv_batch();
+
+  ESP_LOGI(SGO_LOG_EVENT, "@CMD (%s) batch done, %d commands, %d failed", batch_id, n_cmds, n_failed);
+
+  size_t n = snprintf(reply, reply_len, "{\"id\":\"");
+  n += json_escape(&reply[n], reply_len - n, batch_id);
+  n += snprintf(&reply[n], reply_len - n, "\",\"status\":\"%s\",\"total\":%d,\"failed\":%d,\"errors\":[%s]}", n_failed || err != ESP_OK ? "error" : "ok", n_cmds, n_failed, errors);
+  return err != ESP_OK ? n_failed + 1 : n_failed;
+}
+
+/*
+ * Scripts are text files on SPIFFS with one command per line, lines starting
+ * with # are comments. They run like a batch, in one NVS commit, and the batch
+ * summary is written next to them, /spiffs/<name>.log. NVS has no rollback, so
+ * a failed command doesn't undo the ones before it, it only keeps the script
+ * from being deleted.
+ */
+static bool running_script = false;
+
+static void script_path(char *path, size_t len, const char *name, const char *ext) {
+  if (name[0] == '/') {
+    snprintf(path, len, "%s", name);
+    char *dot = strrchr(path, '.');
+    if (dot && strrchr(path, '/') < dot) {
+      *dot = 0;
+    }
+  } else {
+    snprintf(path, len, "%s/%s", CMD_SCRIPT_DIR, name);
+  }
+  strncat(path, ext, len - strlen(path) - 1);
+}
+
+static int run_script(const char *id, const char *name, bool remote, bool delete_after) {
+  char path[MAX_SCRIPT_PATH_LENGTH] = {0};
+  script_path(path, sizeof(path), name, ".cmd");
+
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD (%s) Script %s not found", id, path);
+    return cmd_error(ESP_ERR_NOT_FOUND, "script not found");
+  }
+  if (st.st_size > MAX_SCRIPT_SIZE) {
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD (%s) Script %s too large (%d bytes, max %d)", id, path, (int)st.st_size, MAX_SCRIPT_SIZE);
+    return cmd_error(ESP_ERR_INVALID_SIZE, "script too large");
+  }
+  // an empty script is an empty batch, malloc(0) may return NULL
+  char *script = st.st_size ? malloc(st.st_size) : NULL;
+  if (st.st_size && script == NULL) {
+    return cmd_error(ESP_ERR_NO_MEM, "unable to allocate script");
+  }
+  FILE *f = fopen(path, "r");
+  size_t len = f ? fread(script, 1, st.st_size, f) : 0;
+  if (f) fclose(f);
+  if (len != (size_t)st.st_size) {
+    free(script);
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD (%s) Unable to read script %s", id, path);
+    return cmd_error(ESP_FAIL, "unable to read script");
+  }
+
+  ESP_LOGI(SGO_LOG_EVENT, "@CMD (%s) Running script %s", id, path);
+  char summary[MAX_CMD_REPLY_LENGTH] = {0};
+  running_script = true;
+  int n_failed = run_batch(id, script, len, remote, summary, sizeof(summary));
+  running_script = false;
+  free(script);
+
+  char log_path[MAX_SCRIPT_PATH_LENGTH] = {0};
+  script_path(log_path, sizeof(log_path), path, ".log");
+  f = fopen(log_path, "w");
+  if (f) {
+    fprintf(f, "%s\n", summary);
+    fclose(f);
+  } else {
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD (%s) Unable to write %s", id, log_path);
+  }
+
+  // run_batch reset the result of the commands it ran
+  memset(&result, 0, sizeof(result));
+  if (n_failed) {
+    return cmd_error(ESP_FAIL, "script had errors, see log");
+  }
+  if (delete_after) {
+    ESP_LOGI(SGO_LOG_EVENT, "@CMD (%s) Deleting script %s", id, path);
+    unlink(path);
+  }
+  cmd_result_str(log_path);
   return ESP_OK;
 }
 
+static struct {
+  struct arg_str *id;
+  struct arg_str *name;
+  struct arg_int *delete;
+  struct arg_int *remote;
+  struct arg_end *end;
+} run_args;
+
+static int run_cmd_fn(int argc, char **argv) {
+  int nerrors = arg_parse(argc, argv, (void **) &run_args);
+  if (nerrors != 0) {
+    arg_print_errors(stderr, run_args.end, argv[0]);
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD parameter error");
+    return cmd_error(ESP_ERR_INVALID_ARG, "parameter error");
+  }
+  if (running_script) {
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD Scripts can't run other scripts");
+    return cmd_error(ESP_ERR_INVALID_STATE, "scripts can't be nested");
+  }
+
+  // argv lives in esp_console's line buffer, which the script's commands reuse
+  char id[MAX_CMD_ID_LENGTH] = {0}, name[MAX_SCRIPT_PATH_LENGTH] = {0};
+  strncpy(id, run_args.id->count ? run_args.id->sval[0] : "", sizeof(id) - 1);
+  strncpy(name, run_args.name->sval[0], sizeof(name) - 1);
+  bool delete_after = run_args.delete->count && run_args.delete->ival[0] == 1;
+  bool remote = run_args.remote->ival[0] == 1;
+
+  return run_script(id[0] ? id : name, name, remote, delete_after);
+}
+
+void run_boot_script() {
+  char path[MAX_SCRIPT_PATH_LENGTH] = {0};
+  script_path(path, sizeof(path), CMD_BOOT_SCRIPT, ".cmd");
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return;
+  }
+  char cmd[MAX_CMD_LENGTH] = {0};
+  int len = snprintf(cmd, sizeof(cmd), "run -i boot -n %s -d %d", CMD_BOOT_SCRIPT, get_cmd_boot_script_delete() == 1);
+  execute_cmd(len, cmd, false);
+}
 
 static void cmd_task(void *param) {
   {
@@ -309,38 +765,95 @@ static void cmd_task(void *param) {
     ESP_ERROR_CHECK( esp_console_cmd_register(&gets_cmd) );
   }
 
+  {
+    run_args.id = arg_str0("i", "id", "<s>", "Id");
+    run_args.name = arg_str1("n", "name", "<s>", "Script name, runs " CMD_SCRIPT_DIR "/<name>.cmd");
+    run_args.delete = arg_int0("d", "delete", "<n>", "Delete the script if all its commands succeed");
+    run_args.remote = arg_int1("r", "remote", "<r>", "Remote");
+    run_args.end = arg_end(2);
+
+    const esp_console_cmd_t run_cmd = {
+      .command = "run",
+      .help = "Runs a command script from SPIFFS in one batch",
+      .hint = NULL,
+      .func = &run_cmd_fn,
+      .argtable = &run_args,
+    };
+    ESP_ERROR_CHECK( esp_console_cmd_register(&run_cmd) );
+  }
+
   esp_console_config_t console_config = {
     .max_cmdline_args = 10,
     .max_cmdline_length = MAX_CMD_LENGTH,
   };
   ESP_ERROR_CHECK( esp_console_init(&console_config) );
 
+  cmd_source next = CMD_SOURCE_LOCAL;
+  uint32_t avg_latency = 0, max_latency = 0;
   while (true) {
-    if (xQueueReceive(cmd, buf_cmd, portMAX_DELAY) != pdTRUE) {
+    if (xSemaphoreTake(pending, portMAX_DELAY) != pdTRUE) {
       continue;
     }
-    int ret;
-    esp_err_t err = esp_console_run(buf_cmd, &ret);
-    if (err == ESP_ERR_NOT_FOUND) {
-      ESP_LOGE(SGO_LOG_EVENT, "@CMD Unrecognized command\n");
-    } else if (err == ESP_ERR_INVALID_ARG) {
-      // command was empty
-    } else if (err == ESP_OK && ret != ESP_OK) {
-      ESP_LOGE(SGO_LOG_EVENT, "@CMD Command returned non-zero error code: 0x%x (%s)\n", ret, esp_err_to_name(ret));
-    } else if (err != ESP_OK) {
-      ESP_LOGE(SGO_LOG_EVENT, "@CMD Internal error: %s\n", esp_err_to_name(err));
+    cmd_item *item = NULL;
+    cmd_source source = next;
+    size_t len;
+    for (int i = 0; i < N_CMD_SOURCES && item == NULL; ++i) {
+      source = (next + i) % N_CMD_SOURCES;
+      item = (cmd_item *)xRingbufferReceive(queues[source], &len, 0);
+    }
+    if (item == NULL) {
+      continue;
+    }
+    next = (source + 1) % N_CMD_SOURCES;
+    set_cmd_queued(uxSemaphoreGetCount(pending));
+
+    TickType_t started = xTaskGetTickCount();
+    int code = ESP_OK;
+    if (item->bin_len) {
+      run_cmd_bin((const uint8_t *)item->str, item->bin_len, item->remote);
+    } else if (item->batch) {
+      char reply[MAX_CMD_REPLY_LENGTH] = {0};
+      run_batch(item->str, item->batch, item->batch_len, true, reply, sizeof(reply));
+      mqtt_reply(reply, strlen(reply));
+      free(item->batch);
+    } else {
+      char id[MAX_CMD_ID_LENGTH] = {0};
+      if (item->remote) {
+        find_cmd_id(item->str, id, sizeof(id));
+      }
+      if (run_cmd(item->str, &code) && item->remote) {
+        reply_cmd(id, code, result.error);
+      }
+    }
+    TickType_t done = xTaskGetTickCount();
+    uint32_t seq = item->seq;
+    uint32_t waited = (started - item->queued_at) * portTICK_PERIOD_MS;
+    uint32_t latency = (done - item->queued_at) * portTICK_PERIOD_MS;
+    vRingbufferReturnItem(queues[source], item);
+
+    SGO_LOGD(CMD, SGO_LOG_EVENT, "@CMD (#%u) done, code=%d, waited %ums, ran %ums", seq, code, waited, latency - waited);
+    // moving average over ~8 commands
+    avg_latency = avg_latency ? (avg_latency * 7 + latency) / 8 : latency;
+    set_cmd_latency(avg_latency);
+    if (latency > max_latency) {
+      max_latency = latency;
+      set_cmd_max_latency(max_latency);
     }
-
-    memset(buf_cmd, 0, MAX_CMD_LENGTH);
   }
 }
 
 void init_cmd() {
   ESP_LOGI(SGO_LOG_EVENT, "@CMD Intializing CMD task");
 
-  cmd = xQueueCreate(1, MAX_CMD_LENGTH);
-  if (cmd == NULL) {
-    ESP_LOGE(SGO_LOG_EVENT, "@CMD Unable to create cmd queue");
+  pending = xSemaphoreCreateCounting(MAX_PENDING_CMDS, 0);
+  if (pending == NULL) {
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD Unable to create cmd semaphore");
+  }
+  for (int i = 0; i < N_CMD_SOURCES; ++i) {
+    queues[i] = xRingbufferCreate(CMD_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+    if (queues[i] == NULL) {
+      ESP_LOGE(SGO_LOG_EVENT, "@CMD Unable to create cmd queue");
+    }
   }
 
   BaseType_t ret = xTaskCreatePinnedToCore(cmd_task, "CMD", 8192, NULL, 10, NULL, 1);
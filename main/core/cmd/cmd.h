@@ -20,10 +20,32 @@
 #define CMD_H_
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #define MAX_CMD_LENGTH 512
 
+// binary commands, see cmd_bin.c
+#define MAX_CMD_BIN_LENGTH 640
+#define CMD_BIN_REQUEST 0xB5
+#define CMD_BIN_REPLY 0xB6
+#define CMD_BIN_TERM_PREFIX '~'
+
+#define CMD_BIN_GETI 1
+#define CMD_BIN_SETI 2
+#define CMD_BIN_GETS 3
+#define CMD_BIN_SETS 4
+
 void init_cmd();
-void execute_cmd(int length, const char *cmd, bool remote);
+// return false if the command was rejected, remote commands then get an error reply
+bool execute_cmd(int length, const char *cmd, bool remote);
+bool execute_cmd_batch(const char *id, int length, const char *cmds);
+bool execute_cmd_bin(const uint8_t *frame, size_t len, bool remote);
+// queues /spiffs/boot.cmd if present, call once SPIFFS is mounted
+void run_boot_script();
+
+bool check_cmd_bin(const uint8_t *frame, size_t len);
+void run_cmd_bin(const uint8_t *frame, size_t len, bool remote);
+void reject_cmd_bin(const uint8_t *frame, size_t len, bool remote, int err);
 
 #endif
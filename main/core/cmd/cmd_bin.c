@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cmd.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sodium/utils.h"
+
+#include "../log/log.h"
+#include "../kv/kv.h"
+#include "../kv/kv_mapping.h"
+#include "../mqtt/mqtt.h"
+
+/*
+ * Binary commands, for machines, skip argtable and the text rewriting. A
+ * frame is:
+ *
+ *   u8 CMD_BIN_REQUEST, u16 payload length, payload, u8 xor of the payload
+ *
+ * with a request payload of:
+ *
+ *   u8 opcode, u16 request id, u8 key length, key, value
+ *
+ * where value is an i32 for CMD_BIN_SETI, u16 length + bytes for
+ * CMD_BIN_SETS, and empty for the getters. Replies are framed the same way,
+ * starting with CMD_BIN_REPLY:
+ *
+ *   u8 opcode, u16 request id, i32 esp_err_t, value (getters, on ESP_OK)
+ *
+ * Integers are little endian. Over MQTT frames are sent as-is inside the
+ * signed envelope, replies go to the reply channel. On the terminal they are
+ * hex encoded on a line starting with CMD_BIN_TERM_PREFIX, as the UART VFS
+ * rewrites line endings.
+ */
+
+#define MAX_BIN_KEY_LENGTH 64
+
+static uint8_t checksum(const uint8_t *data, size_t len) {
+  uint8_t sum = 0;
+  for (size_t i = 0; i < len; ++i) {
+    sum ^= data[i];
+  }
+  return sum;
+}
+
+static uint16_t read_u16(const uint8_t *data) {
+  return data[0] | (data[1] << 8);
+}
+
+static int32_t read_i32(const uint8_t *data) {
+  return (int32_t)(data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24));
+}
+
+static size_t write_u16(uint8_t *data, uint16_t value) {
+  data[0] = value & 0xff;
+  data[1] = value >> 8;
+  return 2;
+}
+
+static size_t write_i32(uint8_t *data, int32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    data[i] = ((uint32_t)value >> (i * 8)) & 0xff;
+  }
+  return 4;
+}
+
+bool check_cmd_bin(const uint8_t *frame, size_t len) {
+  if (len < 4 || len > MAX_CMD_BIN_LENGTH || frame[0] != CMD_BIN_REQUEST) {
+    return false;
+  }
+  size_t payload_len = read_u16(&frame[1]);
+  return payload_len + 4 == len && checksum(&frame[3], payload_len) == frame[len - 1];
+}
+
+static void send_reply(uint8_t *reply, size_t payload_len, bool remote) {
+  reply[0] = CMD_BIN_REPLY;
+  write_u16(&reply[1], payload_len);
+  reply[3 + payload_len] = checksum(&reply[3], payload_len);
+  size_t len = payload_len + 4;
+  if (remote) {
+    mqtt_reply((const char *)reply, len);
+    return;
+  }
+  char hex[MAX_CMD_BIN_LENGTH * 2 + 1];
+  sodium_bin2hex(hex, sizeof(hex), reply, len);
+  printf("%c%s\n", CMD_BIN_TERM_PREFIX, hex);
+  fflush(stdout);
+}
+
+static bool get_int(const char *name, bool remote, int32_t *value) {
+  const kvi8_mapping *hi8 = get_kvi8_mapping(name, remote);
+  if (hi8) {
+    *value = hi8->getter();
+    return true;
+  }
+  const kvui8_mapping *hui8 = get_kvui8_mapping(name, remote);
+  if (hui8) {
+    *value = hui8->getter();
+    return true;
+  }
+  const kvi16_mapping *hi16 = get_kvi16_mapping(name, remote);
+  if (hi16) {
+    *value = hi16->getter();
+    return true;
+  }
+  const kvui16_mapping *hui16 = get_kvui16_mapping(name, remote);
+  if (hui16) {
+    *value = hui16->getter();
+    return true;
+  }
+  const kvi32_mapping *hi32 = get_kvi32_mapping(name, remote);
+  if (hi32) {
+    *value = hi32->getter();
+    return true;
+  }
+  const kvui32_mapping *hui32 = get_kvui32_mapping(name, remote);
+  if (hui32) {
+    *value = hui32->getter();
+    return true;
+  }
+  return false;
+}
+
+static bool set_int(const char *name, bool remote, int32_t value) {
+  const kvi8_mapping *hi8 = get_kvi8_mapping(name, remote);
+  if (hi8 && hi8->setter) {
+    hi8->setter((int8_t)value);
+    return true;
+  }
+  const kvui8_mapping *hui8 = get_kvui8_mapping(name, remote);
+  if (hui8 && hui8->setter) {
+    hui8->setter((uint8_t)value);
+    return true;
+  }
+  const kvi16_mapping *hi16 = get_kvi16_mapping(name, remote);
+  if (hi16 && hi16->setter) {
+    hi16->setter((int16_t)value);
+    return true;
+  }
+  const kvui16_mapping *hui16 = get_kvui16_mapping(name, remote);
+  if (hui16 && hui16->setter) {
+    hui16->setter((uint16_t)value);
+    return true;
+  }
+  const kvi32_mapping *hi32 = get_kvi32_mapping(name, remote);
+  if (hi32 && hi32->setter) {
+    hi32->setter(value);
+    return true;
+  }
+  const kvui32_mapping *hui32 = get_kvui32_mapping(name, remote);
+  if (hui32 && hui32->setter) {
+    hui32->setter((uint32_t)value);
+    return true;
+  }
+  return false;
+}
+
+static esp_err_t run_op(uint8_t opcode, const char *key, const uint8_t *value, size_t value_len, bool remote, uint8_t *reply, size_t *n) {
+  int32_t ivalue;
+  char svalue[MAX_KVALUE_SIZE] = {0};
+  switch (opcode) {
+    case CMD_BIN_GETI:
+      if (!get_int(key, remote, &ivalue)) {
+        return ESP_ERR_NOT_FOUND;
+      }
+      *n += write_i32(&reply[*n], ivalue);
+      SGO_LOGI_STRUCT(SGO_LOG_METRIC, SGO_MSG_KV_INT, key, ivalue);
+      return ESP_OK;
+    case CMD_BIN_SETI:
+      if (value_len != 4) {
+        return ESP_ERR_INVALID_ARG;
+      }
+      ivalue = read_i32(value);
+      if (!set_int(key, remote, ivalue)) {
+        return ESP_ERR_NOT_FOUND;
+      }
+      SGO_LOGI_STRUCT(SGO_LOG_METRIC, SGO_MSG_KV_INT, key, ivalue);
+      return ESP_OK;
+    case CMD_BIN_GETS: {
+      const kvs_mapping *h = get_kvs_mapping(key, remote);
+      if (!h) {
+        return ESP_ERR_NOT_FOUND;
+      }
+      h->getter(svalue, MAX_KVALUE_SIZE - 1);
+      size_t len = strlen(svalue);
+      *n += write_u16(&reply[*n], len);
+      memcpy(&reply[*n], svalue, len);
+      *n += len;
+      SGO_LOGI_STRUCT(SGO_LOG_METRIC, SGO_MSG_KV_STR, key, svalue);
+      return ESP_OK;
+    }
+    case CMD_BIN_SETS: {
+      if (value_len < 2 || read_u16(value) != value_len - 2 || value_len - 2 >= MAX_KVALUE_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+      }
+      const kvs_mapping *h = get_kvs_mapping(key, remote);
+      if (!h || !h->setter) {
+        return ESP_ERR_NOT_FOUND;
+      }
+      memcpy(svalue, &value[2], value_len - 2);
+      h->setter(svalue);
+      SGO_LOGI_STRUCT(SGO_LOG_METRIC, SGO_MSG_KV_STR, key, svalue);
+      return ESP_OK;
+    }
+  }
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+static size_t start_reply(const uint8_t *frame, size_t len, uint8_t *reply) {
+  const uint8_t *payload = &frame[3];
+  size_t payload_len = len - 4;
+  size_t n = 3;
+  reply[n++] = payload_len > 0 ? payload[0] : 0;
+  n += write_u16(&reply[n], payload_len >= 3 ? read_u16(&payload[1]) : 0);
+  return n;
+}
+
+// frame must have passed check_cmd_bin
+void reject_cmd_bin(const uint8_t *frame, size_t len, bool remote, int err) {
+  uint8_t reply[16];
+  size_t n = start_reply(frame, len, reply);
+  n += write_i32(&reply[n], err);
+  send_reply(reply, n - 3, remote);
+}
+
+// frame must have passed check_cmd_bin
+void run_cmd_bin(const uint8_t *frame, size_t len, bool remote) {
+  const uint8_t *p = &frame[3];
+  const uint8_t *end = &frame[len - 1];
+  if (end - p < 4) {
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD Malformed binary command");
+    reject_cmd_bin(frame, len, remote, ESP_ERR_INVALID_ARG);
+    return;
+  }
+  uint8_t opcode = p[0];
+  uint16_t id = read_u16(&p[1]);
+  size_t key_len = p[3];
+  p += 4;
+
+  uint8_t reply[MAX_CMD_BIN_LENGTH];
+  size_t code_offset = start_reply(frame, len, reply);
+  size_t n = code_offset + 4;
+
+  esp_err_t err = ESP_ERR_INVALID_ARG;
+  if (key_len > 0 && key_len < MAX_BIN_KEY_LENGTH && end - p >= key_len) {
+    char key[MAX_BIN_KEY_LENGTH] = {0};
+    memcpy(key, p, key_len);
+    p += key_len;
+    err = run_op(opcode, key, p, end - p, remote, reply, &n);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(SGO_LOG_EVENT, "@CMD (#%d) Binary command failed: 0x%x (%s)", id, err, esp_err_to_name(err));
+    n = code_offset + 4;
+  }
+  write_i32(&reply[code_offset], err);
+  send_reply(reply, n - 3, remote);
+}
@@ -16,11 +16,169 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
 #include <esp_http_server.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include "mbedtls/sha256.h"
+#include "sodium/utils.h"
 
+#include "httpd.h"
 #include "../kv/kv.h"
 #include "../log/log.h"
 
+/*
+ * The expected credential is kept in RAM as a sha256 hash, loaded from NVS
+ * on first use and dropped when HTTPD_AUTH is set.
+ *
+ * A successful Basic login hands out a session token as a cookie, later
+ * requests are checked against the session table only.
+ */
+
+#define SESSION_COOKIE "sgsid"
+#define SESSION_TOKEN_SIZE 16
+#define SESSION_TOKEN_HEX_SIZE (SESSION_TOKEN_SIZE * 2 + 1)
+#define N_SESSIONS 4
+#define SESSION_TTL_S (15 * 60)
+
+typedef enum {
+  AUTH_UNKNOWN,
+  AUTH_DISABLED,
+  AUTH_ENABLED,
+} auth_state;
+
+typedef struct {
+  char token[SESSION_TOKEN_HEX_SIZE];
+  int64_t expires;
+} session;
+
+// only touched from the httpd task, except auth_dirty
+static volatile bool auth_dirty = true;
+static auth_state state = AUTH_UNKNOWN;
+static uint8_t auth_hash[32] = {0};
+static session sessions[N_SESSIONS] = {0};
+
+// the header value must outlive the handler's call to httpd_resp_set_hdr
+static char cookie_hdr[sizeof(SESSION_COOKIE) + SESSION_TOKEN_HEX_SIZE + 48] = {0};
+
+static bool const_time_eq(const void *a, const void *b, size_t len) {
+  const uint8_t *pa = a, *pb = b;
+  uint8_t diff = 0;
+  for (size_t i = 0; i < len; ++i) {
+    diff |= pa[i] ^ pb[i];
+  }
+  return diff == 0;
+}
+
+static int64_t now_s() {
+  return esp_timer_get_time() / 1000000;
+}
+
+static void hash_str(const char *str, uint8_t hash[32]) {
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts_ret(&ctx, 0);
+  mbedtls_sha256_update_ret(&ctx, (const unsigned char *)str, strlen(str));
+  mbedtls_sha256_finish_ret(&ctx, hash);
+  mbedtls_sha256_free(&ctx);
+}
+
+static void load_auth() {
+  auth_dirty = false;
+  memset(sessions, 0, sizeof(sessions));
+  state = AUTH_DISABLED;
+  if (!hasstr(HTTPD_AUTH)) {
+    return;
+  }
+  char auth[MAX_KVALUE_SIZE] = {0};
+  getstr(HTTPD_AUTH, auth, MAX_KVALUE_SIZE);
+  if (strlen(auth) == 0) {
+    return;
+  }
+  hash_str(auth, auth_hash);
+  memset(auth, 0, sizeof(auth));
+  state = AUTH_ENABLED;
+}
+
+static bool find_session(const char *token) {
+  if (strlen(token) != SESSION_TOKEN_HEX_SIZE - 1) {
+    return false;
+  }
+  int64_t now = now_s();
+  bool found = false;
+  for (int i = 0; i < N_SESSIONS; ++i) {
+    if (sessions[i].expires <= now) {
+      continue;
+    }
+    if (const_time_eq(sessions[i].token, token, SESSION_TOKEN_HEX_SIZE - 1)) {
+      sessions[i].expires = now + SESSION_TTL_S;
+      found = true;
+    }
+  }
+  return found;
+}
+
+static const char *new_session() {
+  int64_t now = now_s();
+  session *s = &sessions[0];
+  for (int i = 1; i < N_SESSIONS; ++i) {
+    if (sessions[i].expires < s->expires) {
+      s = &sessions[i];
+    }
+  }
+  uint8_t raw[SESSION_TOKEN_SIZE];
+  esp_fill_random(raw, sizeof(raw));
+  sodium_bin2hex(s->token, sizeof(s->token), raw, sizeof(raw));
+  s->expires = now + SESSION_TTL_S;
+  return s->token;
+}
+
+static bool get_cookie_token(const char *cookies, char *token, size_t len) {
+  for (const char *c = strstr(cookies, SESSION_COOKIE "="); c; c = strstr(c + 1, SESSION_COOKIE "=")) {
+    if (c != cookies && c[-1] != ' ' && c[-1] != ';') {
+      continue;
+    }
+    c += sizeof(SESSION_COOKIE);
+    size_t n = strcspn(c, "; ");
+    if (n >= len) {
+      return false;
+    }
+    memcpy(token, c, n);
+    token[n] = 0;
+    return true;
+  }
+  return false;
+}
+
+// reads the session token from the Cookie header, or from "Authorization: Bearer"
+static bool get_session_token(httpd_req_t *req, char *token, size_t len) {
+  // sized from the header, other cookies set on the same host can make it
+  // longer than any fixed buffer
+  size_t cookies_len = httpd_req_get_hdr_value_len(req, "Cookie");
+  if (cookies_len > 0) {
+    cookies_len = MIN(cookies_len + 1, CONFIG_HTTPD_MAX_REQ_HDR_LEN);
+    char *cookies = malloc(cookies_len);
+    if (cookies != NULL) {
+      // a truncated value is still nul terminated, the token may be in it
+      esp_err_t err = httpd_req_get_hdr_value_str(req, "Cookie", cookies, cookies_len);
+      bool found = (err == ESP_OK || err == ESP_ERR_HTTPD_RESULT_TRUNC) && get_cookie_token(cookies, token, len);
+      free(cookies);
+      if (found) {
+        return true;
+      }
+    }
+  }
+  char bearer[SESSION_TOKEN_HEX_SIZE + 8] = {0};
+  if (httpd_req_get_hdr_value_str(req, "Authorization", bearer, sizeof(bearer)) == ESP_OK && strncmp(bearer, "Bearer ", 7) == 0) {
+    strncpy(token, &bearer[7], len - 1);
+    return true;
+  }
+  return false;
+}
+
 static bool auth_failed(httpd_req_t *req) {
   httpd_resp_set_hdr(req, "WWW-Authenticate", "Basic realm=\"Please login\"");
   httpd_resp_set_status(req, "401");
@@ -29,22 +187,37 @@ static bool auth_failed(httpd_req_t *req) {
 }
 
 bool auth_request(httpd_req_t *req) {
-  if (!hasstr(HTTPD_AUTH)) {
+  if (auth_dirty || state == AUTH_UNKNOWN) {
+    load_auth();
+  }
+  if (state == AUTH_DISABLED) {
     return true;
   }
-  char auth[MAX_KVALUE_SIZE] = {0};
-  getstr(HTTPD_AUTH, auth, MAX_KVALUE_SIZE);
 
-  if (strlen(auth) == 0) {
+  char token[SESSION_TOKEN_HEX_SIZE] = {0};
+  if (get_session_token(req, token, sizeof(token)) && find_session(token)) {
     return true;
   }
 
   char reqAuth[MAX_KVALUE_SIZE] = {0};
-  if(httpd_req_get_hdr_value_str(req, "Authorization", reqAuth, MAX_KVALUE_SIZE) != ESP_OK) {
+  if (httpd_req_get_hdr_value_str(req, "Authorization", reqAuth, MAX_KVALUE_SIZE) != ESP_OK || strncmp(reqAuth, "Basic ", 6) != 0) {
     return auth_failed(req);
   }
-  if (strlen(reqAuth) != 6 + strlen(auth) || strncmp(auth, &(reqAuth[6]), MAX_KVALUE_SIZE-6) != 0) {
+  uint8_t hash[32];
+  hash_str(&reqAuth[6], hash);
+  memset(reqAuth, 0, sizeof(reqAuth));
+  if (!const_time_eq(hash, auth_hash, sizeof(hash))) {
     return auth_failed(req);
   }
+
+  snprintf(cookie_hdr, sizeof(cookie_hdr), SESSION_COOKIE "=%s; Path=/; Max-Age=%d; HttpOnly", new_session(), SESSION_TTL_S);
+  httpd_resp_set_hdr(req, "Set-Cookie", cookie_hdr);
   return true;
 }
+
+/* KV Callbacks */
+
+const char *on_set_httpd_auth(const char *value) {
+  auth_dirty = true;
+  return value;
+}
@@ -27,96 +27,32 @@
 
 #include "../kv/kv.h"
 #include "../log/log.h"
-
-#define IS_URI_SEP(c) (c == '?' || c == '&' || c == '=')
-
+#include "httpd_params.h"
 
 esp_err_t download_get_handler(httpd_req_t *req);
 esp_err_t upload_post_handler(httpd_req_t *req);
-
-/* static size_t get_char_count(const char *uri) {
-  size_t i = 0;
-  for (; uri[i] && !IS_URI_SEP(uri[i]); ++i) {}
-  return i;
-} */
-
-static const char *move_to_next_elem(const char *uri) {
-  for (; *uri && !IS_URI_SEP(*uri); ++uri) {}
-  if (*uri) ++uri;
-  return uri;
-}
-
-static const char *move_to_key_value(const char *uri, const char *name) {
-  while (*(uri = move_to_next_elem(uri))) {
-    if (strncmp(uri, name, strlen(name)) == 0) {
-      break;
-    }
-  }
-  if (!*uri) return uri;
-  return move_to_next_elem(uri);
-}
-
-inline int ishex(int x)
-{
-  return	(x >= '0' && x <= '9')	||
-    (x >= 'a' && x <= 'f')	||
-    (x >= 'A' && x <= 'F');
-}
-
-int url_decode(const char *s, char *dec)
-{
-  char *o;
-  const char *end = s + strlen(s);
-  int c;
-
-  for (o = dec; s <= end; o++) {
-    c = *s++;
-    if (c == '+') c = ' ';
-    else if (c == '%' && (	!ishex(*s++)	||
-          !ishex(*s++)	||
-          !sscanf(s - 2, "%2x", &c)))
-      return -1;
-
-    if (dec) *o = c;
-  }
-
-  return o - dec;
-}
-
-/*static int find_int_param(const char *uri, const char *name) {
-  int res = 0;
-  const char *uri_offset = move_to_key_value(uri, name);
-  if (!*uri_offset) {
-    return 0;
-  }
-  return res;
-}*/
-
-static void find_str_param(const char *uri, const char *name, char *out, size_t *len) {
-  uri = move_to_key_value(uri, name);
-  if (!*uri) {
-    return;
-  }
-  int i = 0;
-  for (i = 0; uri[i] && i < (*len-1) && !IS_URI_SEP(uri[i]); ++i) {
-    out[i] = uri[i];
-  }
-  *len = i;
-}
+esp_err_t kv_get_handler(httpd_req_t *req);
+esp_err_t kv_post_handler(httpd_req_t *req);
+esp_err_t metrics_get_handler(httpd_req_t *req);
+esp_err_t schema_get_handler(httpd_req_t *req);
 
 static esp_err_t geti_handler(httpd_req_t *req) {
   if (auth_request(req) == false) {
     return 0;
   }
-  size_t len = 50;
-  char name[50] = {0};
-  find_str_param(req->uri, "k", name, &len);
+  httpd_params params;
+  if (parse_query_params(req, &params) != ESP_OK || !get_param(&params, "k")) {
+    free_params(&params);
+    return httpd_resp_send_404(req);
+  }
+  const char *name = get_param(&params, "k");
   const kvi8_mapping *hi8 = get_kvi8_mapping(name, false);
   const kvui8_mapping *hui8 = get_kvui8_mapping(name, false);
   const kvi16_mapping *hi16 = get_kvi16_mapping(name, false);
   const kvui16_mapping *hui16 = get_kvui16_mapping(name, false);
   const kvi32_mapping *hi32 = get_kvi32_mapping(name, false);
   const kvui32_mapping *hui32 = get_kvui32_mapping(name, false);
+  free_params(&params);
 
   if (!hi8 && !hui8 && !hi16 && !hui16 && !hi32 && !hui32) {
     return httpd_resp_send_404(req);
@@ -148,9 +84,12 @@ static esp_err_t seti_handler(httpd_req_t *req) {
   if (auth_request(req) == false) {
     return 0;
   }
-  size_t len = 50;
-  char name[50] = {0};
-  find_str_param(req->uri, "k", name, &len);
+  httpd_params params;
+  if (parse_query_params(req, &params) != ESP_OK || !get_param(&params, "k")) {
+    free_params(&params);
+    return httpd_resp_send_404(req);
+  }
+  const char *name = get_param(&params, "k");
   const kvi8_mapping *hi8 = get_kvi8_mapping(name, false);
   bool is_i8 = hi8 && hi8->setter;
   const kvui8_mapping *hui8 = get_kvui8_mapping(name, false);
@@ -164,15 +103,14 @@ static esp_err_t seti_handler(httpd_req_t *req) {
   const kvui32_mapping *hui32 = get_kvui32_mapping(name, false);
   bool is_ui32 = hui32 && hui32->setter;
 
+  const char *value = get_param(&params, "v");
+  int res = value ? atoi(value) : 0;
+  free_params(&params);
+
   if (!is_i8 && !is_ui8 && !is_i16 && !is_ui16 && !is_i32 && !is_ui32) {
     return httpd_resp_send_404(req);
   }
 
-  len = 50;
-  char value[50] = {0};
-  find_str_param(req->uri, "v", value, &len);
-  int res = atoi(value);
-
   if (is_i8) {
     hi8->setter((int8_t)res);
   } else if (is_ui8) {
@@ -195,11 +133,14 @@ static esp_err_t getstr_handler(httpd_req_t *req) {
   if (auth_request(req) == false) {
     return 0;
   }
-  char name[50] = {0};
-  size_t len = 50;
-  find_str_param(req->uri, "k", name, &len);
+  httpd_params params;
+  if (parse_query_params(req, &params) != ESP_OK || !get_param(&params, "k")) {
+    free_params(&params);
+    return httpd_resp_send_404(req);
+  }
 
-  const kvs_mapping *h = get_kvs_mapping(name, false);
+  const kvs_mapping *h = get_kvs_mapping(get_param(&params, "k"), false);
+  free_params(&params);
   if (!h) {
     return httpd_resp_send_404(req);
   }
@@ -212,26 +153,50 @@ static esp_err_t getstr_handler(httpd_req_t *req) {
   return ESP_OK;
 }
 
+/*
+ * k and v are read from the query string, or from the body (form encoded or
+ * JSON) when the query has no v, which allows values up to MAX_KVALUE_SIZE.
+ */
 static esp_err_t setstr_handler(httpd_req_t *req) {
   if (auth_request(req) == false) {
     return 0;
   }
-  char name[50] = {0};
-  size_t len = 50;
-  find_str_param(req->uri, "k", name, &len);
+  httpd_params query, body = {0};
+  if (parse_query_params(req, &query) != ESP_OK) {
+    free_params(&query);
+    return httpd_resp_send_404(req);
+  }
+  const char *name = get_param(&query, "k");
+  const char *value = get_param(&query, "v");
+  if (!value && req->content_len > 0) {
+    if (parse_body_params(req, &body, MAX_KVALUE_SIZE * 3 + 64) != ESP_OK) {
+      free_params(&query);
+      free_params(&body);
+      httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad body");
+      return ESP_FAIL;
+    }
+    if (!name) {
+      name = get_param(&body, "k");
+    }
+    value = get_param(&body, "v");
+  }
 
-  const kvs_mapping *h = get_kvs_mapping(name, false);
+  const kvs_mapping *h = name ? get_kvs_mapping(name, false) : NULL;
   if (!h || !h->setter) {
+    free_params(&query);
+    free_params(&body);
     return httpd_resp_send_404(req);
   }
-
-  len = MAX_KVALUE_SIZE;
-  char raw[MAX_KVALUE_SIZE] = {0};
-  char value[MAX_KVALUE_SIZE] = {0};
-  find_str_param(req->uri, "v", raw, &len);
-  url_decode(raw, value);
+  if (!value || strlen(value) >= MAX_KVALUE_SIZE) {
+    free_params(&query);
+    free_params(&body);
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad value");
+    return ESP_FAIL;
+  }
 
   h->setter(value);
+  free_params(&query);
+  free_params(&body);
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
   httpd_resp_send(req, "OK", 2);
   return ESP_OK;
@@ -241,9 +206,17 @@ static esp_err_t setsigningkey_handler(httpd_req_t *req) {
   if (auth_request(req) == false) {
     return 0;
   }
-  size_t len = 33;
+  httpd_params params;
+  if (parse_query_params(req, &params) != ESP_OK) {
+    free_params(&params);
+    return httpd_resp_send_404(req);
+  }
   char key[33] = {0};
-  find_str_param(req->uri, "key", key, &len);
+  const char *value = get_param(&params, "key");
+  if (value) {
+    strncpy(key, value, sizeof(key) - 1);
+  }
+  free_params(&params);
 
   setstr(SIGNING_KEY, key);
 
@@ -311,6 +284,34 @@ httpd_uri_t uri_setstr = {
   .user_ctx = NULL
 };
 
+httpd_uri_t uri_getkv = {
+  .uri      = "/kv",
+  .method   = HTTP_GET,
+  .handler  = kv_get_handler,
+  .user_ctx = NULL
+};
+
+httpd_uri_t uri_setkv = {
+  .uri      = "/kv",
+  .method   = HTTP_POST,
+  .handler  = kv_post_handler,
+  .user_ctx = NULL
+};
+
+httpd_uri_t uri_metrics = {
+  .uri      = "/metrics",
+  .method   = HTTP_GET,
+  .handler  = metrics_get_handler,
+  .user_ctx = NULL
+};
+
+httpd_uri_t uri_schema = {
+  .uri      = "/schema",
+  .method   = HTTP_GET,
+  .handler  = schema_get_handler,
+  .user_ctx = NULL
+};
+
 httpd_uri_t uri_setsigningkey = {
   .uri      = "/signing",
   .method   = HTTP_POST,
@@ -354,18 +355,23 @@ static void start_webserver_task(void *args) {
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
   config.lru_purge_enable = true;
   config.uri_match_fn = httpd_uri_match_wildcard;
-  config.max_uri_handlers = 9;
+  config.max_uri_handlers = 14;
 
   if (httpd_start(&server, &config) == ESP_OK) {
     httpd_register_uri_handler(server, &uri_geti);
     httpd_register_uri_handler(server, &uri_seti);
     httpd_register_uri_handler(server, &uri_getstr);
     httpd_register_uri_handler(server, &uri_setstr);
+    httpd_register_uri_handler(server, &uri_getkv);
+    httpd_register_uri_handler(server, &uri_setkv);
+    httpd_register_uri_handler(server, &uri_metrics);
+    httpd_register_uri_handler(server, &uri_schema);
     httpd_register_uri_handler(server, &uri_setsigningkey);
     httpd_register_uri_handler(server, &uri_get_ip);
     httpd_register_uri_handler(server, &file_download);
 		httpd_register_uri_handler(server, &file_upload);
     httpd_register_uri_handler(server, &uri_option);
+    init_httpd_events(server);
   }
 
   vTaskDelete(NULL);
@@ -24,5 +24,9 @@
 void init_httpd();
 void init_spiffs(void);
 bool auth_request(httpd_req_t *req);
+const char *on_set_httpd_auth(const char *value);
+bool get_kv_str(const char *name, char *value, size_t len);
+bool etag_matches(httpd_req_t *req, const char *etag);
+void init_httpd_events(httpd_handle_t server);
 
 #endif
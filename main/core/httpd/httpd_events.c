@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_http_server.h"
+
+#include "../kv/kv.h"
+#include "../kv/kv_feed.h"
+#include "../log/log.h"
+
+/*
+ * Server-Sent Events stream of kv changes.
+ *
+ * GET /events?k=KEY1,KEY2&w=500 or GET /events?p=BOX_0_,LED_&w=500
+ *
+ * Every w ms (coalescing window, default 500), the changed keys that match
+ * the filter (no filter means all keys) are sent as one event:
+ *
+ *   data: KEY1=12
+ *   data: KEY2=value
+ *
+ * Clients should load initial values from /kv. If a client falls too far
+ * behind the change feed, it gets an "event: resync" and should reload them.
+ *
+ * The connection is left open after the handler returns. Events are written
+ * from the httpd task through httpd_queue_work, so sessions never need to be
+ * locked.
+ */
+
+#define MAX_EVENT_CLIENTS 4
+#define MAX_EVENT_FILTER_SIZE 256
+#define EVENT_TICK_MS 100
+#define DEFAULT_EVENT_WINDOW_MS 500
+#define MIN_EVENT_WINDOW_MS EVENT_TICK_MS
+#define EVENT_BUFSIZE 1024
+
+typedef struct {
+  bool used;
+  int fd;
+  uint32_t cursor;
+  int window;
+  int64_t last_sent;
+  bool prefix;
+  char filter[MAX_EVENT_FILTER_SIZE];
+} event_client;
+
+static httpd_handle_t server = NULL;
+// only accessed from the httpd task
+static event_client clients[MAX_EVENT_CLIENTS] = {0};
+static volatile int n_clients = 0;
+
+static bool match_filter(const event_client *c, const char *name) {
+  if (!c->filter[0]) {
+    return true;
+  }
+  for (const char *f = c->filter; *f;) {
+    const char *sep = strchr(f, ',');
+    size_t len = sep ? sep - f : strlen(f);
+    if (len && strncmp(f, name, len) == 0 && (c->prefix || name[len] == 0)) {
+      return true;
+    }
+    f += sep ? len + 1 : len;
+  }
+  return false;
+}
+
+static void close_client(event_client *c) {
+  if (c->used) {
+    c->used = false;
+    --n_clients;
+  }
+}
+
+// called by httpd when the session is closed
+static void free_client(void *ctx) {
+  close_client((event_client *)ctx);
+}
+
+static bool send_client(event_client *c, const char *buf, size_t len) {
+  if (httpd_socket_send(server, c->fd, buf, len, 0) < 0) {
+    httpd_sess_trigger_close(server, c->fd);
+    return false;
+  }
+  return true;
+}
+
+static void send_changes(event_client *c, int64_t now) {
+  const char *names[KV_FEED_SIZE];
+  int n = kv_feed_read(&c->cursor, names, KV_FEED_SIZE);
+  if (n < 0) {
+    static const char resync[] = "event: resync\ndata: \n\n";
+    send_client(c, resync, sizeof(resync) - 1);
+    c->last_sent = now;
+    return;
+  }
+
+  static char buf[EVENT_BUFSIZE];
+  size_t len = 0;
+  for (int i = 0; i < n; ++i) {
+    bool dup = false;
+    for (int j = i + 1; j < n && !dup; ++j) {
+      dup = strcmp(names[i], names[j]) == 0;
+    }
+    if (dup || !match_filter(c, names[i])) {
+      continue;
+    }
+
+    char value[MAX_KVALUE_SIZE] = {0};
+    if (!get_kv_str(names[i], value, sizeof(value))) {
+      continue;
+    }
+    // values are single line, newlines would end the data field
+    for (char *v = value; *v; ++v) {
+      if (*v == '\n' || *v == '\r') *v = ' ';
+    }
+    size_t line_len = strlen(names[i]) + strlen(value) + 8;
+    if (len + line_len + 1 > EVENT_BUFSIZE) {
+      if (len && (!send_client(c, buf, len) || !send_client(c, "\n", 1))) {
+        return;
+      }
+      len = 0;
+    }
+    if (line_len + 1 > EVENT_BUFSIZE) {
+      continue;
+    }
+    len += snprintf(&buf[len], EVENT_BUFSIZE - len, "data: %s=%s\n", names[i], value);
+  }
+  if (len) {
+    buf[len++] = '\n';
+    send_client(c, buf, len);
+  }
+  c->last_sent = now;
+}
+
+static void events_tick(void *arg) {
+  int64_t now = esp_timer_get_time() / 1000;
+  for (int i = 0; i < MAX_EVENT_CLIENTS; ++i) {
+    event_client *c = &clients[i];
+    if (c->used && now - c->last_sent >= c->window && c->cursor != kv_feed_head()) {
+      send_changes(c, now);
+    }
+  }
+}
+
+static void events_task(void *param) {
+  while (true) {
+    if (n_clients) {
+      httpd_queue_work(server, events_tick, NULL);
+    }
+    vTaskDelay(EVENT_TICK_MS / portTICK_PERIOD_MS);
+  }
+}
+
+static esp_err_t events_handler(httpd_req_t *req) {
+  if (auth_request(req) == false) {
+    return 0;
+  }
+
+  event_client *c = NULL;
+  for (int i = 0; i < MAX_EVENT_CLIENTS && !c; ++i) {
+    if (!clients[i].used) {
+      c = &clients[i];
+    }
+  }
+  if (c == NULL) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Too many event clients");
+    return ESP_OK;
+  }
+  memset(c, 0, sizeof(event_client));
+  c->window = DEFAULT_EVENT_WINDOW_MS;
+
+  size_t query_len = httpd_req_get_url_query_len(req) + 1;
+  if (query_len > 1) {
+    char *query = malloc(query_len);
+    if (query && httpd_req_get_url_query_str(req, query, query_len) == ESP_OK) {
+      char window[8] = {0};
+      if (httpd_query_key_value(query, "w", window, sizeof(window)) == ESP_OK) {
+        c->window = MAX(atoi(window), MIN_EVENT_WINDOW_MS);
+      }
+      if (httpd_query_key_value(query, "k", c->filter, sizeof(c->filter)) != ESP_OK) {
+        c->prefix = httpd_query_key_value(query, "p", c->filter, sizeof(c->filter)) == ESP_OK;
+        if (!c->prefix) {
+          c->filter[0] = 0;
+        }
+      }
+    }
+    free(query);
+  }
+
+  static const char headers[] = "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Access-Control-Allow-Origin: *\r\n\r\n";
+  if (httpd_send(req, headers, sizeof(headers) - 1) < 0) {
+    return ESP_FAIL;
+  }
+
+  c->used = true;
+  c->fd = httpd_req_to_sockfd(req);
+  c->cursor = kv_feed_head();
+  c->last_sent = esp_timer_get_time() / 1000;
+  ++n_clients;
+
+  req->sess_ctx = c;
+  req->free_ctx = free_client;
+
+  SGO_LOGI(HTTPD, SGO_LOG_NOSEND, "events client connected, filter: %s", c->filter);
+  return ESP_OK;
+}
+
+static httpd_uri_t uri_events = {
+  .uri      = "/events",
+  .method   = HTTP_GET,
+  .handler  = events_handler,
+  .user_ctx = NULL
+};
+
+void init_httpd_events(httpd_handle_t handle) {
+  server = handle;
+  httpd_register_uri_handler(server, &uri_events);
+
+  BaseType_t ret = xTaskCreatePinnedToCore(events_task, "HTTPD_EVENTS", 2048, NULL, 5, NULL, 1);
+  if (ret != pdPASS) {
+    ESP_LOGE(SGO_LOG_EVENT, "@HTTPS Failed to create events task");
+  }
+}
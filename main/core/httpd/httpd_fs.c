@@ -19,6 +19,7 @@
 #include "httpd.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
 #include <sys/unistd.h>
@@ -26,23 +27,54 @@
 #include <dirent.h>
 
 #include "esp_err.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "sodium/utils.h"
 
 #include "../log/log.h"
 #include "esp_vfs.h"
 #include "esp_spiffs.h"
 #include "esp_http_server.h"
+#include "httpd_writer.h"
 
 #define FILE_BASE_PATH "/spiffs"
 
 /* Max length a file path can have on storage */
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN)
 
-/* Scratch buffer size */
-#define FILE_BUFSIZE  8192
-char file_buffer[FILE_BUFSIZE] = {0};
+/* Scratch buffer size, each request allocates its own */
+#define FILE_BUFSIZE  4096
 
-#define MAX_FILE_SIZE (15*1024)
-#define MAX_FILE_SIZE_STR "15KB"
+/*
+ * Files are served with a strong ETag, a hash of their content, and
+ * Cache-Control: no-cache, so browsers revalidate and get a 304 when
+ * nothing changed. ETags are computed on first request and cached with the
+ * file's size and mtime, any change to either recomputes it. Without
+ * CONFIG_SPIFFS_USE_MTIME a same-size rewrite goes unnoticed, so the files the
+ * firmware writes itself (the command script .log files) are never cached.
+ */
+#define MAX_ETAGS 8
+#define ETAG_SIZE 24
+
+typedef struct {
+  char path[FILE_PATH_MAX];
+  char etag[ETAG_SIZE];
+  off_t size;
+  time_t mtime;
+} etag_entry;
+
+// only accessed from the httpd task
+static etag_entry etags[MAX_ETAGS] = {0};
+static int etags_next = 0;
+
+/*
+ * Uploads are streamed to UPLOAD_TMP_PATH, checked (length, and SHA-256 if
+ * the X-Content-SHA256 header is set), then renamed over the target, so an
+ * interrupted upload never leaves a truncated file behind. SPIFFS can't
+ * rename over an existing file, the target is unlinked right before.
+ */
+#define UPLOAD_TMP_PATH FILE_BASE_PATH "/.upload.tmp"
+#define UPLOAD_PROGRESS_INTERVAL_US (2 * 1000 * 1000)
 
 /* Send HTTP response with a run-time generated html consisting of
  * a list of all files and folders under the requested path */
@@ -52,7 +84,6 @@ static esp_err_t http_resp_dir_html(httpd_req_t *req)
     return 0;
   }
   char fullpath[FILE_PATH_MAX];
-  char entrysize[16];
   const char *entrytype;
 
   DIR *dir = NULL;
@@ -67,7 +98,7 @@ static esp_err_t http_resp_dir_html(httpd_req_t *req)
   dir = opendir(fullpath);
   const size_t entrypath_offset = strlen(fullpath);
 
-  ESP_LOGI(SGO_LOG_NOSEND, "http_resp_dir_html %s", fullpath);
+  SGO_LOGI(HTTPD, SGO_LOG_NOSEND, "http_resp_dir_html %s", fullpath);
 
   if (!dir) {
     /* If opening directory failed then send 404 server error */
@@ -75,6 +106,13 @@ static esp_err_t http_resp_dir_html(httpd_req_t *req)
     return ESP_OK;
   }
 
+  resp_writer *w = malloc(sizeof(resp_writer));
+  if (!w) {
+    closedir(dir);
+    return httpd_resp_send_500(req);
+  }
+  resp_writer_init(w, req);
+
   httpd_resp_set_type(req, "text/plain");
   /* Iterate over all files / folders and fetch their names and sizes */
   while ((entry = readdir(dir)) != NULL) {
@@ -82,30 +120,20 @@ static esp_err_t http_resp_dir_html(httpd_req_t *req)
 
     strncpy(fullpath + entrypath_offset, entry->d_name, sizeof(fullpath) - entrypath_offset);
     if (stat(fullpath, &entry_stat) == -1) {
-      ESP_LOGE(SGO_LOG_NOSEND, "Failed to stat %s : %s", entrytype, entry->d_name);
+      SGO_LOGE(HTTPD, SGO_LOG_NOSEND, "Failed to stat %s : %s", entrytype, entry->d_name);
       continue;
     }
-    snprintf(entrysize, sizeof(entrysize)-1, "%ld", entry_stat.st_size);
-    ESP_LOGI(SGO_LOG_NOSEND, "Found %s : %s (%s bytes)", entrytype, entry->d_name, entrysize);
-
-    /* Send chunk of HTML file containing table entries with file name and size */
-    httpd_resp_sendstr_chunk(req, req->uri);
-    httpd_resp_sendstr_chunk(req, entry->d_name);
-    if (entry->d_type == DT_DIR) {
-      httpd_resp_sendstr_chunk(req, "/");
-    }
-    httpd_resp_sendstr_chunk(req, ";");
-    httpd_resp_sendstr_chunk(req, entry->d_name);
-    httpd_resp_sendstr_chunk(req, ";");
-    httpd_resp_sendstr_chunk(req, entrytype);
-    httpd_resp_sendstr_chunk(req, ";");
-    httpd_resp_sendstr_chunk(req, entrysize);
-    httpd_resp_sendstr_chunk(req, "\n");
+    SGO_LOGD(HTTPD, SGO_LOG_NOSEND, "Found %s : %s (%ld bytes)", entrytype, entry->d_name, entry_stat.st_size);
+
+    /* One line per entry: uri;name;type;size */
+    resp_printf(w, "%s%s%s;%s;%s;%ld\n", req->uri, entry->d_name, entry->d_type == DT_DIR ? "/" : "",
+        entry->d_name, entrytype, entry_stat.st_size);
   }
   closedir(dir);
 
-  /* Send empty chunk to signal HTTP response completion */
-  httpd_resp_sendstr_chunk(req, NULL);
+  /* Flush and send empty chunk to signal HTTP response completion */
+  resp_writer_end(w);
+  free(w);
   return ESP_OK;
 }
 
@@ -132,6 +160,73 @@ static esp_err_t set_content_type_from_file(httpd_req_t *req)
   return httpd_resp_set_type(req, "text/plain");
 }
 
+static void invalidate_etag(const char *filepath) {
+  for (int i = 0; i < MAX_ETAGS; ++i) {
+    if (strcmp(etags[i].path, filepath) == 0) {
+      etags[i].path[0] = 0;
+    }
+  }
+}
+
+// FNV-1a over the file content
+static bool compute_etag(FILE *fd, char *buf, char *etag) {
+  uint32_t hash = 2166136261U;
+  size_t size = 0, n;
+  while ((n = fread(buf, 1, FILE_BUFSIZE, fd)) > 0) {
+    for (size_t i = 0; i < n; ++i) {
+      hash = (hash ^ (uint8_t)buf[i]) * 16777619U;
+    }
+    size += n;
+  }
+  if (ferror(fd) || fseek(fd, 0, SEEK_SET) != 0) {
+    return false;
+  }
+  snprintf(etag, ETAG_SIZE, "\"%08x-%x\"", (unsigned)hash, (unsigned)size);
+  return true;
+}
+
+static const char *get_etag(const char *filepath, const struct stat *st, FILE *fd, char *buf) {
+  etag_entry *e = NULL;
+  for (int i = 0; i < MAX_ETAGS; ++i) {
+    if (strcmp(etags[i].path, filepath) == 0) {
+      e = &etags[i];
+      break;
+    }
+  }
+  if (e && e->size == st->st_size && e->mtime == st->st_mtime) {
+    return e->etag;
+  }
+  if (e == NULL) {
+    e = &etags[etags_next];
+    etags_next = (etags_next + 1) % MAX_ETAGS;
+  }
+  e->path[0] = 0;
+  if (!compute_etag(fd, buf, e->etag)) {
+    return NULL;
+  }
+#ifndef CONFIG_SPIFFS_USE_MTIME
+  if (IS_FILE_EXT(filepath, ".log")) {
+    return e->etag;
+  }
+#endif
+  strncpy(e->path, filepath, FILE_PATH_MAX - 1);
+  e->size = st->st_size;
+  e->mtime = st->st_mtime;
+  return e->etag;
+}
+
+bool etag_matches(httpd_req_t *req, const char *etag) {
+  char if_none_match[128] = {0};
+  size_t len = httpd_req_get_hdr_value_len(req, "If-None-Match");
+  if (len == 0 || len >= sizeof(if_none_match)) {
+    return false;
+  }
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) != ESP_OK) {
+    return false;
+  }
+  return strstr(if_none_match, etag) != NULL || strcmp(if_none_match, "*") == 0;
+}
+
 /* Send HTTP response with the contents of the requested file */
 static esp_err_t http_resp_file(httpd_req_t *req)
 {
@@ -148,39 +243,59 @@ static esp_err_t http_resp_file(httpd_req_t *req)
 
   /* Concatenate the requested file path */
   strcat(filepath, &(req->uri[3]));
-  ESP_LOGI(SGO_LOG_NOSEND, "http_resp_file %s", filepath);
+  SGO_LOGI(HTTPD, SGO_LOG_NOSEND, "http_resp_file %s", filepath);
   if (stat(filepath, &file_stat) == -1) {
-    ESP_LOGE(SGO_LOG_NOSEND, "Failed to stat file : %s", filepath);
+    SGO_LOGE(HTTPD, SGO_LOG_NOSEND, "Failed to stat file : %s", filepath);
     /* If file doesn't exist respond with 404 Not Found */
     httpd_resp_send_404(req);
     return ESP_OK;
   }
 
-  ESP_LOGI(SGO_LOG_NOSEND, "Sending file : %s (%ld bytes)...", filepath, file_stat.st_size);
-  set_content_type_from_file(req);
-  httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
-  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-
   fd = fopen(filepath, "r");
   if (!fd) {
-    ESP_LOGE(SGO_LOG_NOSEND, "Failed to read existing file : %s", filepath);
+    SGO_LOGE(HTTPD, SGO_LOG_NOSEND, "Failed to read existing file : %s", filepath);
     /* If file exists but unable to open respond with 500 Server Error */
     httpd_resp_set_status(req, "500 Server Error");
     httpd_resp_sendstr(req, "Failed to read existing file!");
     return ESP_OK;
   }
 
-  /* Retrieve the pointer to file_buffer buffer for temporary storage */
+  char *buf = malloc(FILE_BUFSIZE);
+  if (!buf) {
+    fclose(fd);
+    return httpd_resp_send_500(req);
+  }
+
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  const char *etag = get_etag(filepath, &file_stat, fd, buf);
+  if (etag) {
+    httpd_resp_set_hdr(req, "ETag", etag);
+    if (etag_matches(req, etag)) {
+      SGO_LOGD(HTTPD, SGO_LOG_NOSEND, "Not modified : %s", filepath);
+      fclose(fd);
+      free(buf);
+      httpd_resp_set_status(req, "304 Not Modified");
+      httpd_resp_send(req, NULL, 0);
+      return ESP_OK;
+    }
+  }
+
+  SGO_LOGI(HTTPD, SGO_LOG_NOSEND, "Sending file : %s (%ld bytes)...", filepath, file_stat.st_size);
+  set_content_type_from_file(req);
+  httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+
   size_t chunksize;
   do {
-    /* Read file in chunks into the file_buffer buffer */
-    chunksize = fread(file_buffer, 1, FILE_BUFSIZE, fd);
-    ESP_LOGI(SGO_LOG_NOSEND, "%d", chunksize);
+    /* Read file in chunks into the request's buffer */
+    chunksize = fread(buf, 1, FILE_BUFSIZE, fd);
+    SGO_LOGD(HTTPD, SGO_LOG_NOSEND, "%d", chunksize);
 
     /* Send the buffer contents as HTTP response chunk */
-    if (httpd_resp_send_chunk(req, file_buffer, chunksize) != ESP_OK) {
+    if (httpd_resp_send_chunk(req, buf, chunksize) != ESP_OK) {
       fclose(fd);
-      ESP_LOGE(SGO_LOG_NOSEND, "File sending failed!");
+      free(buf);
+      SGO_LOGE(HTTPD, SGO_LOG_NOSEND, "File sending failed!");
       /* Abort sending file */
       httpd_resp_sendstr_chunk(req, NULL);
       /* Send error message with status code */
@@ -194,7 +309,8 @@ static esp_err_t http_resp_file(httpd_req_t *req)
 
   /* Close file after sending complete */
   fclose(fd);
-  ESP_LOGI(SGO_LOG_NOSEND, "File sending complete");
+  free(buf);
+  SGO_LOGI(HTTPD, SGO_LOG_NOSEND, "File sending complete");
 
   /* Respond with an empty chunk to signal HTTP response completion */
   httpd_resp_send_chunk(req, NULL, 0);
@@ -208,7 +324,7 @@ esp_err_t download_get_handler(httpd_req_t *req)
     return 0;
   }
 
-  ESP_LOGI(SGO_LOG_NOSEND, "download_get_handler");
+  SGO_LOGD(HTTPD, SGO_LOG_NOSEND, "download_get_handler");
   // Check if the target is a directory
   if (req->uri[strlen(req->uri) - 1] == '/') {
     // In so, send an html with directory listing
@@ -220,6 +336,26 @@ esp_err_t download_get_handler(httpd_req_t *req)
   return ESP_OK;
 }
 
+static bool read_sha256_header(httpd_req_t *req, uint8_t *sha256) {
+  char hex[65] = {0};
+  if (httpd_req_get_hdr_value_len(req, "X-Content-SHA256") != 64 ||
+      httpd_req_get_hdr_value_str(req, "X-Content-SHA256", hex, sizeof(hex)) != ESP_OK) {
+    return false;
+  }
+  return sodium_hex2bin(sha256, 32, hex, 64, NULL, NULL, NULL) == 0;
+}
+
+static void upload_failed(httpd_req_t *req, FILE *fd, char *buf, mbedtls_sha256_context *sha256_ctx, httpd_err_code_t code, const char *msg) {
+  ESP_LOGE(SGO_LOG_EVENT, "@FS Upload failed: %s", msg);
+  if (fd) {
+    fclose(fd);
+  }
+  free(buf);
+  mbedtls_sha256_free(sha256_ctx);
+  unlink(UPLOAD_TMP_PATH);
+  httpd_resp_send_err(req, code, msg);
+}
+
 esp_err_t upload_post_handler(httpd_req_t *req)
 {
   if (auth_request(req) == false) {
@@ -228,9 +364,8 @@ esp_err_t upload_post_handler(httpd_req_t *req)
 
   char filepath[FILE_PATH_MAX];
   FILE *fd = NULL;
-  //struct stat file_stat;
 
-  /* Skip leading "/upload" from URI to get filename */
+  /* Skip leading "/fs" from URI to get filename */
   /* Note sizeof() counts NULL termination hence the -1 */
   const char *filename = req->uri + sizeof("/fs") - 1;
 
@@ -247,83 +382,112 @@ esp_err_t upload_post_handler(httpd_req_t *req)
 
   /* Concatenate the requested file path */
   strcat(filepath, filename);
-  /*if (!stat(filepath, &file_stat) == 0) {
-    ESP_LOGE(SGO_LOG_EVENT, "File already exists : %s", filepath);
-    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "File already exists");
-    return ESP_FAIL;
-    }*/
 
-  /* File cannot be larger than a limit */
-  if (req->content_len > MAX_FILE_SIZE) {
-    ESP_LOGE(SGO_LOG_EVENT, "@FS File too large : %d bytes", req->content_len);
-    /* Respond with 400 Bad Request */
-    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
-        "File size must be less than " MAX_FILE_SIZE_STR " !");
+  /* The temp file and the current one coexist until the rename */
+  unlink(UPLOAD_TMP_PATH);
+  size_t total = 0, used = 0;
+  if (esp_spiffs_info(NULL, &total, &used) != ESP_OK || req->content_len > total - used) {
+    ESP_LOGE(SGO_LOG_EVENT, "@FS File too large : %d bytes, %d available", req->content_len, total - used);
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Not enough space left on storage");
     /* Return failure to close underlying connection else the
      * incoming file content will keep the socket busy */
     return ESP_FAIL;
   }
 
-  fd = fopen(filepath, "w");
+  uint8_t expected_sha256[32] = {0};
+  bool check_sha256 = read_sha256_header(req, expected_sha256);
+
+  char *buf = malloc(FILE_BUFSIZE);
+  if (!buf) {
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    return ESP_FAIL;
+  }
+
+  fd = fopen(UPLOAD_TMP_PATH, "w");
   if (!fd) {
-    ESP_LOGE(SGO_LOG_EVENT, "@FS Failed to create file : %s", filepath);
+    free(buf);
+    ESP_LOGE(SGO_LOG_EVENT, "@FS Failed to create file : %s", UPLOAD_TMP_PATH);
     /* Respond with 500 Internal Server Error */
     httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create file");
     return ESP_FAIL;
   }
 
+  mbedtls_sha256_context sha256_ctx;
+  mbedtls_sha256_init(&sha256_ctx);
+  mbedtls_sha256_starts_ret(&sha256_ctx, false);
+
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-  ESP_LOGI(SGO_LOG_EVENT, "@FS Receiving file : %s...", filename);
+  ESP_LOGI(SGO_LOG_EVENT, "@FS Receiving file : %s (%d bytes)...", filename, req->content_len);
 
-  /* Retrieve the pointer to scratch buffer for temporary storage */
-  char *buf = file_buffer;
   int received;
+  size_t total_received = 0;
+  int64_t last_progress = esp_timer_get_time();
 
   /* Content length of the request gives
    * the size of the file being uploaded */
   int remaining = req->content_len;
 
   while (remaining > 0) {
-
-    ESP_LOGI(SGO_LOG_EVENT, "@FS Remaining size : %d", remaining);
     /* Receive the file part by part into a buffer */
     if ((received = httpd_req_recv(req, buf, MIN(remaining, FILE_BUFSIZE))) <= 0) {
       if (received == HTTPD_SOCK_ERR_TIMEOUT) {
         /* Retry if timeout occurred */
         continue;
       }
-
-      /* In case of unrecoverable error,
-       * close and delete the unfinished file*/
-      fclose(fd);
-      unlink(filepath);
-
-      ESP_LOGE(SGO_LOG_EVENT, "@FS File reception failed!");
-      /* Respond with 500 Internal Server Error */
-      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive file");
+      upload_failed(req, fd, buf, &sha256_ctx, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive file");
       return ESP_FAIL;
     }
 
     /* Write buffer content to file on storage */
-    if (received && (received != fwrite(buf, 1, received, fd))) {
+    if (received != fwrite(buf, 1, received, fd)) {
       /* Couldn't write everything to file!
        * Storage may be full? */
-      fclose(fd);
-      unlink(filepath);
-
-      ESP_LOGE(SGO_LOG_EVENT, "@FS File write failed!");
-      /* Respond with 500 Internal Server Error */
-      httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
+      upload_failed(req, fd, buf, &sha256_ctx, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
       return ESP_FAIL;
     }
+    if (check_sha256) {
+      mbedtls_sha256_update_ret(&sha256_ctx, (uint8_t *)buf, received);
+    }
 
     /* Keep track of remaining size of
      * the file left to be uploaded */
     remaining -= received;
+    total_received += received;
+
+    int64_t now = esp_timer_get_time();
+    if (now - last_progress >= UPLOAD_PROGRESS_INTERVAL_US) {
+      last_progress = now;
+      ESP_LOGI(SGO_LOG_EVENT, "@FS Received %d/%d bytes", total_received, req->content_len);
+    }
   }
 
-  /* Close file upon upload completion */
-  fclose(fd);
+  if (fclose(fd) != 0 || total_received != req->content_len) {
+    fd = NULL;
+    upload_failed(req, fd, buf, &sha256_ctx, HTTPD_500_INTERNAL_SERVER_ERROR, "Incomplete file");
+    return ESP_FAIL;
+  }
+  fd = NULL;
+  free(buf);
+  buf = NULL;
+
+  if (check_sha256) {
+    uint8_t sha256[32] = {0};
+    mbedtls_sha256_finish_ret(&sha256_ctx, sha256);
+    if (memcmp(sha256, expected_sha256, sizeof(sha256)) != 0) {
+      upload_failed(req, fd, buf, &sha256_ctx, HTTPD_400_BAD_REQUEST, "SHA-256 mismatch");
+      return ESP_FAIL;
+    }
+  }
+  mbedtls_sha256_free(&sha256_ctx);
+
+  invalidate_etag(filepath);
+  unlink(filepath);
+  if (rename(UPLOAD_TMP_PATH, filepath) != 0) {
+    ESP_LOGE(SGO_LOG_EVENT, "@FS Failed to rename %s to %s", UPLOAD_TMP_PATH, filepath);
+    unlink(UPLOAD_TMP_PATH);
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to replace file");
+    return ESP_FAIL;
+  }
   ESP_LOGI(SGO_LOG_EVENT, "@FS File reception complete");
 
   httpd_resp_sendstr(req, "@FS File uploaded successfully");
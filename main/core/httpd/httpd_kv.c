@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#include "../kv/kv.h"
+#include "../kv/kv_mapping.h"
+#include "../log/log.h"
+#include "httpd_params.h"
+#include "httpd_writer.h"
+
+/*
+ * Batch access to the kv store, so a page load doesn't need one request per key.
+ *
+ * GET /kv?k=KEY1,KEY2 or GET /kv?p=PREFIX1,PREFIX2
+ *   {"KEY1":12,"KEY2":"value","UNKNOWN":null}
+ *
+ * POST /kv, body: KEY1=12&KEY2=url%20encoded
+ *   {"ok":1,"failed":["KEY2"]}
+ */
+
+#define MAX_KV_BODY_SIZE 4096
+#define MAX_KEY_SIZE 50
+
+typedef struct {
+  resp_writer w;
+  bool first;
+} kv_resp;
+
+// JSON escaping, unescaped runs are written in one go
+static void kv_resp_quoted(kv_resp *r, const char *value) {
+  resp_write(&r->w, "\"", 1);
+  for (const char *c = value; *c;) {
+    size_t n = 0;
+    while (c[n] && c[n] != '"' && c[n] != '\\' && (unsigned char)c[n] >= 0x20) {
+      ++n;
+    }
+    resp_write(&r->w, c, n);
+    c += n;
+    if (*c == '"' || *c == '\\') {
+      resp_printf(&r->w, "\\%c", *c++);
+    } else if (*c) {
+      resp_printf(&r->w, "\\u%04x", *c++);
+    }
+  }
+  resp_write(&r->w, "\"", 1);
+}
+
+// names come from the request, they are escaped like values
+static void kv_resp_key(kv_resp *r, const char *name) {
+  if (!r->first) {
+    resp_write(&r->w, ",", 1);
+  }
+  kv_resp_quoted(r, name);
+  resp_write(&r->w, ":", 1);
+  r->first = false;
+}
+
+static void kv_resp_int(kv_resp *r, const char *name, int value) {
+  kv_resp_key(r, name);
+  resp_printf(&r->w, "%d", value);
+}
+
+static void kv_resp_uint(kv_resp *r, const char *name, unsigned int value) {
+  kv_resp_key(r, name);
+  resp_printf(&r->w, "%u", value);
+}
+
+static void kv_resp_str(kv_resp *r, const char *name, const char *value) {
+  kv_resp_key(r, name);
+  kv_resp_quoted(r, value);
+}
+
+static void write_kv(kv_resp *r, const char *name) {
+  const kvi8_mapping *hi8 = get_kvi8_mapping(name, false);
+  const kvui8_mapping *hui8 = hi8 ? NULL : get_kvui8_mapping(name, false);
+  const kvi16_mapping *hi16 = hi8 || hui8 ? NULL : get_kvi16_mapping(name, false);
+  const kvui16_mapping *hui16 = hi8 || hui8 || hi16 ? NULL : get_kvui16_mapping(name, false);
+  const kvi32_mapping *hi32 = hi8 || hui8 || hi16 || hui16 ? NULL : get_kvi32_mapping(name, false);
+  const kvui32_mapping *hui32 = hi8 || hui8 || hi16 || hui16 || hi32 ? NULL : get_kvui32_mapping(name, false);
+
+  if (hi8) {
+    kv_resp_int(r, name, hi8->getter());
+  } else if (hui8) {
+    kv_resp_int(r, name, hui8->getter());
+  } else if (hi16) {
+    kv_resp_int(r, name, hi16->getter());
+  } else if (hui16) {
+    kv_resp_int(r, name, hui16->getter());
+  } else if (hi32) {
+    kv_resp_int(r, name, hi32->getter());
+  } else if (hui32) {
+    kv_resp_uint(r, name, hui32->getter());
+  } else {
+    const kvs_mapping *hs = get_kvs_mapping(name, false);
+    if (hs) {
+      char v[MAX_KVALUE_SIZE] = {0};
+      hs->getter(v, MAX_KVALUE_SIZE - 1);
+      kv_resp_str(r, name, v);
+    } else {
+      kv_resp_key(r, name);
+      resp_write_str(&r->w, "null");
+    }
+  }
+}
+
+bool get_kv_str(const char *name, char *value, size_t len) {
+  const kvi8_mapping *hi8 = get_kvi8_mapping(name, false);
+  const kvui8_mapping *hui8 = hi8 ? NULL : get_kvui8_mapping(name, false);
+  const kvi16_mapping *hi16 = hi8 || hui8 ? NULL : get_kvi16_mapping(name, false);
+  const kvui16_mapping *hui16 = hi8 || hui8 || hi16 ? NULL : get_kvui16_mapping(name, false);
+  const kvi32_mapping *hi32 = hi8 || hui8 || hi16 || hui16 ? NULL : get_kvi32_mapping(name, false);
+  const kvui32_mapping *hui32 = hi8 || hui8 || hi16 || hui16 || hi32 ? NULL : get_kvui32_mapping(name, false);
+
+  if (hi8) {
+    snprintf(value, len, "%d", hi8->getter());
+  } else if (hui8) {
+    snprintf(value, len, "%d", hui8->getter());
+  } else if (hi16) {
+    snprintf(value, len, "%d", hi16->getter());
+  } else if (hui16) {
+    snprintf(value, len, "%d", hui16->getter());
+  } else if (hi32) {
+    snprintf(value, len, "%d", hi32->getter());
+  } else if (hui32) {
+    snprintf(value, len, "%u", hui32->getter());
+  } else {
+    const kvs_mapping *hs = get_kvs_mapping(name, false);
+    if (!hs) {
+      return false;
+    }
+    hs->getter(value, MIN(len, MAX_KVALUE_SIZE) - 1);
+  }
+  return true;
+}
+
+#define WRITE_PREFIXED_INTS(r, mappings, write, prefix, len) \
+  for (int i = 0; mappings[i].name != NULL; ++i) { \
+    if (strncmp(mappings[i].name, prefix, len) == 0) { \
+      write(r, mappings[i].name, mappings[i].getter()); \
+    } \
+  }
+
+static void write_prefixed_kvs(kv_resp *r, const char *prefix, size_t len) {
+  WRITE_PREFIXED_INTS(r, kvi8_mappings, kv_resp_int, prefix, len);
+  WRITE_PREFIXED_INTS(r, kvui8_mappings, kv_resp_int, prefix, len);
+  WRITE_PREFIXED_INTS(r, kvi16_mappings, kv_resp_int, prefix, len);
+  WRITE_PREFIXED_INTS(r, kvui16_mappings, kv_resp_int, prefix, len);
+  WRITE_PREFIXED_INTS(r, kvi32_mappings, kv_resp_int, prefix, len);
+  WRITE_PREFIXED_INTS(r, kvui32_mappings, kv_resp_uint, prefix, len);
+  for (int i = 0; kvs_mappings[i].name != NULL; ++i) {
+    if (strncmp(kvs_mappings[i].name, prefix, len) == 0) {
+      char v[MAX_KVALUE_SIZE] = {0};
+      kvs_mappings[i].getter(v, MAX_KVALUE_SIZE - 1);
+      kv_resp_str(r, kvs_mappings[i].name, v);
+    }
+  }
+}
+
+static bool set_kv(const char *name, const char *value) {
+  const kvi8_mapping *hi8 = get_kvi8_mapping(name, false);
+  if (hi8 && hi8->setter) {
+    hi8->setter((int8_t)atoi(value));
+    return true;
+  }
+  const kvui8_mapping *hui8 = get_kvui8_mapping(name, false);
+  if (hui8 && hui8->setter) {
+    hui8->setter((uint8_t)atoi(value));
+    return true;
+  }
+  const kvi16_mapping *hi16 = get_kvi16_mapping(name, false);
+  if (hi16 && hi16->setter) {
+    hi16->setter((int16_t)atoi(value));
+    return true;
+  }
+  const kvui16_mapping *hui16 = get_kvui16_mapping(name, false);
+  if (hui16 && hui16->setter) {
+    hui16->setter((uint16_t)atoi(value));
+    return true;
+  }
+  const kvi32_mapping *hi32 = get_kvi32_mapping(name, false);
+  if (hi32 && hi32->setter) {
+    hi32->setter((int32_t)atoi(value));
+    return true;
+  }
+  const kvui32_mapping *hui32 = get_kvui32_mapping(name, false);
+  if (hui32 && hui32->setter) {
+    hui32->setter((uint32_t)strtoul(value, NULL, 10));
+    return true;
+  }
+  const kvs_mapping *hs = get_kvs_mapping(name, false);
+  if (hs && hs->setter) {
+    hs->setter(value);
+    return true;
+  }
+  return false;
+}
+
+// longest entry of a k= or p= list
+static size_t max_list_entry(const char *list) {
+  size_t max = 0;
+  for (const char *name = list; *name;) {
+    size_t len = strcspn(name, ",");
+    max = MAX(max, len);
+    name += name[len] ? len + 1 : len;
+  }
+  return max;
+}
+
+esp_err_t kv_get_handler(httpd_req_t *req) {
+  if (auth_request(req) == false) {
+    return 0;
+  }
+
+  httpd_params params;
+  if (parse_query_params(req, &params) != ESP_OK) {
+    free_params(&params);
+    return httpd_resp_send_404(req);
+  }
+  const char *list = get_param(&params, "k");
+  bool prefix = list == NULL;
+  if (prefix) {
+    list = get_param(&params, "p");
+  }
+  if (list == NULL) {
+    free_params(&params);
+    return httpd_resp_send_404(req);
+  }
+  // truncated, a name could read another key
+  if (max_list_entry(list) >= MAX_KEY_SIZE) {
+    free_params(&params);
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Key too long");
+    return ESP_FAIL;
+  }
+
+  kv_resp *r = malloc(sizeof(kv_resp));
+  if (r == NULL) {
+    free_params(&params);
+    return httpd_resp_send_500(req);
+  }
+  resp_writer_init(&r->w, req);
+  r->first = true;
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  resp_write_str(&r->w, "{");
+  for (const char *name = list; *name;) {
+    size_t len = strcspn(name, ",");
+    // skipped when empty, as a prefix it would match the whole store
+    if (len > 0 && prefix) {
+      write_prefixed_kvs(r, name, len);
+    } else if (len > 0) {
+      char key[MAX_KEY_SIZE] = {0};
+      memcpy(key, name, len);
+      write_kv(r, key);
+    }
+    name += name[len] ? len + 1 : len;
+  }
+  resp_write_str(&r->w, "}");
+  resp_writer_end(&r->w);
+
+  free(r);
+  free_params(&params);
+  return ESP_OK;
+}
+
+esp_err_t kv_post_handler(httpd_req_t *req) {
+  if (auth_request(req) == false) {
+    return 0;
+  }
+  if (req->content_len > MAX_KV_BODY_SIZE) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Body too large");
+    return ESP_FAIL;
+  }
+
+  char *body = malloc(req->content_len + 1);
+  kv_resp *r = malloc(sizeof(kv_resp));
+  if (body == NULL || r == NULL) {
+    free(body);
+    free(r);
+    return httpd_resp_send_500(req);
+  }
+
+  size_t received = 0;
+  while (received < req->content_len) {
+    int ret = httpd_req_recv(req, &body[received], req->content_len - received);
+    if (ret <= 0) {
+      if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+        continue;
+      }
+      free(body);
+      free(r);
+      return ESP_FAIL;
+    }
+    received += ret;
+  }
+  body[received] = 0;
+
+  resp_writer_init(&r->w, req);
+  r->first = true;
+
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  resp_write_str(&r->w, "{\"failed\":[");
+
+  int n_ok = 0;
+  for (char *pair = body; *pair;) {
+    size_t len = strcspn(pair, "&\n");
+    char *next = pair[len] ? &pair[len + 1] : &pair[len];
+    pair[len] = 0;
+
+    char *value = strchr(pair, '=');
+    if (value) {
+      *(value++) = 0;
+      int len = url_decode_inplace(value);
+      if (len >= 0 && len < MAX_KVALUE_SIZE && set_kv(pair, value)) {
+        ++n_ok;
+      } else {
+        if (!r->first) {
+          resp_write(&r->w, ",", 1);
+        }
+        kv_resp_quoted(r, pair);
+        r->first = false;
+      }
+    }
+    pair = next;
+  }
+
+  resp_printf(&r->w, "],\"ok\":%d}", n_ok);
+  resp_writer_end(&r->w);
+
+  free(body);
+  free(r);
+  return ESP_OK;
+}
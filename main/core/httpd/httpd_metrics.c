@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "nvs.h"
+
+#include "../kv/kv.h"
+#include "../log/log.h"
+#include "../mqtt/mqtt.h"
+#include "httpd_writer.h"
+
+/*
+ * Device health in the Prometheus text exposition format.
+ *
+ * GET /metrics
+ *   # TYPE sgo_heap_free_bytes gauge
+ *   sgo_heap_free_bytes 81234
+ *   ...
+ *
+ * Task runtime percentages are relative to one core, so on the ESP32 they sum
+ * up to ~200% (idle tasks included).
+ */
+
+static void metric_type(resp_writer *w, const char *name, const char *type, const char *help) {
+  resp_printf(w, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metric(resp_writer *w, const char *name, const char *type, const char *help, long long value) {
+  metric_type(w, name, type, help);
+  resp_printf(w, "%s %lld\n", name, value);
+}
+
+static void write_heap_metrics(resp_writer *w) {
+  metric(w, "sgo_heap_free_bytes", "gauge", "Free heap", esp_get_free_heap_size());
+  metric(w, "sgo_heap_min_free_bytes", "gauge", "Lowest free heap since boot", esp_get_minimum_free_heap_size());
+  metric(w, "sgo_heap_largest_free_block_bytes", "gauge", "Largest allocatable block", heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
+
+static void write_task_metrics(resp_writer *w) {
+  UBaseType_t n_tasks = uxTaskGetNumberOfTasks() + 2;
+  TaskStatus_t *tasks = malloc(n_tasks * sizeof(TaskStatus_t));
+  if (tasks == NULL) {
+    return;
+  }
+  uint32_t total_runtime = 0;
+  n_tasks = uxTaskGetSystemState(tasks, n_tasks, &total_runtime);
+
+  metric_type(w, "sgo_task_stack_free_bytes", "gauge", "Stack high-water mark, lowest free stack since the task started");
+  for (int i = 0; i < n_tasks; ++i) {
+    resp_printf(w, "sgo_task_stack_free_bytes{task=\"%s\"} %u\n", tasks[i].pcTaskName, (unsigned)tasks[i].usStackHighWaterMark);
+  }
+
+  metric_type(w, "sgo_task_runtime_percent", "gauge", "Share of one core used by the task since boot");
+  total_runtime /= 100;
+  for (int i = 0; total_runtime && i < n_tasks; ++i) {
+    resp_printf(w, "sgo_task_runtime_percent{task=\"%s\"} %u\n", tasks[i].pcTaskName, (unsigned)(tasks[i].ulRunTimeCounter / total_runtime));
+  }
+  free(tasks);
+}
+
+static void write_mqtt_metrics(resp_writer *w) {
+  size_t used, size;
+  mqtt_log_buffer_usage(&used, &size);
+  metric(w, "sgo_mqtt_log_buffer_used_bytes", "gauge", "Log records waiting to be published", used);
+  metric(w, "sgo_mqtt_log_buffer_size_bytes", "gauge", "Log buffer capacity", size);
+  metric(w, "sgo_mqtt_log_dropped_total", "counter", "Log records dropped", get_broker_log_dropped());
+  metric(w, "sgo_mqtt_log_truncated_total", "counter", "Log records truncated", get_broker_log_truncated());
+  metric(w, "sgo_mqtt_log_overflowed_total", "counter", "Log records evicted from a full buffer", get_broker_log_overflowed());
+}
+
+static void write_cmd_metrics(resp_writer *w) {
+  metric(w, "sgo_cmd_queued", "gauge", "Commands waiting to run", get_cmd_queued());
+  metric(w, "sgo_cmd_max_queued", "gauge", "Most commands waiting at once since boot", get_cmd_max_queued());
+  metric(w, "sgo_cmd_rejected_total", "counter", "Commands rejected because their queue was full", get_cmd_rejected());
+  metric(w, "sgo_cmd_latency_ms", "gauge", "Moving average of the time from enqueue to completion", get_cmd_latency());
+  metric(w, "sgo_cmd_max_latency_ms", "gauge", "Longest time from enqueue to completion since boot", get_cmd_max_latency());
+}
+
+static void write_nvs_metrics(resp_writer *w) {
+  nvs_stats_t stats;
+  if (nvs_get_stats(NULL, &stats) != ESP_OK) {
+    return;
+  }
+  metric(w, "sgo_nvs_used_entries", "gauge", "NVS entries used", stats.used_entries);
+  metric(w, "sgo_nvs_free_entries", "gauge", "NVS entries free", stats.free_entries);
+}
+
+static void write_wifi_metrics(resp_writer *w) {
+  wifi_ap_record_t ap;
+  if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+    metric(w, "sgo_wifi_rssi_dbm", "gauge", "RSSI of the current access point", ap.rssi);
+  }
+  metric(w, "sgo_wifi_reconnects_total", "counter", "Reconnections since boot", get_wifi_reconnects());
+  metric(w, "sgo_wifi_connect_time_ms", "gauge", "Time the last connection took, from start or disconnection to IP", get_wifi_connect_time());
+}
+
+static void write_ota_metrics(resp_writer *w) {
+  metric(w, "sgo_ota_status", "gauge", "OTA status, 0 idle, 1 in progress, 2 disabled", get_ota_status());
+  metric(w, "sgo_ota_progress_percent", "gauge", "Progress of the current or last firmware download", get_ota_progress());
+  metric(w, "sgo_ota_received_bytes", "gauge", "Bytes received by the current or last firmware download", get_ota_received());
+  metric(w, "sgo_ota_speed_bytes_per_second", "gauge", "Average throughput of the current or last firmware download", get_ota_speed());
+}
+
+esp_err_t metrics_get_handler(httpd_req_t *req) {
+  if (auth_request(req) == false) {
+    return 0;
+  }
+  resp_writer *w = malloc(sizeof(resp_writer));
+  if (w == NULL) {
+    return httpd_resp_send_500(req);
+  }
+  resp_writer_init(w, req);
+
+  httpd_resp_set_type(req, "text/plain; version=0.0.4");
+  metric(w, "sgo_uptime_seconds", "counter", "Time since boot", esp_timer_get_time() / 1000000);
+  write_heap_metrics(w);
+  write_task_metrics(w);
+  write_mqtt_metrics(w);
+  write_cmd_metrics(w);
+  write_nvs_metrics(w);
+  write_wifi_metrics(w);
+  write_ota_metrics(w);
+  resp_writer_end(w);
+
+  free(w);
+  return ESP_OK;
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpd_params.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+static int hexval(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+int url_decode_inplace(char *s) {
+  char *start = s, *o = s;
+  for (; *s; ++s, ++o) {
+    if (*s == '+') {
+      *o = ' ';
+    } else if (*s == '%') {
+      int h = hexval(s[1]), l = h < 0 ? -1 : hexval(s[2]);
+      if (l < 0) {
+        *o = 0;
+        return -1;
+      }
+      *o = (h << 4) | l;
+      s += 2;
+    } else {
+      *o = *s;
+    }
+  }
+  *o = 0;
+  return o - start;
+}
+
+static void add_param(httpd_params *params, const char *key, const char *value) {
+  if (params->n < MAX_HTTPD_PARAMS) {
+    params->params[params->n].key = key;
+    params->params[params->n].value = value;
+    ++params->n;
+  }
+}
+
+// key=value&key2=value2, keys without '=' get an empty value
+static esp_err_t tokenize_form(httpd_params *params, char *p) {
+  while (*p) {
+    char *key = p;
+    p += strcspn(p, "&");
+    if (*p) {
+      *(p++) = 0;
+    }
+    char *value = strchr(key, '=');
+    if (value) {
+      *(value++) = 0;
+    } else {
+      value = key + strlen(key);
+    }
+    if (url_decode_inplace(key) < 0 || url_decode_inplace(value) < 0) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    if (*key) {
+      add_param(params, key, value);
+    }
+  }
+  return ESP_OK;
+}
+
+// unescapes the JSON string starting after the opening quote, returns the char after the closing quote
+static char *json_string(char *p, char **str) {
+  char *o = p;
+  *str = p;
+  for (; *p && *p != '"'; ++p, ++o) {
+    if (*p != '\\') {
+      *o = *p;
+      continue;
+    }
+    switch (*(++p)) {
+      case 'n': *o = '\n'; break;
+      case 't': *o = '\t'; break;
+      case 'r': *o = '\r'; break;
+      case 'b': *o = '\b'; break;
+      case 'f': *o = '\f'; break;
+      case 'u': {
+        int c = 0;
+        for (int i = 1; i <= 4; ++i) {
+          int h = hexval(p[i]);
+          if (h < 0) return NULL;
+          c = (c << 4) | h;
+        }
+        if (c > 0x7f) return NULL; // values are ascii
+        *o = c;
+        p += 4;
+        break;
+      }
+      case 0: return NULL;
+      default: *o = *p; break;
+    }
+  }
+  if (*p != '"') {
+    return NULL;
+  }
+  *o = 0;
+  return p + 1;
+}
+
+static char *skip_spaces(char *p) {
+  while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') ++p;
+  return p;
+}
+
+// flat object only, numbers, true/false/null are kept as their text
+static esp_err_t tokenize_json(httpd_params *params, char *p) {
+  p = skip_spaces(p);
+  if (*(p++) != '{') {
+    return ESP_ERR_INVALID_ARG;
+  }
+  p = skip_spaces(p);
+  if (*p == '}') {
+    return ESP_OK;
+  }
+  while (true) {
+    char *key, *value;
+    p = skip_spaces(p);
+    if (*p != '"' || (p = json_string(p + 1, &key)) == NULL) {
+      return ESP_ERR_INVALID_ARG;
+    }
+    p = skip_spaces(p);
+    if (*(p++) != ':') {
+      return ESP_ERR_INVALID_ARG;
+    }
+    p = skip_spaces(p);
+    if (*p == '"') {
+      if ((p = json_string(p + 1, &value)) == NULL) {
+        return ESP_ERR_INVALID_ARG;
+      }
+    } else {
+      value = p;
+      p += strcspn(p, ",} \t\r\n");
+      if (p == value) {
+        return ESP_ERR_INVALID_ARG;
+      }
+      char end = *p;
+      *p = 0;
+      if (end == ',' || end == '}') {
+        // the separator was overwritten, handle it here
+        add_param(params, key, value);
+        if (end == '}') return ESP_OK;
+        ++p;
+        continue;
+      }
+      ++p;
+    }
+    add_param(params, key, value);
+    p = skip_spaces(p);
+    if (*p == '}') {
+      return ESP_OK;
+    }
+    if (*(p++) != ',') {
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+}
+
+esp_err_t parse_query_params(httpd_req_t *req, httpd_params *params) {
+  memset(params, 0, sizeof(httpd_params));
+  size_t len = httpd_req_get_url_query_len(req);
+  params->buf = malloc(len + 1);
+  if (params->buf == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  params->buf[0] = 0;
+  if (len && httpd_req_get_url_query_str(req, params->buf, len + 1) != ESP_OK) {
+    return ESP_FAIL;
+  }
+  return tokenize_form(params, params->buf);
+}
+
+esp_err_t parse_body_params(httpd_req_t *req, httpd_params *params, size_t max_len) {
+  memset(params, 0, sizeof(httpd_params));
+  if (req->content_len > max_len) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  params->buf = malloc(req->content_len + 1);
+  if (params->buf == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  size_t received = 0;
+  while (received < req->content_len) {
+    int ret = httpd_req_recv(req, &params->buf[received], req->content_len - received);
+    if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+      continue;
+    } else if (ret <= 0) {
+      return ESP_FAIL;
+    }
+    received += ret;
+  }
+  params->buf[received] = 0;
+
+  char *p = skip_spaces(params->buf);
+  if (*p == '{') {
+    return tokenize_json(params, p);
+  }
+  return tokenize_form(params, p);
+}
+
+const char *get_param(const httpd_params *params, const char *key) {
+  for (int i = 0; i < params->n; ++i) {
+    if (params->params[i].key[0] == key[0] && strcmp(params->params[i].key, key) == 0) {
+      return params->params[i].value;
+    }
+  }
+  return NULL;
+}
+
+void free_params(httpd_params *params) {
+  free(params->buf);
+  params->buf = NULL;
+  params->n = 0;
+}
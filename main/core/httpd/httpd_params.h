@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTPD_PARAMS_H_
+#define HTTPD_PARAMS_H_
+
+#include <stddef.h>
+
+#include <esp_http_server.h>
+
+/*
+ * Request parameters, parsed in one pass.
+ *
+ * The query string, or the body (form encoded or a flat JSON object), is
+ * copied once in a buffer owned by httpd_params, and decoded in place:
+ * keys and values point into that buffer.
+ */
+
+#define MAX_HTTPD_PARAMS 16
+
+typedef struct {
+  const char *key;
+  const char *value;
+} httpd_param;
+
+typedef struct {
+  char *buf;
+  int n;
+  httpd_param params[MAX_HTTPD_PARAMS];
+} httpd_params;
+
+esp_err_t parse_query_params(httpd_req_t *req, httpd_params *params);
+esp_err_t parse_body_params(httpd_req_t *req, httpd_params *params, size_t max_len);
+const char *get_param(const httpd_params *params, const char *key);
+void free_params(httpd_params *params);
+
+// decodes %XX and '+' in place, returns the decoded length or -1 on a bad escape
+int url_decode_inplace(char *s);
+
+#endif
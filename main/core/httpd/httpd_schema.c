@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpd.h"
+
+#include <stdio.h>
+
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#include "../log/log.h"
+
+/*
+ * The web app's schema, generated from schema.json.template and gzipped by
+ * update_templates.sh, then embedded in rodata (COMPONENT_EMBED_FILES), so it
+ * always matches the running firmware's fields.
+ */
+
+extern const uint8_t schema_json_gz_start[] asm("_binary_schema_json_gz_start");
+extern const uint8_t schema_json_gz_end[] asm("_binary_schema_json_gz_end");
+
+static char schema_etag[20] = {0};
+
+// FNV-1a over the blob, computed on first request
+static const char *get_schema_etag() {
+  if (schema_etag[0]) {
+    return schema_etag;
+  }
+  uint32_t hash = 2166136261U;
+  for (const uint8_t *c = schema_json_gz_start; c < schema_json_gz_end; ++c) {
+    hash = (hash ^ *c) * 16777619U;
+  }
+  snprintf(schema_etag, sizeof(schema_etag), "\"%08x-%x\"", (unsigned)hash, (unsigned)(schema_json_gz_end - schema_json_gz_start));
+  return schema_etag;
+}
+
+esp_err_t schema_get_handler(httpd_req_t *req) {
+  if (auth_request(req) == false) {
+    return 0;
+  }
+  const char *etag = get_schema_etag();
+  httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  httpd_resp_set_hdr(req, "ETag", etag);
+  if (etag_matches(req, etag)) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_send(req, NULL, 0);
+    return ESP_OK;
+  }
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+  httpd_resp_send(req, (const char *)schema_json_gz_start, schema_json_gz_end - schema_json_gz_start);
+  return ESP_OK;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "httpd_writer.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+void resp_writer_init(resp_writer *w, httpd_req_t *req) {
+  w->req = req;
+  w->err = ESP_OK;
+  w->len = 0;
+}
+
+void resp_flush(resp_writer *w) {
+  if (w->len && w->err == ESP_OK) {
+    w->err = httpd_resp_send_chunk(w->req, w->buf, w->len);
+  }
+  w->len = 0;
+}
+
+void resp_write(resp_writer *w, const char *data, size_t len) {
+  while (len && w->err == ESP_OK) {
+    size_t n = MIN(len, RESP_WRITER_BUFSIZE - w->len);
+    memcpy(&w->buf[w->len], data, n);
+    w->len += n;
+    data += n;
+    len -= n;
+    if (w->len == RESP_WRITER_BUFSIZE) {
+      resp_flush(w);
+    }
+  }
+}
+
+void resp_write_str(resp_writer *w, const char *str) {
+  resp_write(w, str, strlen(str));
+}
+
+// formats in place, flushes and retries once if it didn't fit
+void resp_printf(resp_writer *w, const char *fmt, ...) {
+  if (w->err != ESP_OK) {
+    return;
+  }
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(&w->buf[w->len], RESP_WRITER_BUFSIZE - w->len, fmt, args);
+  va_end(args);
+  if (n < 0) {
+    return;
+  }
+  if (n >= RESP_WRITER_BUFSIZE - w->len) {
+    resp_flush(w);
+    if (w->err != ESP_OK) {
+      return;
+    }
+    va_start(args, fmt);
+    n = vsnprintf(w->buf, RESP_WRITER_BUFSIZE, fmt, args);
+    va_end(args);
+    if (n < 0) {
+      return;
+    }
+    n = MIN(n, RESP_WRITER_BUFSIZE - 1);
+  }
+  w->len += n;
+}
+
+esp_err_t resp_writer_end(resp_writer *w) {
+  resp_flush(w);
+  if (w->err == ESP_OK) {
+    w->err = httpd_resp_send_chunk(w->req, NULL, 0);
+  }
+  return w->err;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTPD_WRITER_H_
+#define HTTPD_WRITER_H_
+
+#include <stddef.h>
+
+#include <esp_http_server.h>
+#include "sdkconfig.h"
+
+/*
+ * Buffered chunked response.
+ *
+ * Writes are accumulated in the writer's buffer and sent as one chunk per
+ * TCP segment, instead of one chunk (and socket write) per call. After a
+ * failed send, later writes are dropped.
+ */
+
+// leaves room for the chunk size line and trailing CRLF
+#define RESP_WRITER_BUFSIZE (CONFIG_TCP_MSS - 8)
+
+typedef struct {
+  httpd_req_t *req;
+  esp_err_t err;
+  size_t len;
+  char buf[RESP_WRITER_BUFSIZE];
+} resp_writer;
+
+void resp_writer_init(resp_writer *w, httpd_req_t *req);
+void resp_write(resp_writer *w, const char *data, size_t len);
+void resp_write_str(resp_writer *w, const char *str);
+// output longer than RESP_WRITER_BUFSIZE is truncated
+void resp_printf(resp_writer *w, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void resp_flush(resp_writer *w);
+// flushes and sends the terminating chunk
+esp_err_t resp_writer_end(resp_writer *w);
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "freertos/FreeRTOS.h"
+
+#include "kv_feed.h"
+
+static portMUX_TYPE feed_mux = portMUX_INITIALIZER_UNLOCKED;
+static const char *feed[KV_FEED_SIZE] = {0};
+static uint32_t feed_head = 0;
+
+void kv_feed_push(const char *name) {
+  portENTER_CRITICAL(&feed_mux);
+  feed[feed_head % KV_FEED_SIZE] = name;
+  ++feed_head;
+  portEXIT_CRITICAL(&feed_mux);
+}
+
+uint32_t kv_feed_head() {
+  portENTER_CRITICAL(&feed_mux);
+  uint32_t head = feed_head;
+  portEXIT_CRITICAL(&feed_mux);
+  return head;
+}
+
+int kv_feed_read(uint32_t *cursor, const char **names, int max) {
+  int n = 0;
+  portENTER_CRITICAL(&feed_mux);
+  if (feed_head - *cursor > KV_FEED_SIZE) {
+    *cursor = feed_head;
+    portEXIT_CRITICAL(&feed_mux);
+    return -1;
+  }
+  for (; *cursor != feed_head && n < max; ++(*cursor)) {
+    names[n++] = feed[*cursor % KV_FEED_SIZE];
+  }
+  portEXIT_CRITICAL(&feed_mux);
+  return n;
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KV_FEED_H_
+#define KV_FEED_H_
+
+#include <stdint.h>
+
+/*
+ * Feed of changed keys. Every set_<field> that changes a value pushes the
+ * key's name. Readers keep their own cursor, so any number of them can
+ * follow the feed. A reader that falls more than KV_FEED_SIZE changes behind
+ * gets -1 and has to resync.
+ */
+
+#define KV_FEED_SIZE 128
+
+void kv_feed_push(const char *name);
+uint32_t kv_feed_head();
+// names are the mapping's caps names, string literals, compare them with strcmp
+int kv_feed_read(uint32_t *cursor, const char **names, int max);
+
+#endif
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "log.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#include "../kv/kv.h"
+#include "../mqtt/mqtt.h"
+
+/*
+ * Binary record layout (little endian):
+ *   u8 SGO_LOG_BINARY_MARKER, u8 tag, u16 message id, u32 timestamp,
+ *   then each argument: int32/uint32 as 4 bytes, strings as u8 length + bytes
+ */
+#define MAX_BINARY_RECORD_SIZE 160
+
+bool sgo_log_binary = false;
+
+static const char *module_names[] = {SGO_LOG_MODULE_NAMES};
+static const uint8_t module_levels[] = {SGO_LOG_MODULE_LEVELS};
+uint8_t sgo_log_levels[SGO_LOG_MODULE_COUNT] = {SGO_LOG_MODULE_LEVELS};
+
+static const char *level_names[] = {"none", "error", "warn", "info", "debug", "verbose"};
+
+static const char *text_formats[] = {
+#define SGO_LOG_MESSAGE(id, args, format) LOG_FORMAT(I, format),
+  SGO_LOG_MESSAGES
+#undef SGO_LOG_MESSAGE
+};
+
+static const char *message_args[] = {
+#define SGO_LOG_MESSAGE(id, args, format) args,
+  SGO_LOG_MESSAGES
+#undef SGO_LOG_MESSAGE
+};
+
+// index is the tag byte of the binary record, NOSEND records are never stored
+static const char *tags[] = {SGO_LOG_NOSEND, SGO_LOG_MSG, SGO_LOG_EVENT, SGO_LOG_METRIC};
+
+const char *sgo_log_text_format(sgo_log_message msg) {
+  return text_formats[msg];
+}
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = v >> 24;
+  return p + 4;
+}
+
+void sgo_log_struct(const char *tag, sgo_log_message msg, ...) {
+  uint8_t tag_index = 0;
+  for (int i = 1; i < sizeof(tags) / sizeof(tags[0]); ++i) {
+    if (strcmp(tags[i], tag) == 0) {
+      tag_index = i;
+      break;
+    }
+  }
+  if (tag_index == 0 || msg >= SGO_MSG_COUNT) {
+    return;
+  }
+
+  uint8_t record[MAX_BINARY_RECORD_SIZE];
+  uint8_t *p = record;
+  const uint8_t *end = record + sizeof(record);
+
+  *(p++) = SGO_LOG_BINARY_MARKER;
+  *(p++) = tag_index;
+  p = put_u16(p, msg);
+  p = put_u32(p, esp_log_timestamp());
+
+  va_list l;
+  va_start(l, msg);
+  // every argument is consumed, so a later 's' never reads an int, but
+  // nothing is appended after the first one that doesn't fit
+  bool full = false;
+  for (const char *arg = message_args[msg]; *arg; ++arg) {
+    if (*arg == 's') {
+      const char *str = va_arg(l, const char *);
+      size_t room = p < end ? end - p - 1 : 0;
+      if (full || room == 0) {
+        full = true;
+        continue;
+      }
+      size_t len = strlen(str);
+      if (len > room) {
+        len = room;
+      }
+      if (len > 0xff) {
+        len = 0xff;
+      }
+      *(p++) = len;
+      memcpy(p, str, len);
+      p += len;
+    } else {
+      uint32_t value = *arg == 'u' ? va_arg(l, unsigned int) : (uint32_t)va_arg(l, int);
+      if (full || end - p < 4) {
+        full = true;
+        continue;
+      }
+      p = put_u32(p, value);
+    }
+  }
+  va_end(l);
+
+  mqtt_log_record((const char *)record, p - record);
+}
+
+static int parse_level(const char *value, size_t len) {
+  if (len > 0 && value[0] >= '0' && value[0] <= '9') {
+    return atoi(value);
+  }
+  for (int i = 0; i < sizeof(level_names) / sizeof(level_names[0]); ++i) {
+    if (strlen(level_names[i]) == len && strncmp(level_names[i], value, len) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// value is a comma separated list of module=level, unlisted modules get their compiled level back
+static void parse_log_levels(const char *value) {
+  memcpy(sgo_log_levels, module_levels, sizeof(sgo_log_levels));
+
+  while (*value) {
+    const char *sep = strchr(value, '=');
+    if (!sep) {
+      break;
+    }
+    const char *end = strchr(sep, ',');
+    if (!end) {
+      end = sep + strlen(sep);
+    }
+
+    int level = parse_level(sep + 1, end - sep - 1);
+    for (int i = 0; i < SGO_LOG_MODULE_COUNT; ++i) {
+      if (strlen(module_names[i]) == sep - value && strncmp(module_names[i], value, sep - value) == 0) {
+        if (level >= 0) {
+          sgo_log_levels[i] = level;
+        }
+        break;
+      }
+    }
+    value = *end ? end + 1 : end;
+  }
+}
+
+void init_log() {
+  // module levels are filtered by SGO_LOGx, let every level through esp_log_write
+  esp_log_level_set(SGO_LOG_NOSEND, ESP_LOG_VERBOSE);
+  esp_log_level_set(SGO_LOG_MSG, ESP_LOG_VERBOSE);
+  esp_log_level_set(SGO_LOG_EVENT, ESP_LOG_VERBOSE);
+  esp_log_level_set(SGO_LOG_METRIC, ESP_LOG_VERBOSE);
+
+  sgo_log_binary = get_log_binary() != 0;
+
+  char levels[MAX_KVALUE_SIZE] = {0};
+  get_log_levels(levels, MAX_KVALUE_SIZE - 1);
+  parse_log_levels(levels);
+}
+
+/* KV Callbacks */
+
+int on_set_log_binary(int value) {
+  sgo_log_binary = value != 0;
+  return value;
+}
+
+const char *on_set_log_levels(const char *value) {
+  parse_log_levels(value);
+  return value;
+}
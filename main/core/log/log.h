@@ -19,11 +19,77 @@
 #ifndef LOG_H_
 #define LOG_H_
 
+#include <stdbool.h>
+
+#include <stdint.h>
+
 #include "esp_log.h"
+#include "log_messages.h"
+#include "log_levels.h"
 
 #define SGO_LOG_NOSEND "NOSEND"
 #define SGO_LOG_MSG "MSG"
 #define SGO_LOG_EVENT "EVENT"
 #define SGO_LOG_METRIC "METRIC"
 
+/*
+ * Per-module log levels
+ *
+ * SGO_LOGx(MODULE, tag, format, ...) logs only if the level is enabled for
+ * the module. Levels above the module's log_level (set in its cue file) are
+ * compiled out entirely, arguments included. Below that, LOG_LEVELS can
+ * lower (or restore) them at runtime, ie. "httpd=warn,sht21=none".
+ */
+
+extern uint8_t sgo_log_levels[SGO_LOG_MODULE_COUNT];
+
+#define SGO_LOG_ENABLED(module, level) \
+  (SGO_LOG_LEVEL_##module >= level && sgo_log_levels[SGO_LOG_MODULE_##module] >= level)
+
+#define SGO_LOG_LEVEL(module, level, letter, tag, format, ...) do { \
+    if (SGO_LOG_ENABLED(module, level)) { \
+      esp_log_write(level, tag, LOG_FORMAT(letter, format), esp_log_timestamp(), tag, ##__VA_ARGS__); \
+    } \
+  } while (0)
+
+#define SGO_LOGE(module, tag, format, ...) SGO_LOG_LEVEL(module, ESP_LOG_ERROR, E, tag, format, ##__VA_ARGS__)
+#define SGO_LOGW(module, tag, format, ...) SGO_LOG_LEVEL(module, ESP_LOG_WARN, W, tag, format, ##__VA_ARGS__)
+#define SGO_LOGI(module, tag, format, ...) SGO_LOG_LEVEL(module, ESP_LOG_INFO, I, tag, format, ##__VA_ARGS__)
+#define SGO_LOGD(module, tag, format, ...) SGO_LOG_LEVEL(module, ESP_LOG_DEBUG, D, tag, format, ##__VA_ARGS__)
+#define SGO_LOGV(module, tag, format, ...) SGO_LOG_LEVEL(module, ESP_LOG_VERBOSE, V, tag, format, ##__VA_ARGS__)
+
+/*
+ * Structured logs
+ *
+ * When LOG_BINARY is set, SGO_LOGI_STRUCT stores the message id and its raw
+ * arguments as a binary record, the text is rebuilt off-device from
+ * log_messages.h. Otherwise it's logged as text like ESP_LOGI.
+ */
+
+#define SGO_LOG_BINARY_MARKER 0xB1
+
+typedef enum {
+#define SGO_LOG_MESSAGE(id, args, format) SGO_MSG_##id,
+  SGO_LOG_MESSAGES
+#undef SGO_LOG_MESSAGE
+  SGO_MSG_COUNT,
+} sgo_log_message;
+
+extern bool sgo_log_binary;
+
+const char *sgo_log_text_format(sgo_log_message msg);
+void sgo_log_struct(const char *tag, sgo_log_message msg, ...);
+
+#define SGO_LOGI_STRUCT(tag, msg, ...) do { \
+    if (sgo_log_binary) { \
+      sgo_log_struct(tag, msg, ##__VA_ARGS__); \
+    } else { \
+      esp_log_write(ESP_LOG_INFO, tag, sgo_log_text_format(msg), esp_log_timestamp(), tag, ##__VA_ARGS__); \
+    } \
+  } while (0)
+
+void init_log();
+int on_set_log_binary(int value);
+const char *on_set_log_levels(const char *value);
+
 #endif
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOG_MESSAGES_H_
+#define LOG_MESSAGES_H_
+
+/*
+ * Message catalog for structured logs.
+ *
+ * SGO_LOG_MESSAGE(id, args, format)
+ *   args: one char per argument, 'i' for int32, 'u' for uint32, 's' for string
+ *
+ * Message ids are the position in this list, so only append at the end.
+ * decode_log.py reads this file to turn binary records back into text.
+ */
+
+#define SGO_LOG_MESSAGES \
+  SGO_LOG_MESSAGE(KV_INT, "si", "@KV %s=%d") \
+  SGO_LOG_MESSAGE(KV_STR, "ss", "@KV %s=%s") \
+  SGO_LOG_MESSAGE(CMD_DONE, "s", "@CMD (%s) done")
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "lz.h"
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5 // the LZ4 format requires the block to end with literals
+#define MF_LIMIT 12 // and the last match to start this far from the end
+
+static uint32_t read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t hash(uint32_t v) {
+  return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *write_length(uint8_t *op, size_t len) {
+  for (; len >= 255; len -= 255) {
+    *op++ = 255;
+  }
+  *op++ = len;
+  return op;
+}
+
+static uint8_t *write_sequence(uint8_t *op, const uint8_t *literals, size_t n_literals) {
+  uint8_t *token = op++;
+  *token = (n_literals >= 15 ? 15 : n_literals) << 4;
+  if (n_literals >= 15) {
+    op = write_length(op, n_literals - 15);
+  }
+  memcpy(op, literals, n_literals);
+  return op + n_literals;
+}
+
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len, uint16_t table[LZ_HASH_SIZE]) {
+  if (len > LZ_MAX_INPUT_SIZE || dst_len < LZ_COMPRESS_BOUND(len)) {
+    return 0;
+  }
+
+  const uint8_t *ip = src + 1;
+  const uint8_t *anchor = src;
+  const uint8_t *end = src + len;
+  uint8_t *op = dst;
+
+  memset(table, 0, sizeof(uint16_t) * LZ_HASH_SIZE);
+
+  if (len >= MF_LIMIT) {
+    const uint8_t *mflimit = end - MF_LIMIT;
+    const uint8_t *matchlimit = end - LAST_LITERALS;
+
+    while (ip <= mflimit) {
+      uint32_t h = hash(read32(ip));
+      const uint8_t *ref = src + table[h];
+      table[h] = ip - src;
+      if (ref >= ip || read32(ref) != read32(ip)) {
+        ++ip;
+        continue;
+      }
+
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+        --ip;
+        --ref;
+      }
+      const uint8_t *mp = ip + MIN_MATCH;
+      const uint8_t *mr = ref + MIN_MATCH;
+      while (mp < matchlimit && *mp == *mr) {
+        ++mp;
+        ++mr;
+      }
+
+      uint8_t *token = op;
+      op = write_sequence(op, anchor, ip - anchor);
+      uint16_t offset = ip - ref;
+      *op++ = offset & 0xff;
+      *op++ = offset >> 8;
+      size_t match_len = mp - ip - MIN_MATCH;
+      *token |= match_len >= 15 ? 15 : match_len;
+      if (match_len >= 15) {
+        op = write_length(op, match_len - 15);
+      }
+
+      ip = anchor = mp;
+      if (ip - 2 > src) {
+        table[hash(read32(ip - 2))] = ip - 2 - src;
+      }
+    }
+  }
+
+  op = write_sequence(op, anchor, end - anchor);
+  if (op - dst >= len) {
+    return 0;
+  }
+  return op - dst;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LZ_H_
+#define LZ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Small LZ77 compressor, output is a raw LZ4 block (no frame header), so
+ * any LZ4 decoder can read it. Inputs are limited to 64KB, which is also
+ * the match window.
+ */
+
+#define LZ_HASH_BITS 10
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+#define LZ_MAX_INPUT_SIZE 0xffff
+
+#define LZ_COMPRESS_BOUND(len) ((len) + (len) / 255 + 16)
+
+// table is the caller's scratch space, returns 0 if the output doesn't fit or the input doesn't shrink
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len, uint16_t table[LZ_HASH_SIZE]);
+
+#endif
@@ -16,11 +16,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+
 #include "mqtt.h"
+#include "lz.h"
 #include "mqtt_client.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
 #include "esp_log.h"
 #include "sodium/utils.h"
 #include "mbedtls/sha256.h"
@@ -31,30 +36,210 @@
 #include "../cmd/cmd.h"
 
 #define MAX_REMOTE_CMD_LENGTH MAX_CMD_LENGTH-10 // keeps some space for the -r true parameter
+#define MAX_REMOTE_BATCH_LENGTH 8192
+#define MAX_BATCH_ID_LENGTH 64
 
 static esp_mqtt_client_handle_t client;
 
+// reassembly buffer for remote commands received in several chunks
+static char *remote_data = NULL;
+
 static QueueHandle_t cmd;
-static QueueHandle_t log_queue;
 
-#define MAX_LOG_QUEUE_ITEM_SIZE 128
-#define MAX_LOG_QUEUE_ITEMS 50
-static uint8_t buf_out[MAX_LOG_QUEUE_ITEM_SIZE] = {0};
+/*
+ * Log records are stored back to back in a byte ring buffer, so short lines
+ * only cost their own length (plus the ringbuf item header) instead of a
+ * fixed slot. When full, the oldest records are evicted to make room.
+ */
+#define LOG_BUFFER_SIZE CONFIG_SGO_LOG_BUFFER_SIZE
+#define MAX_LOG_RECORD_SIZE CONFIG_SGO_LOG_MAX_RECORD_SIZE
+#define MAX_LOG_EVICTIONS 16
+
+static RingbufHandle_t log_buffer;
+static SemaphoreHandle_t log_mutex;
+static char log_record[MAX_LOG_RECORD_SIZE] = {0};
+
+// protected by log_mutex, except for the dropped counter when log_mutex can't be taken
+static uint32_t n_log_dropped = 0;
+static uint32_t n_log_truncated = 0;
+static uint32_t n_log_overflowed = 0;
+
+// bytes of the records in log_buffer, xRingbufferGetCurFreeSize only gives
+// the largest item that still fits, less than what's free once it wraps
+static portMUX_TYPE log_queued_mux = portMUX_INITIALIZER_UNLOCKED;
+static size_t log_queued_bytes = 0;
+
+static void count_log_queued(int delta) {
+  portENTER_CRITICAL(&log_queued_mux);
+  log_queued_bytes += delta;
+  portEXIT_CRITICAL(&log_queued_mux);
+}
+
+static size_t get_log_queued() {
+  portENTER_CRITICAL(&log_queued_mux);
+  size_t queued = log_queued_bytes;
+  portEXIT_CRITICAL(&log_queued_mux);
+  return queued;
+}
+
+/*
+ * With broker_compress set, records are sent in batches instead, as frames:
+ *
+ *   u8 header (LOG_FRAME_RAW or LOG_FRAME_LZ), u16 batch length, payload
+ *
+ * The batch is a list of u16 record length + record, the payload is either
+ * the batch as-is or its LZ4 block. The header bytes can't start a UTF-8
+ * text line nor a binary log record. Each frame decodes on its own, as QoS 0
+ * publishes can be lost.
+ */
+#define LOG_BATCH_SIZE CONFIG_SGO_LOG_BATCH_SIZE
+#define LOG_FRAME_SIZE (3 + LZ_COMPRESS_BOUND(LOG_BATCH_SIZE))
+#define LOG_BATCH_DELAY (5000 / portTICK_PERIOD_MS)
+#define LOG_FRAME_RAW 0xC0
+#define LOG_FRAME_LZ 0xC1
+
+// only used from mqtt_task, allocated when compression is first enabled
+static uint8_t *log_batch = NULL;
+static uint8_t *log_frame = NULL;
+static uint16_t *lz_table = NULL;
+
+static uint64_t n_log_raw_bytes = 0;
+static uint64_t n_log_sent_bytes = 0;
+
+/*
+ * Command replies are queued here by the CMD task and published, in order,
+ * on <clientid>.reply by mqtt_task.
+ */
+#define REPLY_BUFFER_SIZE 4096
+
+static RingbufHandle_t reply_buffer;
 
 static int CMD_MQTT_DISCONNECTED = 0;
 static int CMD_MQTT_CONNECTED = 1;
 static int CMD_MQTT_FORCE_FLUSH = 2;
 
-static void subscribe_cmd() {
-  char cmd_channel[MAX_KVALUE_SIZE] = {0};
+static void get_client_channel(char *channel, const char *suffix) {
   char client_id[MAX_KVALUE_SIZE] = {0};
   get_broker_clientid(client_id, sizeof(client_id) - 1);
-  sprintf(cmd_channel, "%s.cmd", client_id);
+  sprintf(channel, "%s.%s", client_id, suffix);
+}
 
-  ESP_LOGI(SGO_LOG_NOSEND, "@MQTT subscribe_cmd %s", cmd_channel);
+static void subscribe_cmd() {
+  char cmd_channel[MAX_KVALUE_SIZE + 8] = {0};
+  get_client_channel(cmd_channel, "cmd");
+
+  SGO_LOGI(MQTT, SGO_LOG_NOSEND, "@MQTT subscribe_cmd %s", cmd_channel);
   esp_mqtt_client_subscribe(client, cmd_channel, 2);
 }
 
+static bool check_signature(const char *hash, const char *body, int len) {
+  char signingKey[33] = {0};
+  getstr(SIGNING_KEY, signingKey, 33);
+
+  uint8_t localHashBin[32] = {0};
+  mbedtls_sha256_context sha256_ctx;
+  mbedtls_sha256_init(&sha256_ctx);
+  mbedtls_sha256_starts_ret(&sha256_ctx, false);
+  mbedtls_sha256_update_ret(&sha256_ctx, (uint8_t *)signingKey, strlen(signingKey));
+  mbedtls_sha256_update_ret(&sha256_ctx, (uint8_t *)":", 1);
+  mbedtls_sha256_update_ret(&sha256_ctx, (uint8_t *)body, len);
+  mbedtls_sha256_finish_ret(&sha256_ctx, localHashBin);
+  mbedtls_sha256_free(&sha256_ctx);
+
+  char localHash[65] = {0};
+  sodium_bin2hex(localHash, sizeof(localHash), localHashBin, sizeof(localHashBin));
+  return strncmp(localHash, hash, 64) == 0;
+}
+
+/*
+ * Remote commands are signed as "<sha256(signing_key:body) as hex> <body>".
+ *
+ * The body is either a single command, or a batch:
+ *
+ *   batch <batch id>\n<command>\n<command>...
+ *
+ * which is verified once and run by the CMD task in order, or a binary
+ * command frame (see cmd_bin.c).
+ */
+static void handle_remote_cmd(const char *data, int len) {
+  if (len < 66) {
+    ESP_LOGI(SGO_LOG_EVENT, "@MQTT Remote command disabled: missing signing key");
+    return;
+  }
+  const char *body = &data[65];
+  bool bin = (uint8_t)body[0] == CMD_BIN_REQUEST;
+  int body_len = bin ? len - 65 : strnlen(body, len - 65);
+  bool batch = !bin && body_len > 6 && strncmp(body, "batch ", 6) == 0;
+
+  if (bin && body_len > MAX_CMD_BIN_LENGTH) {
+    ESP_LOGI(SGO_LOG_EVENT, "@MQTT Binary command can't be larger that %d with signature", MAX_CMD_BIN_LENGTH + 65);
+    return;
+  }
+  if (!bin && !batch && body_len > MAX_REMOTE_CMD_LENGTH) {
+    ESP_LOGI(SGO_LOG_EVENT, "@MQTT Remote command string can't be larger that %d with signature", MAX_REMOTE_CMD_LENGTH + 65);
+    return;
+  }
+  if (!hasstr(SIGNING_KEY)) {
+    ESP_LOGI(SGO_LOG_EVENT, "@MQTT Remote command disabled: missing signign key");
+    return;
+  }
+  if (!check_signature(data, body, body_len)) {
+    ESP_LOGI(SGO_LOG_EVENT, "@MQTT Command signing check failed.");
+    return;
+  }
+
+  if (bin) {
+    execute_cmd_bin((const uint8_t *)body, body_len, true);
+    return;
+  }
+  if (!batch) {
+    execute_cmd(body_len, body, true);
+    return;
+  }
+
+  const char *cmds = memchr(body, '\n', body_len);
+  if (!cmds || cmds - body - 6 >= MAX_BATCH_ID_LENGTH || cmds - body + 1 >= body_len) {
+    ESP_LOGI(SGO_LOG_EVENT, "@MQTT Malformed command batch");
+    return;
+  }
+  char id[MAX_BATCH_ID_LENGTH] = {0};
+  memcpy(id, &body[6], cmds - body - 6);
+  ++cmds;
+  execute_cmd_batch(id, body_len - (cmds - body), cmds);
+}
+
+// messages larger than the mqtt client's buffer are received in several events
+static void on_remote_data(esp_mqtt_event_handle_t event) {
+  if (event->total_data_len <= event->data_len) {
+    handle_remote_cmd(event->data, event->data_len);
+    return;
+  }
+
+  if (event->current_data_offset == 0) {
+    free(remote_data);
+    remote_data = NULL;
+    if (event->total_data_len > MAX_REMOTE_BATCH_LENGTH + 65) {
+      ESP_LOGI(SGO_LOG_EVENT, "@MQTT Remote command batch can't be larger that %d with signature", MAX_REMOTE_BATCH_LENGTH + 65);
+      return;
+    }
+    remote_data = malloc(event->total_data_len);
+    if (remote_data == NULL) {
+      ESP_LOGE(SGO_LOG_EVENT, "@MQTT Unable to allocate remote command buffer");
+      return;
+    }
+  }
+  if (remote_data == NULL || event->current_data_offset + event->data_len > event->total_data_len) {
+    return;
+  }
+  memcpy(&remote_data[event->current_data_offset], event->data, event->data_len);
+
+  if (event->current_data_offset + event->data_len == event->total_data_len) {
+    handle_remote_cmd(remote_data, event->total_data_len);
+    free(remote_data);
+    remote_data = NULL;
+  }
+}
+
 static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event) {
   switch (event->event_id) {
     case MQTT_EVENT_BEFORE_CONNECT:
@@ -79,44 +264,7 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event) {
       break;
     case MQTT_EVENT_DATA:
       ESP_LOGI(SGO_LOG_EVENT, "@MQTT MQTT_EVENT_DATA");
-      if (event->data_len > MAX_REMOTE_CMD_LENGTH + 65) {
-        ESP_LOGI(SGO_LOG_EVENT, "@MQTT Remote command string can't be larger that %d with signature", MAX_REMOTE_CMD_LENGTH + 65);
-        break;
-      }
-      if (event->data_len < 66) {
-        ESP_LOGI(SGO_LOG_EVENT, "@MQTT Remote command disabled: missing signing key");
-        break;
-      }
-      if (hasstr(SIGNING_KEY)) {
-        char signingKey[33] = {0};
-        getstr(SIGNING_KEY, signingKey, 33);
-        char hash[65] = {0};
-        strncpy(hash, event->data, 64);
-        char cmd[MAX_REMOTE_CMD_LENGTH + 1] = {0};
-        strncpy(cmd, &(event->data[65]), event->data_len - 65);
-
-        char cmdSeeded[MAX_REMOTE_CMD_LENGTH + 33 + 1] = {0};
-        uint8_t localHashBin[32] = {0};
-        sprintf(cmdSeeded, "%s:%s", signingKey, cmd);
-
-        //ESP_LOGI(SGO_LOG_EVENT, "@MQTT Hash: %s - Cmd: %s", hash, cmd);
-        mbedtls_sha256_context sha256_ctx;
-        mbedtls_sha256_init(&sha256_ctx);
-        mbedtls_sha256_starts_ret(&sha256_ctx, false);
-        mbedtls_sha256_update_ret(&sha256_ctx, (uint8_t *)cmdSeeded, strlen(cmdSeeded));
-        mbedtls_sha256_finish_ret(&sha256_ctx, localHashBin);
-
-        char localHash[65] = {0};
-        sodium_bin2hex(localHash, sizeof(localHash), localHashBin, sizeof(localHashBin));
-        if (strncmp(localHash, hash, 64) != 0) {
-          ESP_LOGI(SGO_LOG_EVENT, "@MQTT Command signing check failed.");
-          break;
-        }
-
-        execute_cmd(event->data_len - 65, cmd, true);
-      } else {
-        ESP_LOGI(SGO_LOG_EVENT, "@MQTT Remote command disabled: missing signign key");
-      }
+      on_remote_data(event);
       break;
     case MQTT_EVENT_ERROR:
       ESP_LOGI(SGO_LOG_EVENT, "@MQTT MQTT_EVENT_ERROR");
@@ -128,10 +276,102 @@ static esp_err_t mqtt_event_handler(esp_mqtt_event_handle_t event) {
   return ESP_OK;
 }
 
+static void update_log_stats() {
+  set_broker_log_dropped(n_log_dropped);
+  set_broker_log_truncated(n_log_truncated);
+  set_broker_log_overflowed(n_log_overflowed);
+  if (n_log_sent_bytes) {
+    set_broker_compress_ratio(n_log_raw_bytes * 100 / n_log_sent_bytes);
+  }
+}
+
+static void publish_replies(const char *channel) {
+  size_t len;
+  char *reply;
+  while ((reply = (char *)xRingbufferReceive(reply_buffer, &len, 0)) != NULL) {
+    esp_mqtt_client_publish(client, channel, reply, len, 1, 0);
+    vRingbufferReturnItem(reply_buffer, reply);
+  }
+}
+
+static void publish_log_records(const char *channel) {
+  size_t len;
+  char *record;
+  while ((record = (char *)xRingbufferReceive(log_buffer, &len, 0)) != NULL) {
+    esp_mqtt_client_publish(client, channel, record, len, 0, 0);
+    vRingbufferReturnItem(log_buffer, record);
+    count_log_queued(-(int)len);
+  }
+}
+
+static bool alloc_log_batch() {
+  if (log_batch) {
+    return true;
+  }
+  log_batch = malloc(LOG_BATCH_SIZE);
+  log_frame = malloc(LOG_FRAME_SIZE);
+  lz_table = malloc(sizeof(uint16_t) * LZ_HASH_SIZE);
+  if (log_batch == NULL || log_frame == NULL || lz_table == NULL) {
+    ESP_LOGE(SGO_LOG_EVENT, "@MQTT Unable to allocate log batch buffers");
+    free(log_batch);
+    free(log_frame);
+    free(lz_table);
+    log_batch = NULL;
+    log_frame = NULL;
+    lz_table = NULL;
+    return false;
+  }
+  return true;
+}
+
+// waits for half a batch, or LOG_BATCH_DELAY, to give the compressor something to work with
+static bool log_batch_ready(TickType_t last_flush) {
+  return get_log_queued() >= LOG_BATCH_SIZE / 2 || xTaskGetTickCount() - last_flush >= LOG_BATCH_DELAY;
+}
+
+static void publish_log_batch(const char *channel, size_t len) {
+  size_t payload_len = lz_compress(log_batch, len, &log_frame[3], LOG_FRAME_SIZE - 3, lz_table);
+  if (payload_len) {
+    log_frame[0] = LOG_FRAME_LZ;
+  } else {
+    log_frame[0] = LOG_FRAME_RAW;
+    memcpy(&log_frame[3], log_batch, len);
+    payload_len = len;
+  }
+  log_frame[1] = len & 0xff;
+  log_frame[2] = len >> 8;
+  esp_mqtt_client_publish(client, channel, (const char *)log_frame, payload_len + 3, 0, 0);
+
+  n_log_raw_bytes += len;
+  n_log_sent_bytes += payload_len + 3;
+}
+
+static void publish_log_batches(const char *channel) {
+  size_t len;
+  uint8_t *record;
+  size_t batch_len = 0;
+  while ((record = (uint8_t *)xRingbufferReceive(log_buffer, &len, 0)) != NULL) {
+    if (batch_len + 2 + len > LOG_BATCH_SIZE) {
+      publish_log_batch(channel, batch_len);
+      batch_len = 0;
+    }
+    log_batch[batch_len++] = len & 0xff;
+    log_batch[batch_len++] = len >> 8;
+    memcpy(&log_batch[batch_len], record, len);
+    batch_len += len;
+    vRingbufferReturnItem(log_buffer, record);
+    count_log_queued(-(int)len);
+  }
+  if (batch_len) {
+    publish_log_batch(channel, batch_len);
+  }
+}
+
 static void mqtt_task(void *param) {
   int c;
   bool connected = false;
   bool first_connect = true;
+  TickType_t last_flush = xTaskGetTickCount();
 
   uint64_t _chipmacid;
   esp_efuse_mac_get_default((uint8_t*) (&_chipmacid));
@@ -154,6 +394,9 @@ static void mqtt_task(void *param) {
   }
   ESP_LOGI(SGO_LOG_EVENT, "@MQTT Log clientid: %s", client_id);
 
+  char reply_channel[MAX_KVALUE_SIZE + 8] = {0};
+  get_client_channel(reply_channel, "reply");
+
   char broker_url[MAX_KVALUE_SIZE] = {0};
   getstr(BROKER_URL, broker_url, sizeof(broker_url)-1);
   esp_mqtt_client_config_t mqtt_cfg = {
@@ -181,14 +424,55 @@ static void mqtt_task(void *param) {
         connected = false;
       }
     }
-    if (connected) {
-      memset(buf_out, 0, MAX_LOG_QUEUE_ITEM_SIZE);
-      while (xQueueReceive(log_queue, buf_out, 0)) {
-        esp_mqtt_client_publish(client, log_channel, (char *)buf_out, 0, 0, 0);
-        memset(buf_out, 0, MAX_LOG_QUEUE_ITEM_SIZE);
+    if (connected && reply_buffer) {
+      publish_replies(reply_channel);
+    }
+    if (connected && log_buffer) {
+      if (get_broker_compress() && alloc_log_batch()) {
+        if (log_batch_ready(last_flush)) {
+          publish_log_batches(log_channel);
+          last_flush = xTaskGetTickCount();
+        }
+      } else {
+        publish_log_records(log_channel);
       }
     }
+    update_log_stats();
+  }
+}
+
+static bool take_log_buffer() {
+  if (log_buffer == NULL || log_mutex == NULL || xSemaphoreTake(log_mutex, 10 / portTICK_PERIOD_MS) != pdTRUE) {
+    ++n_log_dropped;
+    return false;
+  }
+  return true;
+}
+
+static void give_log_buffer() {
+  xSemaphoreGive(log_mutex);
+  if (cmd) {
+    xQueueSend(cmd, &CMD_MQTT_FORCE_FLUSH, 0);
+  }
+}
+
+// must be called with log_mutex taken
+static void push_log_record(const char *record, size_t len) {
+  for (int i = 0; i < MAX_LOG_EVICTIONS; ++i) {
+    if (xRingbufferSend(log_buffer, record, len, 0) == pdTRUE) {
+      count_log_queued(len);
+      return;
+    }
+    size_t evicted_len;
+    void *evicted = xRingbufferReceive(log_buffer, &evicted_len, 0);
+    if (evicted == NULL) {
+      break;
+    }
+    vRingbufferReturnItem(log_buffer, evicted);
+    count_log_queued(-(int)evicted_len);
+    ++n_log_overflowed;
   }
+  ++n_log_dropped;
 }
 
 static int mqtt_logging_vprintf(const char *str, va_list l) {
@@ -198,39 +482,65 @@ static int mqtt_logging_vprintf(const char *str, va_list l) {
        strncmp("E (%d) %s", &(str[7]), 9) != 0)) {
     return vprintf(str, l); 
   }
-  int totalsize = vsnprintf(NULL, 0, str, l);
-  if (totalsize >= MAX_LOG_QUEUE_ITEM_SIZE - 1) {
-    return vprintf(str, l);
-  }
-  
+
   va_list nl;
   va_copy(nl, l);
   va_arg(nl, int);
   const char *tag = va_arg(nl, const char *);
+  va_end(nl);
   if (strcmp(tag, SGO_LOG_MSG) != 0 &&
       strcmp(tag, SGO_LOG_EVENT) != 0 &&
       strcmp(tag, SGO_LOG_METRIC) != 0) {
     return vprintf(str, l);
   }
 
-  uint8_t buf_in[MAX_LOG_QUEUE_ITEM_SIZE] = {0};
-  if (uxQueueMessagesWaiting(log_queue) >= MAX_LOG_QUEUE_ITEMS) {
-    xQueueReceive(log_queue, buf_in, 0);
+  if (!take_log_buffer()) {
+    return vprintf(str, l);
   }
-  memset(buf_in, 0, MAX_LOG_QUEUE_ITEM_SIZE);
-  int len = vsnprintf((char*)buf_in, MAX_LOG_QUEUE_ITEM_SIZE-1, str, l);
-  buf_in[len] = 0;
-  xQueueSend(log_queue, buf_in, 0);
-  if (cmd/* && uxQueueMessagesWaiting(log_queue) > 5*/) {
-    xQueueSend(cmd, &CMD_MQTT_FORCE_FLUSH, 0);
+  va_copy(nl, l);
+  int len = vsnprintf(log_record, MAX_LOG_RECORD_SIZE, str, nl);
+  va_end(nl);
+  if (len >= MAX_LOG_RECORD_SIZE) {
+    ++n_log_truncated;
+    len = MAX_LOG_RECORD_SIZE - 1;
+    log_record[len - 1] = '\n';
+  }
+  if (len > 0) {
+    push_log_record(log_record, len);
   }
+  give_log_buffer();
+
   return vprintf(str, l);
 }
 
+void mqtt_log_record(const char *record, size_t len) {
+  if (!take_log_buffer()) {
+    return;
+  }
+  push_log_record(record, len);
+  give_log_buffer();
+}
+
+void mqtt_log_buffer_usage(size_t *used, size_t *size) {
+  *size = LOG_BUFFER_SIZE;
+  *used = get_log_queued();
+}
+
+void mqtt_reply(const char *reply, size_t len) {
+  if (reply_buffer == NULL || xRingbufferSend(reply_buffer, reply, len, 0) != pdTRUE) {
+    ESP_LOGE(SGO_LOG_EVENT, "@MQTT Reply buffer full, dropping reply");
+    return;
+  }
+  if (cmd) {
+    xQueueSend(cmd, &CMD_MQTT_FORCE_FLUSH, 0);
+  }
+}
+
 void mqtt_intercept_log() {
-  log_queue = xQueueCreate(MAX_LOG_QUEUE_ITEMS, MAX_LOG_QUEUE_ITEM_SIZE);
-  if (log_queue == NULL) {
-    ESP_LOGE(SGO_LOG_EVENT, "@MQTT Unable to create mqtt log queue");
+  log_mutex = xSemaphoreCreateMutex();
+  log_buffer = xRingbufferCreate(LOG_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+  if (log_mutex == NULL || log_buffer == NULL) {
+    ESP_LOGE(SGO_LOG_EVENT, "@MQTT Unable to create mqtt log buffer");
   }
 
   esp_log_set_vprintf(mqtt_logging_vprintf);
@@ -246,6 +556,11 @@ void init_mqtt() {
     ESP_LOGE(SGO_LOG_EVENT, "@MQTT Unable to create mqtt queue");
   }
 
+  reply_buffer = xRingbufferCreate(REPLY_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+  if (reply_buffer == NULL) {
+    ESP_LOGE(SGO_LOG_EVENT, "@MQTT Unable to create reply buffer");
+  }
+
   BaseType_t ret = xTaskCreatePinnedToCore(mqtt_task, "MQTT", 8192, NULL, 10, NULL, 1);
   if (ret != pdPASS) {
     ESP_LOGE(SGO_LOG_EVENT, "@MQTT Failed to create task");
@@ -19,7 +19,12 @@
 #ifndef MQTT_H_
 #define MQTT_H_
 
+#include <stddef.h>
+
 void init_mqtt();
 void mqtt_intercept_log();
+void mqtt_log_record(const char *record, size_t len);
+void mqtt_reply(const char *reply, size_t len);
+void mqtt_log_buffer_usage(size_t *used, size_t *size);
 
 #endif
@@ -16,194 +16,472 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-/*
- * This is mostly the esp-idf OTA example from 6 months back,
- * and is a lot copy-pasted for the htmlapp ota.
- */
-
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <sys/socket.h>
-#include <netdb.h>
+#include <strings.h>
 #include <stdbool.h>
 
 #include "ota.h"
+#include "ota_http.h"
+#include "ota_delta.h"
+#include "ota_bundle.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/event_groups.h"
+#include "freertos/queue.h"
 
 #include "esp_system.h"
-#include "esp_wifi.h"
-#include "esp_event_loop.h"
 #include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "mbedtls/sha256.h"
+#include "sodium/utils.h"
 
 #include "../log/log.h"
-#include "../wifi/wifi.h"
 #include "../kv/kv.h"
 
-#define BUFFSIZE 1024
-#define TEXT_BUFFSIZE 1024
-
 #define OTA_BUILD_TIMESTAMP_BCK "O_B_T_BCK"
+#define OTA_PROGRESS_INTERVAL (1000 / portTICK_PERIOD_MS)
 
-static char ota_write_data[BUFFSIZE + 1] = { 0 };
-/*an packet receive buffer*/
-static char text[BUFFSIZE + 1] = { 0 };
-/* an image total length*/
-static int binary_file_length = 0;
-/*socket id*/
-static int socket_id = -1;
+/*
+ * Full image downloads survive disconnections and reboots. The image is
+ * written straight to the partition, and every OTA_CHECKPOINT_INTERVAL bytes
+ * the offset and the sha256 of what's been written so far are saved to NVS.
+ * After a disconnection the download continues with a Range request, after a
+ * reboot the partition is hashed up to the checkpoint and, if it matches,
+ * continues from there too. Checkpoints are sector aligned, so nothing before
+ * them is erased again.
+ *
+ * The final image is checked against <timestamp>/firmware.sha256 when the
+ * server has it, then by esp_ota_set_boot_partition as usual.
+ */
+#define OTA_CHECKPOINT_TIMESTAMP "OTA_CP_TS"
+#define OTA_CHECKPOINT_OFFSET "OTA_CP_OFF"
+#define OTA_CHECKPOINT_HASH "OTA_CP_SHA"
+#define OTA_CHECKPOINT_INTERVAL (16 * SPI_FLASH_SEC_SIZE)
+#define OTA_MAX_RETRIES 5 // in a row without progress
+#define OTA_RETRY_DELAY (2000 / portTICK_PERIOD_MS)
+
+typedef struct {
+  const esp_partition_t *partition;
+  int timestamp;
+  uint32_t written;
+  uint32_t erased;
+  mbedtls_sha256_context sha;
+} ota_image;
 
 static QueueHandle_t cmd;
 
-/*read buffer by byte still delim ,return read bytes counts*/
-static int read_until(char *buffer, char delim, int len)
-{
-  //  /*TODO: delim check,buffer check,further: do an buffer length limited*/
-  int i = 0;
-  while (buffer[i] != delim && i < len) {
-    ++i;
+// reads the body of a small text file, like last_timestamp
+static bool read_text(ota_http *h, char *dst, size_t len) {
+  memset(dst, 0, len);
+  size_t dst_len = 0;
+  const char *data;
+  int n;
+  while ((n = ota_http_read(h, &data)) > 0) {
+    size_t room = len - 1 - dst_len;
+    size_t copy = (size_t)n < room ? n : room;
+    memcpy(&dst[dst_len], data, copy);
+    dst_len += copy;
   }
-  return i + 1;
+  ota_http_end(h);
+  return n == 0;
 }
 
-/* resolve a packet from http socket
- * return true if packet including \r\n\r\n that means http packet header finished,start to receive packet body
- * otherwise return false
- * */
-static bool read_past_http_header(char text[], int total_len, esp_ota_handle_t update_handle)
-{
-  /* i means current position */
-  int i = 0, i_read_len = 0;
-  while (text[i] != 0 && i < total_len) {
-    i_read_len = read_until(&text[i], '\n', total_len);
-    // if we resolve \r\n line,we think packet header is finished
-    if (i_read_len == 2) {
-      int i_write_len = total_len - (i + 2);
-      memset(ota_write_data, 0, BUFFSIZE);
-      /*copy first http packet body to write buffer*/
-      memcpy(ota_write_data, &(text[i + 2]), i_write_len);
-
-      esp_err_t err = esp_ota_write( update_handle, (const void *)ota_write_data, i_write_len);
-      if (err != ESP_OK) {
-        ESP_LOGE(SGO_LOG_EVENT, "@OTA Error: esp_ota_write failed (%s)!", esp_err_to_name(err));
-        return false;
-      } else {
-        ESP_LOGI(SGO_LOG_EVENT, "@OTA esp_ota_write header OK");
-        binary_file_length += i_write_len;
-      }
-      return true;
-    }
-    i += i_read_len;
-    vTaskDelay(1 / portTICK_PERIOD_MS);
+static bool get_text(ota_http *h, const char *path, char *dst, size_t len) {
+  if (!ota_http_get(h, path, 0, NULL)) {
+    return false;
   }
-  return false;
+  if (h->status != 200) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Unable to get %s, status=%d", path, h->status);
+    ota_http_end(h);
+    return false;
+  }
+  return read_text(h, dst, len);
 }
 
-static bool connect_to_http_server()
-{
-  char server_ip[20] = {0}; get_ota_server_ip(server_ip, 20);
-  int16_t port = get_ota_server_port();
-  ESP_LOGI(SGO_LOG_EVENT, "@OTA Server IP: %s Server Port: %d", server_ip, port);
+// ETag and value of the last last_timestamp, checks send the ETag so an
+// unchanged file costs a 304 without body
+static char last_timestamp_etag[OTA_HTTP_MAX_ETAG] = {0};
+static int last_timestamp = 0;
 
-  int  http_connect_flag = -1;
-  struct sockaddr_in sock_info;
+static bool check_new_version(ota_http *h, char *new_timestamp, int len) {
+  char basedir[128] = {0}; get_ota_basedir(basedir, sizeof(basedir));
+  char path[160] = {0};
+  snprintf(path, sizeof(path), "%s/last_timestamp", basedir);
 
-  socket_id = socket(AF_INET, SOCK_STREAM, 0);
-  if (socket_id == -1) {
-    ESP_LOGE(SGO_LOG_EVENT, "@OTA Create socket failed!");
+  if (!ota_http_get(h, path, 0, last_timestamp_etag)) {
+    return false;
+  }
+  if (h->status == 304) {
+    ota_http_end(h);
+  } else if (h->status == 200) {
+    char timestamp[15] = {0};
+    if (!read_text(h, timestamp, sizeof(timestamp))) {
+      return false;
+    }
+    last_timestamp = atoi(timestamp);
+    strncpy(last_timestamp_etag, h->etag, sizeof(last_timestamp_etag) - 1);
+  } else {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Unable to get %s, status=%d", path, h->status);
+    ota_http_end(h);
     return false;
   }
 
-  // set connect info
-  memset(&sock_info, 0, sizeof(struct sockaddr_in));
-  sock_info.sin_family = AF_INET;
-  sock_info.sin_addr.s_addr = inet_addr(server_ip);
-  sock_info.sin_port = htons(port);
+  int ota_build_timestamp = get_ota_timestamp();
+  ESP_LOGI(SGO_LOG_EVENT, "@OTA OTA TIMESTAMP: %d%s (build: %d)", last_timestamp, h->status == 304 ? " (not modified)" : "", ota_build_timestamp);
+  snprintf(new_timestamp, len, "%d", last_timestamp);
+  return ota_build_timestamp < last_timestamp;
+}
 
-  // connect to http server
-  http_connect_flag = connect(socket_id, (struct sockaddr *)&sock_info, sizeof(sock_info));
-  if (http_connect_flag == -1) {
-    ESP_LOGE(SGO_LOG_EVENT, "@OTA Connect to server failed! errno=%d", errno);
-    close(socket_id);
-    return false;
-  } else {
-    ESP_LOGI(SGO_LOG_EVENT, "@OTA Connected to server");
+// downloaded is what this attempt actually received, for the speed
+static void report_progress(int done, int total, int downloaded, TickType_t started) {
+  uint32_t elapsed = (xTaskGetTickCount() - started) * portTICK_PERIOD_MS;
+  uint32_t speed = elapsed ? (uint64_t)downloaded * 1000 / elapsed : 0;
+  set_ota_received(done);
+  set_ota_speed(speed);
+  if (total > 0) {
+    set_ota_progress((uint64_t)done * 100 / total);
+  }
+  ESP_LOGI(SGO_LOG_EVENT, "@OTA Received %d/%d bytes, %u bytes/s", done, total, speed);
+}
+
+static void image_reset(ota_image *img) {
+  img->written = 0;
+  // sectors already written to must be erased again
+  img->erased = 0;
+  mbedtls_sha256_starts_ret(&img->sha, 0);
+}
+
+static void clear_checkpoint() {
+  if (hasi32(OTA_CHECKPOINT_TIMESTAMP) && geti32(OTA_CHECKPOINT_TIMESTAMP) != 0) {
+    seti32(OTA_CHECKPOINT_TIMESTAMP, 0);
+  }
+}
+
+static void save_checkpoint(ota_image *img) {
+  mbedtls_sha256_context sha;
+  uint8_t hash[32];
+  char hex[sizeof(hash) * 2 + 1];
+
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_clone(&sha, &img->sha);
+  mbedtls_sha256_finish_ret(&sha, hash);
+  mbedtls_sha256_free(&sha);
+  sodium_bin2hex(hex, sizeof(hex), hash, sizeof(hash));
+
+  begin_kv_batch();
+  seti32(OTA_CHECKPOINT_TIMESTAMP, img->timestamp);
+  seti32(OTA_CHECKPOINT_OFFSET, img->written);
+  setstr(OTA_CHECKPOINT_HASH, hex);
+  end_kv_batch();
+}
+
+// continues from the last checkpoint if the partition still matches it
+static void load_checkpoint(ota_image *img, uint8_t *buf, size_t buf_len) {
+  if (!hasi32(OTA_CHECKPOINT_TIMESTAMP) || geti32(OTA_CHECKPOINT_TIMESTAMP) != img->timestamp
+      || !hasi32(OTA_CHECKPOINT_OFFSET) || !hasstr(OTA_CHECKPOINT_HASH)) {
+    return;
+  }
+  uint32_t offset = geti32(OTA_CHECKPOINT_OFFSET);
+  char expected[65] = {0};
+  getstr(OTA_CHECKPOINT_HASH, expected, sizeof(expected));
+  if (offset == 0 || offset % SPI_FLASH_SEC_SIZE || offset > img->partition->size) {
+    return;
+  }
+
+  for (uint32_t pos = 0; pos < offset; pos += buf_len) {
+    size_t len = offset - pos < buf_len ? offset - pos : buf_len;
+    if (esp_partition_read(img->partition, pos, buf, len) != ESP_OK) {
+      image_reset(img);
+      return;
+    }
+    mbedtls_sha256_update_ret(&img->sha, buf, len);
+  }
+
+  mbedtls_sha256_context sha;
+  uint8_t hash[32];
+  char hex[sizeof(hash) * 2 + 1];
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_clone(&sha, &img->sha);
+  mbedtls_sha256_finish_ret(&sha, hash);
+  mbedtls_sha256_free(&sha);
+  sodium_bin2hex(hex, sizeof(hex), hash, sizeof(hash));
+  if (strcmp(hex, expected) != 0) {
+    ESP_LOGW(SGO_LOG_EVENT, "@OTA Checkpoint at %u doesn't match the partition, starting over", offset);
+    image_reset(img);
+    return;
+  }
+  ESP_LOGI(SGO_LOG_EVENT, "@OTA Resuming download at %u", offset);
+  img->written = img->erased = offset;
+}
+
+static esp_err_t image_write(ota_image *img, const uint8_t *data, size_t len) {
+  if (img->written + len > img->partition->size) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Image too large for the partition");
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (img->written + len > img->erased) {
+    uint32_t end = (img->written + len + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+    end = end < img->partition->size ? end : img->partition->size;
+    esp_err_t err = esp_partition_erase_range(img->partition, img->erased, end - img->erased);
+    if (err != ESP_OK) {
+      ESP_LOGE(SGO_LOG_EVENT, "@OTA Erase failed (%s)", esp_err_to_name(err));
+      return err;
+    }
+    img->erased = end;
+  }
+
+  while (len) {
+    // split at checkpoints, so their hash covers exactly what's before them
+    uint32_t next_checkpoint = (img->written / OTA_CHECKPOINT_INTERVAL + 1) * OTA_CHECKPOINT_INTERVAL;
+    size_t n = next_checkpoint - img->written < len ? next_checkpoint - img->written : len;
+    esp_err_t err = esp_partition_write(img->partition, img->written, data, n);
+    if (err != ESP_OK) {
+      ESP_LOGE(SGO_LOG_EVENT, "@OTA Write failed (%s)", esp_err_to_name(err));
+      return err;
+    }
+    mbedtls_sha256_update_ret(&img->sha, data, n);
+    img->written += n;
+    data += n;
+    len -= n;
+    if (img->written == next_checkpoint) {
+      save_checkpoint(img);
+    }
+  }
+  return ESP_OK;
+}
+
+// receives the body of the current response, returns false if it was cut short
+static bool receive_image(ota_http *h, ota_image *img, int total, TickType_t started, int *downloaded, esp_err_t *err) {
+  TickType_t last_report = xTaskGetTickCount();
+  const char *data;
+  int n;
+  while ((n = ota_http_read(h, &data)) > 0) {
+    *err = image_write(img, (const uint8_t *)data, n);
+    if (*err != ESP_OK) {
+      return false;
+    }
+    *downloaded += n;
+    if (xTaskGetTickCount() - last_report >= OTA_PROGRESS_INTERVAL) {
+      last_report = xTaskGetTickCount();
+      report_progress(img->written, total, *downloaded, started);
+    }
+  }
+  return n == 0;
+}
+
+// true if the image hash matches <timestamp>/firmware.sha256, or the server doesn't have one
+static bool check_image_hash(ota_http *h, ota_image *img, const char *new_timestamp) {
+  char basedir[128] = {0}; get_ota_basedir(basedir, sizeof(basedir));
+  char path[160] = {0};
+  snprintf(path, sizeof(path), "%s/%s/firmware.sha256", basedir, new_timestamp);
+
+  uint8_t hash[32];
+  char hex[sizeof(hash) * 2 + 1];
+  mbedtls_sha256_finish_ret(&img->sha, hash);
+  sodium_bin2hex(hex, sizeof(hex), hash, sizeof(hash));
+
+  char expected[sizeof(hex)] = {0};
+  if (!get_text(h, path, expected, sizeof(expected))) {
+    ESP_LOGW(SGO_LOG_EVENT, "@OTA No firmware.sha256, relying on the image's own checks");
     return true;
   }
- return false;
+  if (strncasecmp(hex, expected, sizeof(hex) - 1) != 0) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Image hash mismatch, got %s", hex);
+    return false;
+  }
+  ESP_LOGI(SGO_LOG_EVENT, "@OTA Image hash OK");
+  return true;
 }
 
-static bool check_new_version(char *new_timestamp, int len) {
-  char hostname[128] = {0}; get_ota_server_hostname(hostname, 128);
-  int16_t port = get_ota_server_port();
-  char basedir[128] = {0}; get_ota_basedir(basedir, 128);
-  /*connect to http server*/
-  if (connect_to_http_server()) {
-    ESP_LOGI(SGO_LOG_EVENT, "@OTA Connected to http server");
+// true if update_partition now holds the new image, closes h
+static bool download_image(ota_http *h, const char *new_timestamp, const esp_partition_t *update_partition) {
+  char basedir[128] = {0}; get_ota_basedir(basedir, sizeof(basedir));
+  char path[160] = {0};
+  snprintf(path, sizeof(path), "%s/%s/firmware.bin", basedir, new_timestamp);
+
+  ota_image img = {.partition = update_partition, .timestamp = atoi(new_timestamp)};
+  mbedtls_sha256_init(&img.sha);
+  image_reset(&img);
+  load_checkpoint(&img, (uint8_t *)h->buf, sizeof(h->buf));
+
+  TickType_t started = xTaskGetTickCount();
+  int downloaded = 0, total = -1, retries = 0;
+  esp_err_t err = ESP_OK;
+  bool done = false;
+  while (!done && err == ESP_OK && retries < OTA_MAX_RETRIES) {
+    uint32_t written_before = img.written;
+    if (ota_http_get(h, path, img.written, NULL)) {
+      if (h->status == 200 && img.written > 0) {
+        ESP_LOGW(SGO_LOG_EVENT, "@OTA Server ignored the range, starting over");
+        image_reset(&img);
+        written_before = 0;
+      }
+      if (h->status == 416) {
+        // the checkpoint is past the end of the file, it changed on the server
+        image_reset(&img);
+      } else if ((h->status != 200 && h->status != 206) || (h->status == 206 && h->range_start != img.written)) {
+        ESP_LOGE(SGO_LOG_EVENT, "@OTA ota url is invalid or bin does not exist, status=%d", h->status);
+        ota_http_end(h);
+        break;
+      } else {
+        total = h->total_length;
+        done = receive_image(h, &img, total, started, &downloaded, &err);
+      }
+      ota_http_end(h);
+    }
+    if (!done && err == ESP_OK) {
+      retries = img.written > written_before ? 0 : retries + 1;
+      ESP_LOGW(SGO_LOG_EVENT, "@OTA Download interrupted at %u, retrying", img.written);
+      vTaskDelay(OTA_RETRY_DELAY);
+    }
+  }
+  report_progress(img.written, total, downloaded, started);
+
+  bool ok = done && (total < 0 || img.written == (uint32_t)total);
+  if (!ok) {
+    // the checkpoint is kept, the next attempt continues from there
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Download failed at %u bytes", img.written);
+  } else if (!check_image_hash(h, &img, new_timestamp)) {
+    clear_checkpoint();
+    ok = false;
   } else {
-    ESP_LOGE(SGO_LOG_EVENT, "@OTA Connect to http server failed!");
-    close(socket_id);
-    return false;
+    ESP_LOGI(SGO_LOG_EVENT, "@OTA Total Write binary data length : %u", img.written);
+    clear_checkpoint();
   }
+  mbedtls_sha256_free(&img.sha);
+  return ok;
+}
 
-  /*send GET request to http server*/
-  const char *GET_FORMAT =
-    "GET %s/last_timestamp HTTP/1.0\r\n"
-    "Host: %s:%d\r\n"
-    "User-Agent: esp-idf/1.0 esp32\r\n\r\n";
+// same as download_image, from a patch against the running image, see ota_delta.h
+static bool download_patch(ota_http *h, const char *new_timestamp, const esp_partition_t *running, const esp_partition_t *update_partition) {
+  char basedir[128] = {0}; get_ota_basedir(basedir, sizeof(basedir));
+  char path[160] = {0};
+  snprintf(path, sizeof(path), "%s/%s/firmware.%d.patch", basedir, new_timestamp, get_ota_timestamp());
 
-  char *http_request = NULL;
-  int get_len = asprintf(&http_request, GET_FORMAT, basedir, hostname, port);
-  if (get_len < 0) {
-    ESP_LOGE(SGO_LOG_EVENT, "@OTA Failed to allocate memory for GET request buffer");
-    close(socket_id);
+  if (!ota_http_get(h, path, 0, NULL)) {
+    return false;
+  }
+  if (h->status != 200) {
+    ESP_LOGI(SGO_LOG_EVENT, "@OTA No patch from the running version, status=%d", h->status);
+    ota_http_end(h);
     return false;
   }
-  int res = send(socket_id, http_request, get_len, 0);
-  free(http_request);
 
-  if (res < 0) {
-    ESP_LOGE(SGO_LOG_EVENT, "@OTA Send GET request to server failed");
-    close(socket_id);
+  // ~4KB, same as the http client
+  ota_delta *d = malloc(sizeof(ota_delta));
+  if (d == NULL) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Unable to allocate patch buffer");
+    ota_http_end(h);
     return false;
-  } else {
-    ESP_LOGI(SGO_LOG_EVENT, "@OTA Send GET request to server succeeded");
   }
+  ota_delta_begin(d, running, update_partition);
+
+  TickType_t started = xTaskGetTickCount(), last_report = started;
+  esp_err_t err = ESP_OK;
+  const char *data;
+  int n;
+  while ((n = ota_http_read(h, &data)) > 0) {
+    err = ota_delta_write(d, (const uint8_t *)data, n);
+    if (err != ESP_OK) {
+      break;
+    }
+    if (xTaskGetTickCount() - last_report >= OTA_PROGRESS_INTERVAL) {
+      last_report = xTaskGetTickCount();
+      report_progress(h->body_received, h->content_length, h->body_received, started);
+    }
+  }
+  ota_http_end(h);
+  report_progress(h->body_received, h->content_length, h->body_received, started);
 
-  int i = 0;
-  char buf;
-  while (i < 4) {
-    if (recv(socket_id, &buf, 1, 0) != 1) return false;
-    if (buf == '\n' || buf == '\r') ++i;
-    else i = 0;
+  if (n != 0 || err != ESP_OK) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Patch failed after %d bytes (%s)", h->body_received, esp_err_to_name(err));
+    ota_delta_abort(d);
+    free(d);
+    return false;
   }
+  err = ota_delta_end(d);
+  free(d);
+  if (err == ESP_OK) {
+    ESP_LOGI(SGO_LOG_EVENT, "@OTA Patched image ready, %d bytes downloaded", h->body_received);
+  }
+  return err == ESP_OK;
+}
 
-  ESP_LOGI(SGO_LOG_EVENT, "@OTA Skipped http header");
+// streams the bundle at path, see ota_bundle.h. ESP_ERR_NOT_FOUND if the
+// server doesn't have it
+static esp_err_t download_bundle(ota_http *h, const char *path, int timestamp, const esp_partition_t *running, const esp_partition_t *update_partition) {
+  if (!ota_http_get(h, path, 0, NULL)) {
+    return ESP_FAIL;
+  }
+  if (h->status != 200) {
+    ESP_LOGI(SGO_LOG_EVENT, "@OTA No bundle at %s, status=%d", path, h->status);
+    ota_http_end(h);
+    return h->status == 404 ? ESP_ERR_NOT_FOUND : ESP_FAIL;
+  }
 
-  int ota_build_timestamp = get_ota_timestamp();
-  char timestamp[15] = {0};
-  while(recv(socket_id, &(timestamp[strlen(timestamp)]), sizeof(timestamp) - strlen(timestamp) - 1, 0) > 0);
-  ESP_LOGI(SGO_LOG_EVENT, "@OTA OTA TIMESTAMP: %d (build: %d)", atoi(timestamp), ota_build_timestamp);
-  close(socket_id);
-
-  int itimestamp = atoi(timestamp);
-  snprintf(new_timestamp, len, "%d", itimestamp);
-  return ota_build_timestamp < itimestamp;
+  ota_bundle *b = malloc(sizeof(ota_bundle));
+  if (b == NULL) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Unable to allocate bundle");
+    ota_http_end(h);
+    return ESP_ERR_NO_MEM;
+  }
+  ota_bundle_begin(b, timestamp, running, update_partition);
+
+  TickType_t started = xTaskGetTickCount(), last_report = started;
+  esp_err_t err = ESP_OK;
+  const char *data;
+  int n;
+  while ((n = ota_http_read(h, &data)) > 0) {
+    err = ota_bundle_write(b, (const uint8_t *)data, n);
+    if (err != ESP_OK) {
+      break;
+    }
+    if (xTaskGetTickCount() - last_report >= OTA_PROGRESS_INTERVAL) {
+      last_report = xTaskGetTickCount();
+      report_progress(h->body_received, h->content_length, h->body_received, started);
+    }
+  }
+  ota_http_end(h);
+  report_progress(h->body_received, h->content_length, h->body_received, started);
+
+  if (n != 0 || err != ESP_OK) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Bundle failed after %d bytes (%s)", h->body_received, esp_err_to_name(err));
+    ota_bundle_abort(b);
+    free(b);
+    return err != ESP_OK ? err : ESP_FAIL;
+  }
+  err = ota_bundle_end(b);
+  free(b);
+  if (err == ESP_OK) {
+    ESP_LOGI(SGO_LOG_EVENT, "@OTA Bundle ready, %d bytes downloaded", h->body_received);
+  }
+  return err;
 }
 
-static void try_ota(const char *new_timestamp)
-{
-  char server_ip[20] = {0}; get_ota_server_ip(server_ip, 20);
-  char hostname[128] = {0}; get_ota_server_hostname(hostname, 128);
-  int16_t port = get_ota_server_port();
-  char basedir[128] = {0}; get_ota_basedir(basedir, 128);
-
-  esp_err_t err;
-  /* update handle : set by esp_ota_begin(), must be freed via esp_ota_end() */
-  esp_ota_handle_t update_handle = 0 ;
-  const esp_partition_t *update_partition = NULL;
+// bundle.<running timestamp>.sgob carries a patch, bundle.sgob the full
+// image, either one fails without touching the web app
+static esp_err_t download_bundles(ota_http *h, const char *new_timestamp, const esp_partition_t *running, const esp_partition_t *update_partition) {
+  char basedir[128] = {0}; get_ota_basedir(basedir, sizeof(basedir));
+  char path[160] = {0};
+  snprintf(path, sizeof(path), "%s/%s/bundle.%d.sgob", basedir, new_timestamp, get_ota_timestamp());
+  esp_err_t err = download_bundle(h, path, atoi(new_timestamp), running, update_partition);
+  if (err == ESP_OK) {
+    return ESP_OK;
+  }
+  esp_err_t patch_err = err;
+  snprintf(path, sizeof(path), "%s/%s/bundle.sgob", basedir, new_timestamp);
+  err = download_bundle(h, path, atoi(new_timestamp), running, update_partition);
+  // the patch bundle failing is enough to not fall back to a firmware only update
+  if (err == ESP_ERR_NOT_FOUND && patch_err != ESP_ERR_NOT_FOUND) {
+    return ESP_FAIL;
+  }
+  return err;
+}
 
+static void try_ota(ota_http *h, const char *new_timestamp) {
   ESP_LOGI(SGO_LOG_EVENT, "@OTA Starting OTA");
 
   const esp_partition_t *configured = esp_ota_get_boot_partition();
@@ -217,109 +495,36 @@ static void try_ota(const char *new_timestamp)
   ESP_LOGI(SGO_LOG_EVENT, "@OTA Running partition type %d subtype %d (offset 0x%08x)",
       running->type, running->subtype, running->address);
 
-  /*connect to http server*/
-  if (connect_to_http_server()) {
-    ESP_LOGI(SGO_LOG_EVENT, "@OTA Connected to http server");
-  } else {
-    ESP_LOGE(SGO_LOG_EVENT, "@OTA Connect to http server failed!");
-    close(socket_id);
-    return;
-  }
-
-  /*send GET request to http server*/
-  const char *GET_FORMAT =
-    "GET %s/%s/firmware.bin HTTP/1.0\r\n"
-    "Host: %s:%d\r\n"
-    "User-Agent: esp-idf/1.0 esp32\r\n\r\n";
-
-  char *http_request = NULL;
-  int get_len = asprintf(&http_request, GET_FORMAT, basedir, new_timestamp, hostname, port);
-  if (get_len < 0) {
-    ESP_LOGE(SGO_LOG_EVENT, "@OTA Failed to allocate memory for GET request buffer");
-    close(socket_id);
+  const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
+  if (update_partition == NULL) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA No update partition");
     return;
   }
-
-  int res = send(socket_id, http_request, get_len, 0);
-  free(http_request);
-
-  if (res < 0) {
-    ESP_LOGE(SGO_LOG_EVENT, "@OTA Send GET request to server failed");
-    close(socket_id);
-    return;
-  } else {
-    ESP_LOGI(SGO_LOG_EVENT, "@OTA Send GET request to server succeeded");
-  }
-
-  update_partition = esp_ota_get_next_update_partition(NULL);
   ESP_LOGI(SGO_LOG_EVENT, "@OTA Writing to partition subtype %d at offset 0x%x",
       update_partition->subtype, update_partition->address);
-  assert(update_partition != NULL);
 
-  err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &update_handle);
-  if (err != ESP_OK) {
-    ESP_LOGE(SGO_LOG_EVENT, "@OTA esp_ota_begin failed (%s)", esp_err_to_name(err));
-    close(socket_id);
-    return;
-  }
-  ESP_LOGI(SGO_LOG_EVENT, "@OTA esp_ota_begin succeeded");
-
-  bool resp_body_start = false, socket_flag = true, http_200_flag = false;
-  /*deal with all receive packet*/
-  while (socket_flag) {
-    memset(text, 0, TEXT_BUFFSIZE);
-    memset(ota_write_data, 0, BUFFSIZE);
-    int buff_len = recv(socket_id, text, TEXT_BUFFSIZE, 0);
-    if (buff_len < 0) { /*receive error*/
-      ESP_LOGE(SGO_LOG_EVENT, "@OTA Error: receive data error! errno=%d", errno);
-      close(socket_id);
+  // releases with a bundle update the firmware and the web app together,
+  // the others only have the firmware
+  esp_err_t err = download_bundles(h, new_timestamp, running, update_partition);
+  if (err == ESP_ERR_NOT_FOUND) {
+    // any patch failure falls back to the full image, an interrupted full
+    // download is continued instead
+    bool resuming = hasi32(OTA_CHECKPOINT_TIMESTAMP) && geti32(OTA_CHECKPOINT_TIMESTAMP) == atoi(new_timestamp);
+    if ((resuming || !download_patch(h, new_timestamp, running, update_partition))
+        && !download_image(h, new_timestamp, update_partition)) {
       return;
-    } else if (buff_len > 0 && !resp_body_start) {  /*deal with response header*/
-      // only start ota when server response 200 state code
-      if (strstr(text, "200") == NULL && !http_200_flag) {
-        ESP_LOGE(SGO_LOG_EVENT, "@OTA ota url is invalid or bin does not exist");
-        close(socket_id);
-        return;
-      }
-      http_200_flag = true;
-      memcpy(ota_write_data, text, buff_len);
-      resp_body_start = read_past_http_header(text, buff_len, update_handle);
-    } else if (buff_len > 0 && resp_body_start) { /*deal with response body*/
-      memcpy(ota_write_data, text, buff_len);
-      err = esp_ota_write( update_handle, (const void *)ota_write_data, buff_len);
-      if (err != ESP_OK) {
-        ESP_LOGE(SGO_LOG_EVENT, "@OTA Error: esp_ota_write failed (%s)!", esp_err_to_name(err));
-        close(socket_id);
-        return;
-      }
-      binary_file_length += buff_len;
-      ESP_LOGI(SGO_LOG_EVENT, "@OTA Have written image length %d", binary_file_length);
-    } else if (buff_len == 0) {  /*packet over*/
-      socket_flag = false;
-      ESP_LOGI(SGO_LOG_EVENT, "@OTA Connection closed, all packets received");
-      close(socket_id);
-    } else {
-      ESP_LOGE(SGO_LOG_EVENT, "@OTA Unexpected recv result");
     }
-    vTaskDelay(1 / portTICK_PERIOD_MS);
-  }
-
-  ESP_LOGI(SGO_LOG_EVENT, "@OTA Total Write binary data length : %d", binary_file_length);
-
-  if (esp_ota_end(update_handle) != ESP_OK) {
-    ESP_LOGE(SGO_LOG_EVENT, "@OTA esp_ota_end failed!");
-    close(socket_id);
+  } else if (err != ESP_OK) {
     return;
   }
+
   err = esp_ota_set_boot_partition(update_partition);
   if (err != ESP_OK) {
     ESP_LOGE(SGO_LOG_EVENT, "@OTA esp_ota_set_boot_partition failed (%s)!", esp_err_to_name(err));
-    close(socket_id);
     return;
   }
   ESP_LOGI(SGO_LOG_EVENT, "@OTA Prepare to restart system!");
   esp_restart();
-  return;
 }
 
 static void ota_task(void *pvParameter) {
@@ -332,19 +537,34 @@ static void ota_task(void *pvParameter) {
     if (ota_build_timestamp == 0) {
       ESP_LOGI(SGO_LOG_EVENT, "@OTA OTA NOT STARTING timestamp=%d", ota_build_timestamp);
       set_ota_status(OTA_STATUS_DISABLED);
-    } else { 
-      ESP_LOGI(SGO_LOG_EVENT, "@OTA Checking firmware update available");
-      ESP_LOGI(SGO_LOG_EVENT, "@OTA timestamp=%d", ota_build_timestamp);
-      char new_timestamp[15] = {0};
-      if (check_new_version(new_timestamp, sizeof(new_timestamp)-1)) {
-        ESP_LOGI(SGO_LOG_EVENT, "@OTA Start OTA procedure");
-        set_ota_status(OTA_STATUS_IN_PROGRESS);
-        try_ota(new_timestamp);
-      } else {
-        ESP_LOGI(SGO_LOG_EVENT, "@OTA Firmware is up-to-date");
-        set_ota_status(OTA_STATUS_IDLE);
-      }
+      continue;
+    }
+
+    // ~4KB, only allocated while checking or downloading, the check and
+    // the download share its connection
+    ota_http *h = malloc(sizeof(ota_http));
+    if (h == NULL) {
+      ESP_LOGE(SGO_LOG_EVENT, "@OTA Unable to allocate http client");
+      continue;
     }
+    ota_http_init(h);
+
+    ESP_LOGI(SGO_LOG_EVENT, "@OTA Checking firmware update available");
+    ESP_LOGI(SGO_LOG_EVENT, "@OTA timestamp=%d", ota_build_timestamp);
+    char new_timestamp[15] = {0};
+    if (check_new_version(h, new_timestamp, sizeof(new_timestamp)-1)) {
+      ESP_LOGI(SGO_LOG_EVENT, "@OTA Start OTA procedure");
+      set_ota_status(OTA_STATUS_IN_PROGRESS);
+      set_ota_progress(0);
+      try_ota(h, new_timestamp);
+      // only returns on failure
+      set_ota_status(OTA_STATUS_IDLE);
+    } else {
+      ESP_LOGI(SGO_LOG_EVENT, "@OTA Firmware is up-to-date");
+      set_ota_status(OTA_STATUS_IDLE);
+    }
+    ota_http_close(h);
+    free(h);
   }
 }
 
@@ -359,6 +579,9 @@ void init_ota() {
   }
   seti32(OTA_BUILD_TIMESTAMP_BCK, OTA_BUILD_TIMESTAMP);
 
+  // files from a bundle, switched now that its firmware booted
+  ota_bundle_apply_staged(OTA_BUILD_TIMESTAMP);
+
   cmd = xQueueCreate(10, sizeof(uint8_t));
   if (cmd == NULL) {
     ESP_LOGE(SGO_LOG_EVENT, "@OTA Unable to create cmd queue");
@@ -0,0 +1,407 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ota_bundle.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_vfs.h"
+#include "esp_spiffs.h"
+
+#include "../log/log.h"
+
+#define COMMIT_TMP OTA_BUNDLE_STAGING_DIR ".commit.tmp"
+
+static uint32_t read_u32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static const uint8_t *entry_at(ota_bundle *b, int i) {
+  return &b->manifest[OTA_BUNDLE_HEADER_SIZE + i * OTA_BUNDLE_ENTRY_SIZE];
+}
+
+static void entry_name(const uint8_t *e, char *name) {
+  memcpy(name, &e[8], OTA_BUNDLE_NAME_SIZE);
+  name[OTA_BUNDLE_NAME_SIZE] = 0;
+}
+
+// plain file names that fit in a SPIFFS object name once staged
+static bool valid_name(const char *name) {
+  size_t len = strlen(name);
+  return len > 0 && name[0] != '.' && strchr(name, '/') == NULL
+    && 1 + strlen(OTA_BUNDLE_STAGING_PREFIX) + len < CONFIG_SPIFFS_OBJ_NAME_LEN;
+}
+
+// SPIFFS has no directories, staged files are the ones prefixed with OTA_BUNDLE_STAGING_PREFIX
+static void clean_staging() {
+  DIR *dir = opendir(OTA_BUNDLE_BASE_PATH);
+  if (!dir) {
+    return;
+  }
+  char path[ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN];
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, OTA_BUNDLE_STAGING_PREFIX, strlen(OTA_BUNDLE_STAGING_PREFIX)) == 0) {
+      snprintf(path, sizeof(path), "%s/%s", OTA_BUNDLE_BASE_PATH, entry->d_name);
+      unlink(path);
+    }
+  }
+  closedir(dir);
+}
+
+static esp_err_t parse_header(ota_bundle *b) {
+  const uint8_t *h = b->manifest;
+  if (memcmp(h, OTA_BUNDLE_MAGIC, 4) != 0 || h[4] != OTA_BUNDLE_VERSION) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Not a bundle, or unsupported version");
+    return ESP_ERR_INVALID_VERSION;
+  }
+  b->n_entries = h[5];
+  if (b->n_entries == 0 || b->n_entries > OTA_BUNDLE_MAX_ENTRIES) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Bundle has %d entries, max %d", b->n_entries, OTA_BUNDLE_MAX_ENTRIES);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if ((int)read_u32(&h[8]) != b->timestamp) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Bundle is for release %u, expected %d", read_u32(&h[8]), b->timestamp);
+    return ESP_ERR_INVALID_VERSION;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t parse_manifest(ota_bundle *b) {
+  char name[OTA_BUNDLE_NAME_SIZE + 1];
+  uint32_t files_size = 0;
+  for (int i = 0; i < b->n_entries; ++i) {
+    const uint8_t *e = entry_at(b, i);
+    uint32_t size = read_u32(&e[4]);
+    entry_name(e, name);
+    if (e[0] == OTA_BUNDLE_FIRMWARE || e[0] == OTA_BUNDLE_PATCH) {
+      if (b->has_firmware) {
+        ESP_LOGE(SGO_LOG_EVENT, "@OTA Bundle has more than one firmware");
+        return ESP_ERR_INVALID_ARG;
+      }
+      b->has_firmware = true;
+    } else if (e[0] == OTA_BUNDLE_FILE) {
+      if (!valid_name(name)) {
+        ESP_LOGE(SGO_LOG_EVENT, "@OTA Invalid file name in bundle: %s", name);
+        return ESP_ERR_INVALID_ARG;
+      }
+      files_size += size;
+    } else {
+      ESP_LOGE(SGO_LOG_EVENT, "@OTA Unknown bundle entry type %d", e[0]);
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+  // the files are switched when the bundle's firmware boots
+  if (!b->has_firmware) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Bundle has no firmware");
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // leftovers of an interrupted download
+  clean_staging();
+
+  // the current files are only removed when the staged ones replace them
+  size_t total = 0, used = 0;
+  if (files_size && (esp_spiffs_info(NULL, &total, &used) != ESP_OK || files_size > total - used)) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Not enough space to stage %u bytes of files", files_size);
+    return ESP_ERR_NO_MEM;
+  }
+  ESP_LOGI(SGO_LOG_EVENT, "@OTA Applying bundle, %d entries", b->n_entries);
+  return ESP_OK;
+}
+
+static esp_err_t start_entry(ota_bundle *b) {
+  const uint8_t *e = entry_at(b, b->entry);
+  char name[OTA_BUNDLE_NAME_SIZE + 1];
+  entry_name(e, name);
+  b->left = read_u32(&e[4]);
+  mbedtls_sha256_starts_ret(&b->sha, 0);
+
+  switch (e[0]) {
+    case OTA_BUNDLE_FIRMWARE: {
+      if (b->left > b->target->size) {
+        ESP_LOGE(SGO_LOG_EVENT, "@OTA Image too large for the partition: %u bytes", b->left);
+        return ESP_ERR_INVALID_SIZE;
+      }
+      esp_err_t err = esp_ota_begin(b->target, b->left, &b->handle);
+      if (err != ESP_OK) {
+        ESP_LOGE(SGO_LOG_EVENT, "@OTA esp_ota_begin failed (%s)", esp_err_to_name(err));
+        return err;
+      }
+      b->begun = true;
+      break;
+    }
+    case OTA_BUNDLE_PATCH:
+      b->delta = malloc(sizeof(ota_delta));
+      if (b->delta == NULL) {
+        ESP_LOGE(SGO_LOG_EVENT, "@OTA Unable to allocate patch buffer");
+        return ESP_ERR_NO_MEM;
+      }
+      ota_delta_begin(b->delta, b->source, b->target);
+      break;
+    case OTA_BUNDLE_FILE: {
+      char path[ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN];
+      snprintf(path, sizeof(path), "%s%s", OTA_BUNDLE_STAGING_DIR, name);
+      b->file = fopen(path, "wb");
+      if (b->file == NULL) {
+        ESP_LOGE(SGO_LOG_EVENT, "@OTA Unable to create %s", path);
+        return ESP_FAIL;
+      }
+      break;
+    }
+  }
+  ESP_LOGI(SGO_LOG_EVENT, "@OTA Bundle entry %s, %u bytes", name, b->left);
+  return ESP_OK;
+}
+
+static esp_err_t write_entry(ota_bundle *b, const uint8_t *data, size_t len) {
+  mbedtls_sha256_update_ret(&b->sha, data, len);
+  b->left -= len;
+  switch (entry_at(b, b->entry)[0]) {
+    case OTA_BUNDLE_FIRMWARE: {
+      esp_err_t err = esp_ota_write(b->handle, data, len);
+      if (err != ESP_OK) {
+        ESP_LOGE(SGO_LOG_EVENT, "@OTA esp_ota_write failed (%s)", esp_err_to_name(err));
+      }
+      return err;
+    }
+    case OTA_BUNDLE_PATCH:
+      return ota_delta_write(b->delta, data, len);
+    case OTA_BUNDLE_FILE:
+      if (fwrite(data, 1, len, b->file) != len) {
+        ESP_LOGE(SGO_LOG_EVENT, "@OTA Write failed on a staged file");
+        return ESP_FAIL;
+      }
+      return ESP_OK;
+  }
+  return ESP_ERR_INVALID_ARG;
+}
+
+static esp_err_t finish_entry(ota_bundle *b) {
+  const uint8_t *e = entry_at(b, b->entry);
+  uint8_t hash[32];
+  mbedtls_sha256_finish_ret(&b->sha, hash);
+  if (memcmp(hash, &e[8 + OTA_BUNDLE_NAME_SIZE], sizeof(hash)) != 0) {
+    char name[OTA_BUNDLE_NAME_SIZE + 1];
+    entry_name(e, name);
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Bundle entry %s hash mismatch", name);
+    return ESP_ERR_INVALID_CRC;
+  }
+
+  esp_err_t err = ESP_OK;
+  switch (e[0]) {
+    case OTA_BUNDLE_FIRMWARE:
+      b->begun = false;
+      err = esp_ota_end(b->handle);
+      if (err != ESP_OK) {
+        ESP_LOGE(SGO_LOG_EVENT, "@OTA esp_ota_end failed (%s)", esp_err_to_name(err));
+      }
+      break;
+    case OTA_BUNDLE_PATCH:
+      err = ota_delta_end(b->delta);
+      free(b->delta);
+      b->delta = NULL;
+      break;
+    case OTA_BUNDLE_FILE:
+      err = fclose(b->file) == 0 ? ESP_OK : ESP_FAIL;
+      b->file = NULL;
+      break;
+  }
+  return err;
+}
+
+// moves to the next entry with data, empty ones are finished right away
+static esp_err_t next_entry(ota_bundle *b) {
+  esp_err_t err = ESP_OK;
+  while (err == ESP_OK && ++b->entry < b->n_entries) {
+    err = start_entry(b);
+    if (err != ESP_OK || b->left) {
+      return err;
+    }
+    err = finish_entry(b);
+  }
+  b->state = OTA_BUNDLE_DONE;
+  return err;
+}
+
+void ota_bundle_begin(ota_bundle *b, int timestamp, const esp_partition_t *source, const esp_partition_t *target) {
+  memset(b, 0, sizeof(ota_bundle));
+  b->timestamp = timestamp;
+  b->source = source;
+  b->target = target;
+  b->entry = -1;
+  mbedtls_sha256_init(&b->sha);
+}
+
+esp_err_t ota_bundle_write(ota_bundle *b, const uint8_t *data, size_t len) {
+  esp_err_t err = ESP_OK;
+  size_t i = 0;
+  while (i < len && err == ESP_OK) {
+    switch (b->state) {
+      case OTA_BUNDLE_HEADER:
+      case OTA_BUNDLE_MANIFEST: {
+        size_t expected = b->state == OTA_BUNDLE_HEADER ? OTA_BUNDLE_HEADER_SIZE
+          : OTA_BUNDLE_HEADER_SIZE + b->n_entries * OTA_BUNDLE_ENTRY_SIZE;
+        size_t n = expected - b->manifest_len;
+        n = n < len - i ? n : len - i;
+        memcpy(&b->manifest[b->manifest_len], &data[i], n);
+        b->manifest_len += n;
+        i += n;
+        if (b->manifest_len < expected) {
+          break;
+        }
+        if (b->state == OTA_BUNDLE_HEADER) {
+          err = parse_header(b);
+          b->state = OTA_BUNDLE_MANIFEST;
+        } else {
+          err = parse_manifest(b);
+          b->state = OTA_BUNDLE_ENTRY;
+          if (err == ESP_OK) {
+            err = next_entry(b);
+          }
+        }
+        break;
+      }
+      case OTA_BUNDLE_ENTRY: {
+        size_t n = b->left < len - i ? b->left : len - i;
+        err = write_entry(b, &data[i], n);
+        i += n;
+        if (err == ESP_OK && b->left == 0) {
+          err = finish_entry(b);
+          if (err == ESP_OK) {
+            err = next_entry(b);
+          }
+        }
+        break;
+      }
+      case OTA_BUNDLE_DONE:
+        ESP_LOGE(SGO_LOG_EVENT, "@OTA Trailing data after the end of the bundle");
+        err = ESP_ERR_INVALID_SIZE;
+        break;
+    }
+  }
+  return err;
+}
+
+// the staged files are switched by ota_bundle_apply_staged once the commit file exists
+static esp_err_t commit_files(ota_bundle *b) {
+  FILE *f = fopen(COMMIT_TMP, "w");
+  if (f == NULL) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Unable to create %s", COMMIT_TMP);
+    return ESP_FAIL;
+  }
+  char name[OTA_BUNDLE_NAME_SIZE + 1];
+  int n_files = 0;
+  fprintf(f, "%d\n", b->timestamp);
+  for (int i = 0; i < b->n_entries; ++i) {
+    const uint8_t *e = entry_at(b, i);
+    if (e[0] == OTA_BUNDLE_FILE) {
+      entry_name(e, name);
+      fprintf(f, "%s\n", name);
+      ++n_files;
+    }
+  }
+  if (fclose(f) != 0 || rename(COMMIT_TMP, OTA_BUNDLE_COMMIT) != 0) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Unable to commit the staged files");
+    return ESP_FAIL;
+  }
+  ESP_LOGI(SGO_LOG_EVENT, "@OTA %d files staged for the next boot", n_files);
+  return ESP_OK;
+}
+
+esp_err_t ota_bundle_end(ota_bundle *b) {
+  if (b->state != OTA_BUNDLE_DONE) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Bundle incomplete, stopped in entry %d/%d", b->entry + 1, b->n_entries);
+    ota_bundle_abort(b);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  esp_err_t err = commit_files(b);
+  if (err != ESP_OK) {
+    ota_bundle_abort(b);
+    return err;
+  }
+  mbedtls_sha256_free(&b->sha);
+  return ESP_OK;
+}
+
+void ota_bundle_abort(ota_bundle *b) {
+  if (b->begun) {
+    // the image is incomplete, this only frees the handle
+    esp_ota_end(b->handle);
+    b->begun = false;
+  }
+  if (b->delta) {
+    ota_delta_abort(b->delta);
+    free(b->delta);
+    b->delta = NULL;
+  }
+  if (b->file) {
+    fclose(b->file);
+    b->file = NULL;
+  }
+  mbedtls_sha256_free(&b->sha);
+  clean_staging();
+}
+
+void ota_bundle_apply_staged(int build_timestamp) {
+  FILE *f = fopen(OTA_BUNDLE_COMMIT, "r");
+  if (f == NULL) {
+    clean_staging();
+    return;
+  }
+
+  char line[OTA_BUNDLE_NAME_SIZE + 2] = {0};
+  if (fgets(line, sizeof(line), f) == NULL || atoi(line) != build_timestamp) {
+    // the bundle's firmware didn't boot, its files don't go with this one
+    ESP_LOGW(SGO_LOG_EVENT, "@OTA Staged files are for release %d, running %d, discarding", atoi(line), build_timestamp);
+    fclose(f);
+    clean_staging();
+    return;
+  }
+
+  char staged[ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN];
+  char path[ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN];
+  struct stat st;
+  int n_files = 0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    line[strcspn(line, "\r\n")] = 0;
+    if (!valid_name(line)) {
+      continue;
+    }
+    snprintf(staged, sizeof(staged), "%s%s", OTA_BUNDLE_STAGING_DIR, line);
+    snprintf(path, sizeof(path), "%s/%s", OTA_BUNDLE_BASE_PATH, line);
+    // already moved if an earlier boot was interrupted here
+    if (stat(staged, &st) != 0) {
+      continue;
+    }
+    // SPIFFS can't rename over an existing file
+    unlink(path);
+    if (rename(staged, path) != 0) {
+      ESP_LOGE(SGO_LOG_EVENT, "@OTA Unable to move %s in place", staged);
+      continue;
+    }
+    ++n_files;
+  }
+  fclose(f);
+  unlink(OTA_BUNDLE_COMMIT);
+  ESP_LOGI(SGO_LOG_EVENT, "@OTA Bundle files for release %d applied, %d files", build_timestamp, n_files);
+}
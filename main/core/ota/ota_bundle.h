@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OTA_BUNDLE_H_
+#define OTA_BUNDLE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "mbedtls/sha256.h"
+
+#include "ota_delta.h"
+
+/*
+ * A bundle carries the firmware and the web app files of a release, made by
+ * tools/ota_bundle.py, and is applied as it streams in. All integers are
+ * little-endian.
+ *
+ * header (12 bytes):
+ *   "SGOB" | u8 version | u8 number of entries | 2 bytes padding
+ *   u32 release timestamp
+ *
+ * manifest, one per entry (72 bytes):
+ *   u8 type | 3 bytes padding | u32 size | name, 32 bytes NUL padded
+ *   sha256 of the entry data
+ *
+ * then the entries data, in manifest order.
+ *
+ * The firmware, a full image or a patch against the running image (see
+ * ota_delta.h), is required and goes to the update partition. Files are written to
+ * OTA_BUNDLE_STAGING_DIR. Once every entry is checked, ota_bundle_end writes
+ * OTA_BUNDLE_COMMIT, which lists them, and ota_bundle_apply_staged moves
+ * them in place on the next boot, only if the bundle's firmware is the one
+ * that booted. Nothing changes if the download is interrupted, and an
+ * interrupted apply continues on the next boot.
+ */
+
+#define OTA_BUNDLE_MAGIC "SGOB"
+#define OTA_BUNDLE_VERSION 1
+#define OTA_BUNDLE_HEADER_SIZE 12
+#define OTA_BUNDLE_ENTRY_SIZE 72
+#define OTA_BUNDLE_NAME_SIZE 32
+#define OTA_BUNDLE_MAX_ENTRIES 8
+
+#define OTA_BUNDLE_BASE_PATH "/spiffs"
+#define OTA_BUNDLE_STAGING_PREFIX "staged/"
+#define OTA_BUNDLE_STAGING_DIR OTA_BUNDLE_BASE_PATH "/" OTA_BUNDLE_STAGING_PREFIX
+#define OTA_BUNDLE_COMMIT OTA_BUNDLE_STAGING_DIR ".commit"
+
+typedef enum {
+  OTA_BUNDLE_FIRMWARE = 0,
+  OTA_BUNDLE_PATCH = 1,
+  OTA_BUNDLE_FILE = 2,
+} ota_bundle_entry_type;
+
+typedef enum {
+  OTA_BUNDLE_HEADER,
+  OTA_BUNDLE_MANIFEST,
+  OTA_BUNDLE_ENTRY,
+  OTA_BUNDLE_DONE,
+} ota_bundle_state;
+
+typedef struct {
+  ota_bundle_state state;
+  const esp_partition_t *source;
+  const esp_partition_t *target;
+  int timestamp; // expected in the header
+
+  uint8_t manifest[OTA_BUNDLE_HEADER_SIZE + OTA_BUNDLE_MAX_ENTRIES * OTA_BUNDLE_ENTRY_SIZE];
+  size_t manifest_len;
+  int n_entries;
+  bool has_firmware;
+
+  // current entry
+  int entry;
+  uint32_t left;
+  mbedtls_sha256_context sha;
+  esp_ota_handle_t handle;
+  bool begun;
+  ota_delta *delta; // only allocated for a patch
+  FILE *file;
+} ota_bundle;
+
+void ota_bundle_begin(ota_bundle *b, int timestamp, const esp_partition_t *source, const esp_partition_t *target);
+esp_err_t ota_bundle_write(ota_bundle *b, const uint8_t *data, size_t len);
+// checks that the bundle is complete and commits the staged files, the
+// firmware is ready to boot if ESP_OK
+esp_err_t ota_bundle_end(ota_bundle *b);
+// removes everything staged so far
+void ota_bundle_abort(ota_bundle *b);
+
+// called at boot, once SPIFFS is mounted
+void ota_bundle_apply_staged(int build_timestamp);
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ota_delta.h"
+
+#include <string.h>
+
+#include "../log/log.h"
+
+#define OP_END 0x00
+#define OP_COPY 0x01
+#define OP_INSERT 0x02
+
+static uint32_t read_u32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static esp_err_t write_target(ota_delta *d, const uint8_t *data, size_t len) {
+  if (d->written + len > d->target_size) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Patch writes past the target size");
+    return ESP_ERR_INVALID_SIZE;
+  }
+  esp_err_t err = esp_ota_write(d->handle, data, len);
+  if (err != ESP_OK) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA esp_ota_write failed (%s)", esp_err_to_name(err));
+    return err;
+  }
+  mbedtls_sha256_update_ret(&d->sha, data, len);
+  d->written += len;
+  return ESP_OK;
+}
+
+static esp_err_t check_source(ota_delta *d, const uint8_t expected[32]) {
+  if (d->source_size > d->source->size) {
+    return OTA_DELTA_ERR_SOURCE_MISMATCH;
+  }
+  uint8_t hash[32];
+  mbedtls_sha256_starts_ret(&d->sha, 0);
+  for (uint32_t offset = 0; offset < d->source_size; offset += OTA_DELTA_COPY_SIZE) {
+    size_t len = d->source_size - offset < OTA_DELTA_COPY_SIZE ? d->source_size - offset : OTA_DELTA_COPY_SIZE;
+    esp_err_t err = esp_partition_read(d->source, offset, d->copy_buf, len);
+    if (err != ESP_OK) {
+      return err;
+    }
+    mbedtls_sha256_update_ret(&d->sha, d->copy_buf, len);
+  }
+  mbedtls_sha256_finish_ret(&d->sha, hash);
+  return memcmp(hash, expected, sizeof(hash)) == 0 ? ESP_OK : OTA_DELTA_ERR_SOURCE_MISMATCH;
+}
+
+static esp_err_t parse_header(ota_delta *d) {
+  const uint8_t *h = d->header;
+  if (memcmp(h, OTA_DELTA_MAGIC, 4) != 0 || h[4] != OTA_DELTA_VERSION) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Not a patch, or unsupported version");
+    return ESP_ERR_INVALID_VERSION;
+  }
+  d->source_size = read_u32(&h[8]);
+  d->target_size = read_u32(&h[44]);
+
+  esp_err_t err = check_source(d, &h[12]);
+  if (err != ESP_OK) {
+    ESP_LOGW(SGO_LOG_EVENT, "@OTA Patch doesn't apply to the running image");
+    return err;
+  }
+  if (d->target_size > d->target->size) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Patched image too large for the partition: %u bytes", d->target_size);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  err = esp_ota_begin(d->target, d->target_size, &d->handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA esp_ota_begin failed (%s)", esp_err_to_name(err));
+    return err;
+  }
+  d->begun = true;
+  mbedtls_sha256_starts_ret(&d->sha, 0);
+  ESP_LOGI(SGO_LOG_EVENT, "@OTA Applying patch, %u bytes image from %u bytes image", d->target_size, d->source_size);
+  return ESP_OK;
+}
+
+static esp_err_t run_copy(ota_delta *d, int32_t relative_offset) {
+  uint32_t offset = d->source_pos + relative_offset;
+  if (offset > d->source_size || d->length > d->source_size - offset) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Patch copies outside of the source image");
+    return ESP_ERR_INVALID_SIZE;
+  }
+  d->source_pos = offset + d->length;
+  while (d->length) {
+    size_t len = d->length < OTA_DELTA_COPY_SIZE ? d->length : OTA_DELTA_COPY_SIZE;
+    esp_err_t err = esp_partition_read(d->source, offset, d->copy_buf, len);
+    if (err == ESP_OK) {
+      err = write_target(d, d->copy_buf, len);
+    }
+    if (err != ESP_OK) {
+      return err;
+    }
+    offset += len;
+    d->length -= len;
+  }
+  return ESP_OK;
+}
+
+// returns true once the varint is complete, in d->value
+static bool read_varint(ota_delta *d, uint8_t c) {
+  d->value |= (uint32_t)(c & 0x7f) << d->shift;
+  d->shift += 7;
+  return (c & 0x80) == 0 || d->shift > 28;
+}
+
+void ota_delta_begin(ota_delta *d, const esp_partition_t *source, const esp_partition_t *target) {
+  memset(d, 0, offsetof(ota_delta, copy_buf));
+  d->source = source;
+  d->target = target;
+  mbedtls_sha256_init(&d->sha);
+}
+
+esp_err_t ota_delta_write(ota_delta *d, const uint8_t *data, size_t len) {
+  esp_err_t err = ESP_OK;
+  size_t i = 0;
+  while (i < len && err == ESP_OK) {
+    switch (d->state) {
+      case OTA_DELTA_HEADER: {
+        size_t n = OTA_DELTA_HEADER_SIZE - d->header_len;
+        n = n < len - i ? n : len - i;
+        memcpy(&d->header[d->header_len], &data[i], n);
+        d->header_len += n;
+        i += n;
+        if (d->header_len == OTA_DELTA_HEADER_SIZE) {
+          err = parse_header(d);
+          d->state = OTA_DELTA_OP;
+        }
+        break;
+      }
+      case OTA_DELTA_OP: {
+        uint8_t op = data[i++];
+        d->value = 0;
+        d->shift = 0;
+        if (op == OP_END) {
+          d->state = OTA_DELTA_DONE;
+        } else if (op == OP_COPY) {
+          d->state = OTA_DELTA_COPY_LENGTH;
+        } else if (op == OP_INSERT) {
+          d->state = OTA_DELTA_INSERT_LENGTH;
+        } else {
+          ESP_LOGE(SGO_LOG_EVENT, "@OTA Unknown patch op 0x%02x", op);
+          err = ESP_ERR_INVALID_ARG;
+        }
+        break;
+      }
+      case OTA_DELTA_COPY_LENGTH:
+        if (read_varint(d, data[i++])) {
+          d->length = d->value;
+          d->value = 0;
+          d->shift = 0;
+          d->state = OTA_DELTA_COPY_OFFSET;
+        }
+        break;
+      case OTA_DELTA_COPY_OFFSET:
+        if (read_varint(d, data[i++])) {
+          // zigzag: 0, -1, 1, -2, 2...
+          int32_t offset = (int32_t)(d->value >> 1) ^ -(int32_t)(d->value & 1);
+          err = run_copy(d, offset);
+          d->state = OTA_DELTA_OP;
+        }
+        break;
+      case OTA_DELTA_INSERT_LENGTH:
+        if (read_varint(d, data[i++])) {
+          d->length = d->value;
+          d->state = d->length ? OTA_DELTA_INSERT_DATA : OTA_DELTA_OP;
+        }
+        break;
+      case OTA_DELTA_INSERT_DATA: {
+        size_t n = d->length < len - i ? d->length : len - i;
+        err = write_target(d, &data[i], n);
+        i += n;
+        d->length -= n;
+        if (d->length == 0) {
+          d->state = OTA_DELTA_OP;
+        }
+        break;
+      }
+      case OTA_DELTA_DONE:
+        ESP_LOGE(SGO_LOG_EVENT, "@OTA Trailing data after the end of the patch");
+        err = ESP_ERR_INVALID_SIZE;
+        break;
+    }
+  }
+  return err;
+}
+
+esp_err_t ota_delta_end(ota_delta *d) {
+  if (d->state != OTA_DELTA_DONE || d->written != d->target_size) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Patch incomplete, %u/%u bytes written", d->written, d->target_size);
+    ota_delta_abort(d);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  uint8_t hash[32];
+  mbedtls_sha256_finish_ret(&d->sha, hash);
+  mbedtls_sha256_free(&d->sha);
+  if (memcmp(hash, &d->header[48], sizeof(hash)) != 0) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Patched image hash mismatch");
+    ota_delta_abort(d);
+    return ESP_ERR_INVALID_CRC;
+  }
+  d->begun = false;
+  esp_err_t err = esp_ota_end(d->handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA esp_ota_end failed (%s)", esp_err_to_name(err));
+  }
+  return err;
+}
+
+void ota_delta_abort(ota_delta *d) {
+  if (d->begun) {
+    // the image is incomplete, this only frees the handle
+    esp_ota_end(d->handle);
+    d->begun = false;
+  }
+  mbedtls_sha256_free(&d->sha);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OTA_DELTA_H_
+#define OTA_DELTA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "mbedtls/sha256.h"
+
+/*
+ * Applies a patch made by tools/ota_diff.py, as it streams in, to build the
+ * new image from the running one. All integers are little-endian.
+ *
+ * header (80 bytes):
+ *   "SGOP" | u8 version | 3 bytes padding
+ *   u32 source size | source sha256
+ *   u32 target size | target sha256
+ *
+ * then ops, until END:
+ *   0x00 END
+ *   0x01 COPY   varint length | zigzag varint source offset, relative to the
+ *               end of the previous copy
+ *   0x02 INSERT varint length | length bytes
+ *
+ * The source hash is checked against the running partition before anything
+ * is written, and the target hash before the new partition is accepted.
+ */
+
+#define OTA_DELTA_MAGIC "SGOP"
+#define OTA_DELTA_VERSION 1
+#define OTA_DELTA_HEADER_SIZE 80
+#define OTA_DELTA_COPY_SIZE 4096
+
+// returned by ota_delta_write when the patch wasn't made from the running image
+#define OTA_DELTA_ERR_SOURCE_MISMATCH ESP_ERR_INVALID_VERSION
+
+typedef enum {
+  OTA_DELTA_HEADER,
+  OTA_DELTA_OP,
+  OTA_DELTA_COPY_LENGTH,
+  OTA_DELTA_COPY_OFFSET,
+  OTA_DELTA_INSERT_LENGTH,
+  OTA_DELTA_INSERT_DATA,
+  OTA_DELTA_DONE,
+} ota_delta_state;
+
+typedef struct {
+  ota_delta_state state;
+  const esp_partition_t *source;
+  const esp_partition_t *target;
+  esp_ota_handle_t handle;
+  bool begun;
+
+  uint8_t header[OTA_DELTA_HEADER_SIZE];
+  size_t header_len;
+  uint32_t source_size;
+  uint32_t target_size;
+
+  // varint being decoded
+  uint32_t value;
+  int shift;
+
+  uint32_t length; // of the current op
+  uint32_t source_pos; // end of the previous copy
+  uint32_t written;
+  mbedtls_sha256_context sha;
+
+  uint8_t copy_buf[OTA_DELTA_COPY_SIZE];
+} ota_delta;
+
+void ota_delta_begin(ota_delta *d, const esp_partition_t *source, const esp_partition_t *target);
+esp_err_t ota_delta_write(ota_delta *d, const uint8_t *data, size_t len);
+// checks the result and closes the ota handle, target is ready to boot if ESP_OK
+esp_err_t ota_delta_end(ota_delta *d);
+void ota_delta_abort(ota_delta *d);
+
+#endif
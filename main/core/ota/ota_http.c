@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ota_http.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "../log/log.h"
+#include "../kv/kv.h"
+
+// last address ota_server_hostname resolved to, used if DNS is unavailable
+static struct in_addr resolved_addr = {0};
+
+void ota_http_init(ota_http *h) {
+  memset(h, 0, offsetof(ota_http, buf));
+  h->sock = -1;
+}
+
+static void reset_response(ota_http *h) {
+  h->body_done = false;
+  h->state = OTA_HTTP_STATUS_LINE;
+  h->status = 0;
+  h->content_length = -1;
+  h->range_start = 0;
+  h->total_length = -1;
+  h->body_received = 0;
+  h->etag[0] = 0;
+  h->chunked = false;
+  h->chunk_state = OTA_HTTP_CHUNK_SIZE;
+  h->chunk_left = 0;
+  h->line_len = 0;
+  h->pos = h->len = 0;
+}
+
+static void parse_line(ota_http *h) {
+  h->line[h->line_len] = 0;
+  if (h->state == OTA_HTTP_STATUS_LINE) {
+    // HTTP/1.x 200 OK
+    const char *code = strchr(h->line, ' ');
+    if (strncmp(h->line, "HTTP/", 5) != 0 || code == NULL) {
+      h->state = OTA_HTTP_ERROR;
+      return;
+    }
+    h->keep_alive = strncmp(h->line, "HTTP/1.0", 8) != 0;
+    h->status = atoi(code + 1);
+    h->state = OTA_HTTP_HEADERS;
+    return;
+  }
+  if (h->line_len == 0) {
+    h->state = OTA_HTTP_BODY;
+    return;
+  }
+  char *value = strchr(h->line, ':');
+  if (value == NULL) {
+    return;
+  }
+  *value++ = 0;
+  while (*value == ' ') ++value;
+  if (strcasecmp(h->line, "Content-Length") == 0) {
+    h->content_length = atoi(value);
+    if (h->status == 200) {
+      h->total_length = h->content_length;
+    }
+  } else if (strcasecmp(h->line, "Content-Range") == 0) {
+    // bytes <start>-<end>/<total>
+    const char *start = strchr(value, ' ');
+    const char *total = strchr(value, '/');
+    if (start) {
+      h->range_start = atoi(start + 1);
+    }
+    if (total && total[1] != '*') {
+      h->total_length = atoi(total + 1);
+    }
+  } else if (strcasecmp(h->line, "Transfer-Encoding") == 0) {
+    h->chunked = strstr(value, "chunked") != NULL;
+  } else if (strcasecmp(h->line, "Connection") == 0) {
+    h->keep_alive = strcasecmp(value, "close") != 0;
+  } else if (strcasecmp(h->line, "ETag") == 0) {
+    strncpy(h->etag, value, sizeof(h->etag) - 1);
+    h->etag[sizeof(h->etag) - 1] = 0;
+  }
+}
+
+size_t ota_http_parse(ota_http *h, const char *data, size_t len) {
+  size_t i = 0;
+  while (i < len && (h->state == OTA_HTTP_STATUS_LINE || h->state == OTA_HTTP_HEADERS)) {
+    char c = data[i++];
+    if (c == '\n') {
+      parse_line(h);
+      h->line_len = 0;
+    } else if (c != '\r' && h->line_len < OTA_HTTP_MAX_LINE - 1) {
+      // longer lines are truncated, none of the headers we use get that long
+      h->line[h->line_len++] = c;
+    }
+  }
+  return i;
+}
+
+static bool resolve_server(struct in_addr *addr) {
+  char hostname[128] = {0}; get_ota_server_hostname(hostname, sizeof(hostname));
+  if (hostname[0]) {
+    const struct addrinfo hints = {
+      .ai_family = AF_INET,
+      .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res = NULL;
+    int err = getaddrinfo(hostname, NULL, &hints, &res);
+    if (err == 0 && res != NULL) {
+      resolved_addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+      freeaddrinfo(res);
+      *addr = resolved_addr;
+      return true;
+    }
+    ESP_LOGW(SGO_LOG_EVENT, "@OTA Unable to resolve %s, err=%d", hostname, err);
+    if (resolved_addr.s_addr != 0) {
+      *addr = resolved_addr;
+      return true;
+    }
+  }
+  // no hostname, or never resolved, ota_server_ip is the fallback
+  char server_ip[20] = {0}; get_ota_server_ip(server_ip, sizeof(server_ip));
+  return inet_aton(server_ip, addr) != 0;
+}
+
+static bool connect_to_server(ota_http *h) {
+  uint16_t port = get_ota_server_port();
+  struct sockaddr_in sock_info = {0};
+  sock_info.sin_family = AF_INET;
+  sock_info.sin_port = htons(port);
+  if (!resolve_server(&sock_info.sin_addr)) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA No address for the OTA server");
+    return false;
+  }
+
+  h->sock = socket(AF_INET, SOCK_STREAM, 0);
+  if (h->sock < 0) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Create socket failed!");
+    return false;
+  }
+
+  struct timeval timeout = {.tv_sec = OTA_HTTP_TIMEOUT_S};
+  setsockopt(h->sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(h->sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  if (connect(h->sock, (struct sockaddr *)&sock_info, sizeof(sock_info)) != 0) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA Connect to %s:%d failed! errno=%d", inet_ntoa(sock_info.sin_addr), port, errno);
+    ota_http_close(h);
+    return false;
+  }
+  ESP_LOGI(SGO_LOG_EVENT, "@OTA Connected to %s:%d", inet_ntoa(sock_info.sin_addr), port);
+  return true;
+}
+
+// sends the request and reads the headers, returns 0 if the connection was
+// closed before any response byte, which is expected from an idle keep-alive
+static int send_request(ota_http *h, const char *path, int offset, const char *etag) {
+  char hostname[128] = {0}; get_ota_server_hostname(hostname, sizeof(hostname));
+  uint16_t port = get_ota_server_port();
+
+  reset_response(h);
+  int len = snprintf(h->buf, sizeof(h->buf),
+    "GET %s HTTP/1.1\r\n"
+    "Host: %s:%d\r\n"
+    "User-Agent: esp-idf/1.0 esp32\r\n"
+    "Connection: keep-alive\r\n", path, hostname, port);
+  if (offset > 0) {
+    len += snprintf(&h->buf[len], sizeof(h->buf) - len, "Range: bytes=%d-\r\n", offset);
+  }
+  if (etag && etag[0]) {
+    len += snprintf(&h->buf[len], sizeof(h->buf) - len, "If-None-Match: %s\r\n", etag);
+  }
+  len += snprintf(&h->buf[len], sizeof(h->buf) - len, "\r\n");
+  if (len >= (int)sizeof(h->buf)) {
+    return -1;
+  }
+  if (send(h->sock, h->buf, len, 0) != len) {
+    return 0;
+  }
+
+  bool received = false;
+  while (h->state != OTA_HTTP_BODY) {
+    int n = recv(h->sock, h->buf, sizeof(h->buf), 0);
+    if (n <= 0) {
+      return received ? -1 : 0;
+    }
+    received = true;
+    size_t parsed = ota_http_parse(h, h->buf, n);
+    if (h->state == OTA_HTTP_ERROR) {
+      ESP_LOGE(SGO_LOG_EVENT, "@OTA Malformed HTTP response");
+      return -1;
+    }
+    // what's left after the headers is the start of the body
+    h->pos = parsed;
+    h->len = n;
+  }
+  return 1;
+}
+
+bool ota_http_get(ota_http *h, const char *path, int offset, const char *etag) {
+  bool reused = h->sock >= 0;
+  if (!reused && !connect_to_server(h)) {
+    return false;
+  }
+  int ret = send_request(h, path, offset, etag);
+  if (ret == 0 && reused) {
+    // the server closed the idle connection, once more on a new one
+    ota_http_close(h);
+    reused = false;
+    if (!connect_to_server(h)) {
+      return false;
+    }
+    ret = send_request(h, path, offset, etag);
+  }
+  if (ret != 1) {
+    ESP_LOGE(SGO_LOG_EVENT, "@OTA GET %s failed, errno=%d", path, errno);
+    ota_http_close(h);
+    return false;
+  }
+
+  // these never have a body
+  if (h->status == 304 || h->status == 204 || h->status < 200 || (h->content_length == 0 && !h->chunked)) {
+    h->body_done = true;
+  }
+  ESP_LOGI(SGO_LOG_EVENT, "@OTA GET %s (from %d%s): %d, content-length=%d%s", path, offset, reused ? ", reused connection" : "", h->status, h->content_length, h->chunked ? ", chunked" : "");
+  return true;
+}
+
+// consumes chunk framing from buf, returns false once the last chunk is done
+static bool parse_chunk_framing(ota_http *h) {
+  while (h->pos < h->len && h->chunk_state != OTA_HTTP_CHUNK_DATA) {
+    char c = h->buf[h->pos++];
+    if (c != '\n') {
+      if (c != '\r' && h->line_len < OTA_HTTP_MAX_LINE - 1) {
+        h->line[h->line_len++] = c;
+      }
+      continue;
+    }
+    h->line[h->line_len] = 0;
+    size_t line_len = h->line_len;
+    h->line_len = 0;
+    switch (h->chunk_state) {
+      case OTA_HTTP_CHUNK_SIZE:
+        // extensions after ';' are ignored by strtol
+        h->chunk_left = strtol(h->line, NULL, 16);
+        h->chunk_state = h->chunk_left ? OTA_HTTP_CHUNK_DATA : OTA_HTTP_CHUNK_TRAILER;
+        break;
+      case OTA_HTTP_CHUNK_DATA_END:
+        h->chunk_state = OTA_HTTP_CHUNK_SIZE;
+        break;
+      case OTA_HTTP_CHUNK_TRAILER:
+        if (line_len == 0) {
+          return false;
+        }
+        break;
+      case OTA_HTTP_CHUNK_DATA:
+        break;
+    }
+  }
+  return true;
+}
+
+int ota_http_read(ota_http *h, const char **data) {
+  while (!h->body_done) {
+    if (!h->chunked && h->content_length >= 0 && h->body_received >= h->content_length) {
+      h->body_done = true;
+      break;
+    }
+    if (h->chunked && h->chunk_state != OTA_HTTP_CHUNK_DATA && !parse_chunk_framing(h)) {
+      h->body_done = true;
+      break;
+    }
+    if (h->pos == h->len) {
+      int n = recv(h->sock, h->buf, sizeof(h->buf), 0);
+      if (n < 0) {
+        ESP_LOGE(SGO_LOG_EVENT, "@OTA Receive error, errno=%d", errno);
+        return -1;
+      }
+      if (n == 0) {
+        h->keep_alive = false;
+        // without a length, closing is how the server ends the body
+        if (!h->chunked && h->content_length < 0) {
+          h->body_done = true;
+          break;
+        }
+        return -1;
+      }
+      h->pos = 0;
+      h->len = n;
+      continue;
+    }
+    if (h->chunked && h->chunk_state != OTA_HTTP_CHUNK_DATA) {
+      continue;
+    }
+
+    int n = h->len - h->pos;
+    if (h->chunked && n > h->chunk_left) {
+      n = h->chunk_left;
+    } else if (!h->chunked && h->content_length >= 0 && h->body_received + n > h->content_length) {
+      n = h->content_length - h->body_received;
+    }
+    *data = &h->buf[h->pos];
+    h->pos += n;
+    h->body_received += n;
+    if (h->chunked && (h->chunk_left -= n) == 0) {
+      h->chunk_state = OTA_HTTP_CHUNK_DATA_END;
+    }
+    return n;
+  }
+  return 0;
+}
+
+void ota_http_end(ota_http *h) {
+  // small leftovers, like an error page, are skipped to keep the connection
+  if (h->keep_alive && !h->body_done && !h->chunked && h->content_length >= 0
+      && h->content_length - h->body_received <= OTA_HTTP_BUFFER_SIZE) {
+    const char *data;
+    while (ota_http_read(h, &data) > 0);
+  }
+  if (!h->keep_alive || !h->body_done) {
+    ota_http_close(h);
+  }
+}
+
+void ota_http_close(ota_http *h) {
+  if (h->sock >= 0) {
+    close(h->sock);
+    h->sock = -1;
+  }
+}
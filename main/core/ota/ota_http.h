@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OTA_HTTP_H_
+#define OTA_HTTP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Minimal streaming HTTP/1.1 client for the OTA server. Responses are read
+ * straight into buf, the header parser is incremental so it doesn't care how
+ * the headers are split across recv calls, and body bytes are handed out in
+ * place, without copies.
+ *
+ * The connection is kept alive between requests when the server allows it
+ * and the previous body was read to its end, so a version check and the
+ * download that follows share one connection.
+ */
+
+#define OTA_HTTP_BUFFER_SIZE 4096
+#define OTA_HTTP_MAX_LINE 256
+#define OTA_HTTP_MAX_ETAG 64
+#define OTA_HTTP_TIMEOUT_S 10
+
+typedef enum {
+  OTA_HTTP_STATUS_LINE,
+  OTA_HTTP_HEADERS,
+  OTA_HTTP_BODY,
+  OTA_HTTP_ERROR,
+} ota_http_state;
+
+typedef enum {
+  OTA_HTTP_CHUNK_SIZE,
+  OTA_HTTP_CHUNK_DATA,
+  OTA_HTTP_CHUNK_DATA_END,
+  OTA_HTTP_CHUNK_TRAILER,
+} ota_http_chunk_state;
+
+typedef struct {
+  int sock;
+  bool keep_alive;
+  bool body_done;
+
+  ota_http_state state;
+  int status;
+  int content_length; // -1 when the server didn't send one
+  int range_start; // offset of the body in the file, from Content-Range
+  int total_length; // size of the whole file, -1 when unknown
+  int body_received;
+  char etag[OTA_HTTP_MAX_ETAG];
+
+  bool chunked;
+  ota_http_chunk_state chunk_state;
+  int chunk_left;
+
+  char line[OTA_HTTP_MAX_LINE];
+  size_t line_len;
+
+  // buf[pos:len] are body bytes not yet returned by ota_http_read
+  size_t pos;
+  size_t len;
+  char buf[OTA_HTTP_BUFFER_SIZE];
+} ota_http;
+
+void ota_http_init(ota_http *h);
+// feeds response bytes to the header parser, returns how many were consumed,
+// less than len once the headers are done, the rest is body
+size_t ota_http_parse(ota_http *h, const char *data, size_t len);
+
+// sends the request, on the current connection if it can be reused, and
+// reads the headers. With offset > 0 only the end of the file is requested
+// (206 response), with an etag the server can answer 304 Not Modified.
+bool ota_http_get(ota_http *h, const char *path, int offset, const char *etag);
+// returns the number of body bytes available at *data, 0 at the end, -1 on error
+int ota_http_read(ota_http *h, const char **data);
+// done with the response, keeps the connection if it can be reused
+void ota_http_end(ota_http *h);
+void ota_http_close(ota_http *h);
+
+#endif
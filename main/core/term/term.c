@@ -15,7 +15,6 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
-
 #include <string.h>
 
 #include "sdkconfig.h"
@@ -24,36 +23,219 @@
 #include "freertos/queue.h"
 #include "esp_system.h"
 #include "esp_vfs_dev.h"
+#include "driver/uart.h"
+#include "sodium/utils.h"
 
 #include "../log/log.h"
 #include "../kv/kv.h"
 #include "../cmd/cmd.h"
 
-#define TERM_LENGTH 256
+#define TERM_UART CONFIG_CONSOLE_UART_NUM
+#define TERM_LENGTH (MAX_CMD_BIN_LENGTH * 2 + 2)
+#define TERM_RX_BUFFER_SIZE 2048
+#define TERM_QUEUE_SIZE 16
+#define TERM_READ_SIZE 128
+
+// only short text commands are kept in history, binary lines are not
+#define TERM_HISTORY_SIZE 4
+#define TERM_HISTORY_LENGTH 256
+
+#define KEY_CTRL_C 0x03
+#define KEY_BS 0x08
+#define KEY_CTRL_U 0x15
+#define KEY_ESC 0x1B
+#define KEY_DEL 0x7F
+
+typedef enum {
+  TERM_INPUT_NORMAL,
+  TERM_INPUT_ESC,
+  TERM_INPUT_CSI,
+  TERM_INPUT_DISCARD,
+} term_input_state;
+
+static QueueHandle_t uart_queue;
 
 static char buf_term[TERM_LENGTH] = {0};
+static int len_term = 0;
+static term_input_state state = TERM_INPUT_NORMAL;
+static char last_char = 0;
+
+static char history[TERM_HISTORY_SIZE][TERM_HISTORY_LENGTH] = {0};
+static int history_head = 0; // next slot to write
+static int history_count = 0;
+static int history_pos = -1; // -1 when editing a new line
+
+static void echo(const char *data, int len) {
+#if CONFIG_SGO_TERM_ECHO
+  uart_write_bytes(TERM_UART, data, len);
+#endif
+}
+
+// binary command frames are hex encoded on a line starting with CMD_BIN_TERM_PREFIX
+static void execute_term_line(const char *line, int len) {
+  if (len == 0 || line[0] != CMD_BIN_TERM_PREFIX) {
+    execute_cmd(len, line, false);
+    return;
+  }
+  // static, only the term task gets here, keeps it off the stack
+  static uint8_t frame[MAX_CMD_BIN_LENGTH];
+  size_t frame_len = 0;
+  if (sodium_hex2bin(frame, sizeof(frame), &line[1], len - 1, NULL, &frame_len, NULL) != 0) {
+    ESP_LOGE(SGO_LOG_EVENT, "@TERM Malformed binary command");
+    return;
+  }
+  execute_cmd_bin(frame, frame_len, false);
+}
+
+static void history_push(const char *line, int len) {
+  if (len == 0 || len >= TERM_HISTORY_LENGTH || line[0] == CMD_BIN_TERM_PREFIX) {
+    return;
+  }
+  int last = (history_head + TERM_HISTORY_SIZE - 1) % TERM_HISTORY_SIZE;
+  if (history_count && strncmp(history[last], line, len) == 0 && history[last][len] == 0) {
+    return;
+  }
+  memcpy(history[history_head], line, len);
+  history[history_head][len] = 0;
+  history_head = (history_head + 1) % TERM_HISTORY_SIZE;
+  if (history_count < TERM_HISTORY_SIZE) {
+    ++history_count;
+  }
+}
+
+static void replace_line(const char *line) {
+  echo("\r\033[K", 4);
+  len_term = strlen(line);
+  memcpy(buf_term, line, len_term);
+  echo(buf_term, len_term);
+}
+
+// dir is -1 for older, 1 for newer
+static void history_move(int dir) {
+  int pos = history_pos + (dir < 0 ? 1 : -1);
+  if (pos >= history_count || pos < -1) {
+    return;
+  }
+  history_pos = pos;
+  if (pos == -1) {
+    replace_line("");
+    return;
+  }
+  replace_line(history[(history_head + TERM_HISTORY_SIZE - 1 - pos) % TERM_HISTORY_SIZE]);
+}
+
+static void end_line() {
+  echo("\r\n", 2);
+  if (state != TERM_INPUT_DISCARD) {
+    history_push(buf_term, len_term);
+    execute_term_line(buf_term, len_term);
+  }
+  state = TERM_INPUT_NORMAL;
+  len_term = 0;
+  history_pos = -1;
+}
+
+static void input_char(char c) {
+  char prev = last_char;
+  last_char = c;
+
+  if (c == '\r' || c == '\n') {
+    // CRLF counts as a single line end
+    if (c == '\n' && prev == '\r') {
+      return;
+    }
+    end_line();
+    return;
+  }
+
+  switch (state) {
+    case TERM_INPUT_DISCARD:
+      return;
+    case TERM_INPUT_ESC:
+      state = (c == '[' || c == 'O') ? TERM_INPUT_CSI : TERM_INPUT_NORMAL;
+      return;
+    case TERM_INPUT_CSI:
+      if (c >= 0x40 && c <= 0x7E) {
+        state = TERM_INPUT_NORMAL;
+        if (c == 'A') {
+          history_move(-1);
+        } else if (c == 'B') {
+          history_move(1);
+        }
+      }
+      return;
+    case TERM_INPUT_NORMAL:
+      break;
+  }
+
+  switch (c) {
+    case KEY_ESC:
+      state = TERM_INPUT_ESC;
+      return;
+    case KEY_BS:
+    case KEY_DEL:
+      if (len_term > 0) {
+        --len_term;
+        echo("\b \b", 3);
+      }
+      return;
+    case KEY_CTRL_U:
+      replace_line("");
+      return;
+    case KEY_CTRL_C:
+      echo("^C\r\n", 4);
+      len_term = 0;
+      history_pos = -1;
+      return;
+  }
+
+  if ((unsigned char)c < 0x20) {
+    return;
+  }
+  if (len_term == TERM_LENGTH) {
+    // drop the whole line instead of running a truncated command
+    ESP_LOGE(SGO_LOG_EVENT, "@TERM Line too long, max %d characters, discarding", TERM_LENGTH);
+    state = TERM_INPUT_DISCARD;
+    return;
+  }
+  buf_term[len_term++] = c;
+  echo(&c, 1);
+}
 
 static void term_task(void *param) {
-  //setvbuf(stdin, NULL, _IONBF, 0);
+  uart_event_t event;
+  char data[TERM_READ_SIZE];
 
-  int i = 0;
   while (true) {
-    vTaskDelay(20 / portTICK_PERIOD_MS);
-    int c = getchar();
-    if (c <= 0) {
+    if (xQueueReceive(uart_queue, &event, portMAX_DELAY) != pdTRUE) {
       continue;
     }
-    if (i == TERM_LENGTH) {
-      memset(buf_term, 0, TERM_LENGTH);
-      i = 0;
-    }
-
-    if (c == 0x0A) {
-      execute_cmd(i, buf_term, false);
-      memset(buf_term, 0, TERM_LENGTH);
-      i = 0;
-    } else {
-      buf_term[i++] = c;
+    switch (event.type) {
+      case UART_DATA: {
+        // a paste can span several events, read everything available
+        size_t available = 0;
+        uart_get_buffered_data_len(TERM_UART, &available);
+        while (available > 0) {
+          int n = uart_read_bytes(TERM_UART, (uint8_t *)data, available < TERM_READ_SIZE ? available : TERM_READ_SIZE, 0);
+          if (n <= 0) {
+            break;
+          }
+          for (int i = 0; i < n; ++i) {
+            input_char(data[i]);
+          }
+          available -= n;
+        }
+        break;
+      }
+      case UART_FIFO_OVF:
+      case UART_BUFFER_FULL:
+        ESP_LOGE(SGO_LOG_EVENT, "@TERM Input overflow, discarding current line");
+        uart_flush_input(TERM_UART);
+        xQueueReset(uart_queue);
+        state = TERM_INPUT_DISCARD;
+        break;
+      default:
+        break;
     }
   }
 }
@@ -61,6 +243,16 @@ static void term_task(void *param) {
 void init_term() {
   ESP_LOGI(SGO_LOG_EVENT, "@TERM Intializing TERM task");
 
+  esp_err_t err = uart_driver_install(TERM_UART, TERM_RX_BUFFER_SIZE, 0, TERM_QUEUE_SIZE, &uart_queue, 0);
+  if (err != ESP_OK) {
+    ESP_LOGE(SGO_LOG_EVENT, "@TERM uart_driver_install failed: %s", esp_err_to_name(err));
+    return;
+  }
+  // stdout now goes through the driver too, so logs and echo don't interleave mid-write
+  esp_vfs_dev_uart_use_driver(TERM_UART);
+
+  // commands run on this task, a rejected binary frame goes through
+  // execute_cmd_bin, reject_cmd_bin and send_reply's hex buffer
   BaseType_t ret = xTaskCreatePinnedToCore(term_task, "TERM", 8192, NULL, 10, NULL, 1);
   if (ret != pdPASS) {
     ESP_LOGE(SGO_LOG_EVENT, "@TERM Failed to create task");
@@ -29,6 +29,7 @@
 #include "esp_log.h"
 #include "esp_attr.h"
 #include "esp_sleep.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "mdns.h"
 
@@ -53,6 +54,26 @@ static EventGroupHandle_t wifi_event_group;
 
 static const int CONNECTED_BIT = BIT0;
 
+static bool has_connected = false;
+
+/*
+ * BSSID and channel of the last AP we connected to, saved in NVS only when
+ * they change. The first connection after boot or after losing the AP goes
+ * straight to it, without scanning, then falls back to a full scan if it
+ * doesn't answer. The DHCP lease is restored by lwIP
+ * (CONFIG_LWIP_DHCP_RESTORE_LAST_IP).
+ */
+#define WIFI_CACHE_BSSID "WBSSID"
+#define WIFI_CACHE_CHANNEL "WCHAN"
+
+// the current STA config uses the cached AP
+static bool fast_connect = false;
+// connected since the last connection attempt
+static bool was_connected = false;
+// start of the current connection attempt, for wifi_connect_time
+static int64_t connect_started = 0;
+static bool connecting = false;
+
 static void start_sta(void);
 static void start_ap(void);
 static esp_err_t event_handler(void *ctx, system_event_t *event);
@@ -71,7 +92,8 @@ void init_wifi() {
     ESP_LOGE(SGO_LOG_EVENT, "@WIFI Failed to create queue");
   }
 
-  BaseType_t ret = xTaskCreatePinnedToCore(wifi_task, "WIFI", 4096, NULL, tskIDLE_PRIORITY, NULL, 0);
+  // above the idle priority modules, reconnections shouldn't wait for them
+  BaseType_t ret = xTaskCreatePinnedToCore(wifi_task, "WIFI", 4096, NULL, 5, NULL, 0);
   if (ret != pdPASS) {
     ESP_LOGE(SGO_LOG_EVENT, "@WIFI Failed to create task");
   }
@@ -125,22 +147,84 @@ static void start_ap() {
   ESP_ERROR_CHECK( esp_wifi_start() );
 }
 
-static void start_sta() {
-  esp_wifi_stop();
-  xEventGroupClearBits(wifi_event_group, CONNECTED_BIT);
+static bool load_ap_cache(uint8_t bssid[6], uint8_t *channel) {
+  if (!hasi32(WIFI_CACHE_CHANNEL) || !hasstr(WIFI_CACHE_BSSID)) {
+    return false;
+  }
+  int32_t chan = geti32(WIFI_CACHE_CHANNEL);
+  char str[MAX_KVALUE_SIZE] = {0};
+  getstr(WIFI_CACHE_BSSID, str, sizeof(str) - 1);
+  if (chan <= 0 || chan > 14 || sscanf(str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+        &bssid[0], &bssid[1], &bssid[2], &bssid[3], &bssid[4], &bssid[5]) != 6) {
+    return false;
+  }
+  *channel = chan;
+  return true;
+}
 
-  set_wifi_status(CONNECTING);
+static void save_ap_cache() {
+  wifi_ap_record_t ap;
+  if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+    return;
+  }
+  uint8_t bssid[6];
+  uint8_t channel;
+  if (load_ap_cache(bssid, &channel) && channel == ap.primary && !memcmp(bssid, ap.bssid, sizeof(bssid))) {
+    return;
+  }
+  char str[18] = {0};
+  snprintf(str, sizeof(str), "%02x:%02x:%02x:%02x:%02x:%02x",
+      ap.bssid[0], ap.bssid[1], ap.bssid[2], ap.bssid[3], ap.bssid[4], ap.bssid[5]);
+  ESP_LOGI(SGO_LOG_EVENT, "@WIFI Caching AP %s on channel %d", str, ap.primary);
+  begin_kv_batch();
+  setstr(WIFI_CACHE_BSSID, str);
+  seti32(WIFI_CACHE_CHANNEL, ap.primary);
+  end_kv_batch();
+}
+
+static void clear_ap_cache() {
+  if (hasi32(WIFI_CACHE_CHANNEL) && geti32(WIFI_CACHE_CHANNEL) != 0) {
+    seti32(WIFI_CACHE_CHANNEL, 0);
+  }
+}
 
+// fast: straight to the cached AP if there's one, otherwise a full scan
+static void set_sta_config(bool fast) {
   wifi_config_t wifi_config = {0};
-  
+
   get_wifi_ssid((char *)wifi_config.sta.ssid, sizeof(wifi_config.sta.ssid) - 1);
   get_wifi_password((char *)wifi_config.sta.password, sizeof(wifi_config.sta.password) - 1);
 
-  wifi_config.sta.bssid_set = false;
-  ESP_LOGI(SGO_LOG_EVENT, "@WIFI Setting WiFi configuration SSID %s...", wifi_config.sta.ssid);
-  ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_STA) );
+  fast_connect = fast && load_ap_cache(wifi_config.sta.bssid, &wifi_config.sta.channel);
+  wifi_config.sta.bssid_set = fast_connect;
+  if (fast_connect) {
+    ESP_LOGI(SGO_LOG_EVENT, "@WIFI Fast connect to SSID %s, %02x:%02x:%02x:%02x:%02x:%02x on channel %d", wifi_config.sta.ssid,
+        wifi_config.sta.bssid[0], wifi_config.sta.bssid[1], wifi_config.sta.bssid[2],
+        wifi_config.sta.bssid[3], wifi_config.sta.bssid[4], wifi_config.sta.bssid[5], wifi_config.sta.channel);
+  } else {
+    ESP_LOGI(SGO_LOG_EVENT, "@WIFI Setting WiFi configuration SSID %s...", wifi_config.sta.ssid);
+  }
   ESP_ERROR_CHECK( esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
+}
+
+static void start_connecting() {
+  if (!connecting) {
+    connect_started = esp_timer_get_time();
+    connecting = true;
+  }
+}
+
+static void start_sta() {
+  esp_wifi_stop();
+  xEventGroupClearBits(wifi_event_group, CONNECTED_BIT);
+
+  set_wifi_status(CONNECTING);
+
+  ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_STA) );
+  set_sta_config(true);
 
+  connecting = false;
+  start_connecting();
   ESP_ERROR_CHECK( esp_wifi_start() );
 }
 
@@ -167,6 +251,16 @@ static esp_err_t event_handler(void *ctx, system_event_t *event) {
       break;
     case SYSTEM_EVENT_STA_GOT_IP:
       ESP_LOGI(SGO_LOG_EVENT, "@WIFI SYSTEM_EVENT_STA_GOT_IP");
+      if (has_connected) {
+        set_wifi_reconnects(get_wifi_reconnects() + 1);
+      }
+      has_connected = true;
+      if (connecting) {
+        connecting = false;
+        uint32_t connect_time = (esp_timer_get_time() - connect_started) / 1000;
+        set_wifi_connect_time(connect_time);
+        ESP_LOGI(SGO_LOG_EVENT, "@WIFI Connected in %u ms%s", connect_time, fast_connect ? " (fast connect)" : "");
+      }
       xEventGroupSetBits(wifi_event_group, CONNECTED_BIT);
       xQueueSend(cmd, &CMD_STA_CONNECTED, 0);
       set_wifi_status(CONNECTED);
@@ -175,6 +269,7 @@ static esp_err_t event_handler(void *ctx, system_event_t *event) {
       break;
     case SYSTEM_EVENT_STA_DISCONNECTED:
       ESP_LOGI(SGO_LOG_EVENT, "@WIFI SYSTEM_EVENT_STA_DISCONNECTED = %d", event->event_info.disconnected.reason);
+      start_connecting();
       bool failed = event->event_info.disconnected.reason == WIFI_REASON_NO_AP_FOUND || event->event_info.disconnected.reason == WIFI_REASON_AUTH_FAIL;
       if (failed) {
         xQueueSend(cmd, &CMD_STA_CONNECTION_FAILED, 0);
@@ -250,6 +345,7 @@ static void wifi_task(void *param) {
       // Wifi STA conf change
       if ((c == CMD_SSID_CHANGED || c == CMD_PASS_CHANGED)) {
         ESP_LOGI(SGO_LOG_EVENT, "@WIFI CMD_SSID_CHANGED | CMD_PASS_CHANGED");
+        clear_ap_cache();
         bool _is_valid = is_valid();
         if (_is_valid != was_valid) {
           was_valid = _is_valid;
@@ -264,6 +360,8 @@ static void wifi_task(void *param) {
         n_connected_sta = 0;
       } else if (c == CMD_STA_CONNECTED) {
         ESP_LOGI(SGO_LOG_EVENT, "@WIFI CMD_STA_CONNECTED");
+        was_connected = true;
+        save_ap_cache();
         restart_mdns();
       } else if (c == CMD_AP_STACONNECTED) {
         ESP_LOGI(SGO_LOG_EVENT, "@WIFI CMD_AP_STACONNECTED");
@@ -275,7 +373,15 @@ static void wifi_task(void *param) {
       // STA connection stopped
       } else if (c == CMD_STA_CONNECTION_FAILED || c == CMD_STA_DISCONNECTED) {
         ESP_LOGI(SGO_LOG_EVENT, "@WIFI CMD_STA_CONNECTION_FAILED || CMD_STA_DISCONNECTED");
-        if (n_connection_failed < 5 && is_valid()) {
+        if (is_valid() && (was_connected || fast_connect)) {
+          // lost the AP: the cached one first, failed fast connect: full scan
+          if (!was_connected) {
+            ESP_LOGI(SGO_LOG_EVENT, "@WIFI Fast connect failed, scanning");
+          }
+          set_sta_config(was_connected);
+          was_connected = false;
+          esp_wifi_connect();
+        } else if (n_connection_failed < 5 && is_valid()) {
           ++n_connection_failed;
           ESP_LOGI(SGO_LOG_EVENT, "@WIFI Retry: %d/5", n_connection_failed);
           esp_wifi_connect();
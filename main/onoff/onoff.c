@@ -135,12 +135,12 @@ static void emerson_output_task(int boxId, double on_sec, double off_sec, double
 }
 
 void start_onoff(int boxId) {
-  ESP_LOGI(SGO_LOG_NOSEND, "@ONOFF_%d start_onoff", boxId);
+  SGO_LOGI(ONOFF, SGO_LOG_NOSEND, "@ONOFF_%d start_onoff", boxId);
   onoff_task(boxId);
 }
 
 void stop_onoff(int boxId) {
-  ESP_LOGI(SGO_LOG_NOSEND, "@ONOFF_%d stop_onoff", boxId);
+  SGO_LOGI(ONOFF, SGO_LOG_NOSEND, "@ONOFF_%d stop_onoff", boxId);
   set_box_timer_output(boxId, 0);
   set_box_uva_timer_output(boxId, 0);
   set_box_db_timer_output(boxId, 0);
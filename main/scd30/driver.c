@@ -28,7 +28,7 @@ bool begin(scd30_handle *s) {
   if (getFirmwareVersion(s, &fwVer) == false) {
     return false;
 	}
-	ESP_LOGI(SGO_LOG_NOSEND, "@SCD30 firmware version %02x", fwVer);
+	SGO_LOGI(SCD30, SGO_LOG_NOSEND, "@SCD30 firmware version %02x", fwVer);
 
 	if (beginMeasuring(s, 0) == true) {
     if (setMeasurementInterval(s, 2) == false) {
@@ -209,7 +209,7 @@ bool readMeasurement(scd30_handle *s)
 	uint8_t outBuff[2] = {COMMAND_READ_MEASUREMENT >> 8, COMMAND_READ_MEASUREMENT & 0xFF};
 	i2c_err_t err = i2cWrite(s->port, SCD30_ADDRESS, outBuff, sizeof(outBuff), true, 150);
   if (!(err == I2C_ERROR_CONTINUE || err == I2C_ERROR_OK)) {
-		ESP_LOGW(SGO_LOG_NOSEND, "@SCD30 i2cWrite failed %02x", err);
+		SGO_LOGW(SCD30, SGO_LOG_NOSEND, "@SCD30 i2cWrite failed %02x", err);
     return (0);
 	}
 
@@ -255,7 +255,7 @@ bool readMeasurement(scd30_handle *s)
         foundCrc = computeCRC8(s, bytesToCrc, 2);
         if (foundCrc != incoming)
         {
-					ESP_LOGW(SGO_LOG_NOSEND, "@SCD30 readMeasurement: found CRC in byte %d, expected %02x, got %02x", x, foundCrc, incoming);
+					SGO_LOGW(SCD30, SGO_LOG_NOSEND, "@SCD30 readMeasurement: found CRC in byte %d, expected %02x, got %02x", x, foundCrc, incoming);
           error = true;
         }
         break;
@@ -264,13 +264,13 @@ bool readMeasurement(scd30_handle *s)
   }
   else
   {	
-		ESP_LOGW(SGO_LOG_NOSEND, "@SCD30 readMeasurement: no SCD30 data found from I2C, i2c claims we should receive %d bytes", size);
+		SGO_LOGW(SCD30, SGO_LOG_NOSEND, "@SCD30 readMeasurement: no SCD30 data found from I2C, i2c claims we should receive %d bytes", size);
     return false;
   }
 
   if (error)
   {
-		ESP_LOGW(SGO_LOG_NOSEND, "@SCD30 readMeasurement: encountered error reading SCD30 data.");
+		SGO_LOGW(SCD30, SGO_LOG_NOSEND, "@SCD30 readMeasurement: encountered error reading SCD30 data.");
     return false;
   }
   //Now copy the uint32s into their associated floats
@@ -293,7 +293,7 @@ bool getSettingValue(scd30_handle *s, uint16_t registerAddress, uint16_t *val)
 	uint8_t outBuff[2] = {registerAddress >> 8, registerAddress & 0xFF};
 	i2c_err_t err = i2cWrite(s->port, SCD30_ADDRESS, outBuff, sizeof(outBuff), true, 150);
   if (!(err == I2C_ERROR_CONTINUE || err == I2C_ERROR_OK)) {
-		ESP_LOGW(SGO_LOG_NOSEND, "@SCD30 i2cWrite failed %02x", err);
+		SGO_LOGW(SCD30, SGO_LOG_NOSEND, "@SCD30 i2cWrite failed %02x", err);
     return (0);
 	}
 
@@ -303,7 +303,7 @@ bool getSettingValue(scd30_handle *s, uint16_t registerAddress, uint16_t *val)
 	uint8_t buff[3];
 	err = i2cRead(s->port, SCD30_ADDRESS, buff, sizeof(buff), true, 150, &size);
 	if (!(err == I2C_ERROR_CONTINUE || err == I2C_ERROR_OK)) {
-		ESP_LOGW(SGO_LOG_NOSEND, "@SCD30 i2cRead failed %02x", err);
+		SGO_LOGW(SCD30, SGO_LOG_NOSEND, "@SCD30 i2cRead failed %02x", err);
     return (0);
 	}
 
@@ -317,9 +317,9 @@ bool getSettingValue(scd30_handle *s, uint16_t registerAddress, uint16_t *val)
     uint8_t expectedCRC = computeCRC8(s, data, 2);
     if (crc == expectedCRC) // Return true if CRC check is OK
       return (true);
-		ESP_LOGW(SGO_LOG_NOSEND, "@SCD30 getSettingValue: CRC fail: expected %02x, got %02x", expectedCRC, crc);
+		SGO_LOGW(SCD30, SGO_LOG_NOSEND, "@SCD30 getSettingValue: CRC fail: expected %02x, got %02x", expectedCRC, crc);
   } else {
-		ESP_LOGW(SGO_LOG_NOSEND, "@SCD30 i2cRead failed %d", size);
+		SGO_LOGW(SCD30, SGO_LOG_NOSEND, "@SCD30 i2cRead failed %d", size);
 	}
   return (false);
 }
@@ -330,7 +330,7 @@ uint16_t readRegister(scd30_handle *s, uint16_t registerAddress)
 	uint8_t outBuff[2] = {registerAddress >> 8, registerAddress & 0xFF};
 	i2c_err_t err = i2cWrite(s->port, SCD30_ADDRESS, outBuff, sizeof(outBuff), true, 150);
   if (!(err == I2C_ERROR_CONTINUE || err == I2C_ERROR_OK)) {
-		ESP_LOGW(SGO_LOG_NOSEND, "@SCD30 i2cWrite in readRegister failed %02x", err);
+		SGO_LOGW(SCD30, SGO_LOG_NOSEND, "@SCD30 i2cWrite in readRegister failed %02x", err);
     return (0);
 	}
 
@@ -345,7 +345,7 @@ uint16_t readRegister(scd30_handle *s, uint16_t registerAddress)
     uint8_t lsb = buff[1];
     return ((uint16_t)msb << 8 | lsb);
   }
-	ESP_LOGW(SGO_LOG_NOSEND, "@SCD30 i2cRead in readRegister failed %02x", err);
+	SGO_LOGW(SCD30, SGO_LOG_NOSEND, "@SCD30 i2cRead in readRegister failed %02x", err);
   return (0); //Sensor did not respond
 }
 
@@ -360,7 +360,7 @@ bool sendCommandArg(scd30_handle *s, uint16_t command, uint16_t arguments)
 	uint8_t outBuff[5] = {command >> 8, command & 0xFF, arguments >> 8, arguments & 0xFF, crc};
 	i2c_err_t err = i2cWrite(s->port, SCD30_ADDRESS, outBuff, sizeof(outBuff), true, 150);
   if (!(err == I2C_ERROR_CONTINUE || err == I2C_ERROR_OK)) {
-		ESP_LOGW(SGO_LOG_NOSEND, "@SCD30 i2cWrite in sendCommandArg failed %02x", err);
+		SGO_LOGW(SCD30, SGO_LOG_NOSEND, "@SCD30 i2cWrite in sendCommandArg failed %02x", err);
     return false;
 	}
 
@@ -373,7 +373,7 @@ bool sendCommand(scd30_handle *s, uint16_t command)
 	uint8_t outBuff[2] = {command >> 8, command & 0xFF};
 	i2c_err_t err = i2cWrite(s->port, SCD30_ADDRESS, outBuff, sizeof(outBuff), true, 150);
   if (!(err == I2C_ERROR_CONTINUE || err == I2C_ERROR_OK)) {
-		ESP_LOGW(SGO_LOG_NOSEND, "@SCD30 i2cWrite in sendCommand failed %02x", err);
+		SGO_LOGW(SCD30, SGO_LOG_NOSEND, "@SCD30 i2cWrite in sendCommand failed %02x", err);
     return false;
 	}
 
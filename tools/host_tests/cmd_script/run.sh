@@ -0,0 +1,24 @@
+#!/bin/bash
+
+# Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+# Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Runs the script host test: tools/host_tests/cmd_script/run.sh
+set -e
+cd "$(dirname "$0")"
+S=../stubs
+gcc -std=gnu99 -g -w -I$S -I$S/generated/log -o /tmp/sgo_cmd_script test.c unused.c $S/fake_idf.c
+/tmp/sgo_cmd_script
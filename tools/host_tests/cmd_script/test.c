@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// runs cmd.c's run_script on Linux, see run.sh
+#include <stdlib.h>
+
+// malloc(0) is NULL like in the ESP-IDF heap, glibc returns a pointer
+static void *idf_malloc(size_t size) {
+  return size ? malloc(size) : NULL;
+}
+#define malloc idf_malloc
+
+#include "../../../main/core/cmd/cmd.c"
+
+#include <assert.h>
+
+// the console only records the commands, "fail" fails
+static int n_run = 0;
+esp_err_t esp_console_run(const char *cmdline, int *cmd_ret) {
+  while (*cmdline == ' ') ++cmdline;
+  if (*cmdline == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  ++n_run;
+  *cmd_ret = strncmp(cmdline, "fail", 4) == 0 ? ESP_FAIL : ESP_OK;
+  return ESP_OK;
+}
+
+void begin_kv_batch() {}
+esp_err_t end_kv_batch() { return ESP_OK; }
+
+static char dir[] = "/tmp/sgo_cmd_script_XXXXXX";
+
+static void write_file(const char *name, const char *content) {
+  char path[128];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE *f = fopen(path, "w");
+  fputs(content, f);
+  fclose(f);
+}
+
+static void read_file(const char *name, char *dst, size_t len) {
+  char path[128];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  memset(dst, 0, len);
+  FILE *f = fopen(path, "r");
+  assert(f);
+  fread(dst, 1, len - 1, f);
+  fclose(f);
+}
+
+static bool exists(const char *name) {
+  char path[128];
+  struct stat st;
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  return stat(path, &st) == 0;
+}
+
+static int run(const char *name, bool delete_after) {
+  char path[128];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  n_run = 0;
+  return run_script(name, path, false, delete_after);
+}
+
+int main() {
+  char log[1024];
+  assert(mkdtemp(dir));
+
+  // all good, deleted
+  write_file("ok.cmd", "# comment\r\nseti -k A -v 1\n\nsets -k B -v x\n");
+  assert(run("ok", true) == ESP_OK);
+  assert(n_run == 2);
+  assert(!exists("ok.cmd"));
+  read_file("ok.log", log, sizeof(log));
+  assert(strstr(log, "\"status\":\"ok\",\"total\":2,\"failed\":0"));
+
+  // empty, nothing to run, deleted too
+  write_file("empty.cmd", "");
+  assert(run("empty", true) == ESP_OK);
+  assert(n_run == 0);
+  assert(!exists("empty.cmd"));
+  read_file("empty.log", log, sizeof(log));
+  assert(strstr(log, "\"status\":\"ok\",\"total\":0,\"failed\":0"));
+
+  // a failing command keeps the script
+  write_file("fail.cmd", "seti -k A -v 1\nfail -i f1\n");
+  assert(run("fail", true) == ESP_FAIL);
+  assert(exists("fail.cmd"));
+  read_file("fail.log", log, sizeof(log));
+  assert(strstr(log, "\"status\":\"error\",\"total\":2,\"failed\":1"));
+  assert(strstr(log, "{\"id\":\"f1\",\"code\":-1,"));
+
+  // a line too long to run is a failure too, not skipped
+  char script[MAX_CMD_LENGTH + 64] = "seti -k A -v 1\nsets -k B -v ";
+  size_t n = strlen(script);
+  memset(&script[n], 'x', MAX_CMD_LENGTH);
+  strcpy(&script[n + MAX_CMD_LENGTH], "\nseti -k C -v 3\n");
+  write_file("long.cmd", script);
+  assert(run("long", true) == ESP_FAIL);
+  assert(n_run == 2);
+  assert(exists("long.cmd"));
+  read_file("long.log", log, sizeof(log));
+  assert(strstr(log, "\"status\":\"error\",\"total\":3,\"failed\":1"));
+  assert(strstr(log, "{\"id\":\"line 2\",\"code\":260,\"error\":\"command too long\"}"));
+
+  printf("cmd_script: OK\n");
+  return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// referenced by the parts of cmd.c the test doesn't run, only to link
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define UNUSED(name) void name() { abort(); }
+
+UNUSED(arg_end) UNUSED(arg_int0) UNUSED(arg_int1) UNUSED(arg_parse) UNUSED(arg_print_errors)
+UNUSED(arg_str0) UNUSED(arg_str1)
+UNUSED(esp_console_cmd_register) UNUSED(esp_console_init)
+UNUSED(check_cmd_bin) UNUSED(reject_cmd_bin) UNUSED(run_cmd_bin) UNUSED(mqtt_reply)
+UNUSED(get_kvi8_mapping) UNUSED(get_kvui8_mapping) UNUSED(get_kvi16_mapping) UNUSED(get_kvui16_mapping)
+UNUSED(get_kvi32_mapping) UNUSED(get_kvui32_mapping) UNUSED(get_kvs_mapping) UNUSED(get_cmd_boot_script_delete)
+UNUSED(set_cmd_latency) UNUSED(set_cmd_max_latency) UNUSED(set_cmd_max_queued) UNUSED(set_cmd_queued) UNUSED(set_cmd_rejected)
+UNUSED(sgo_log_struct) UNUSED(sgo_log_text_format)
+UNUSED(uxSemaphoreGetCount) UNUSED(xSemaphoreCreateCounting) UNUSED(xSemaphoreGive) UNUSED(xSemaphoreTake)
+UNUSED(vRingbufferReturnItem) UNUSED(xRingbufferCreate) UNUSED(xRingbufferReceive) UNUSED(xRingbufferSend)
+UNUSED(xTaskCreatePinnedToCore) UNUSED(xTaskGetTickCount)
+
+bool sgo_log_binary = false;
+uint8_t sgo_log_levels[8] = {0};
@@ -0,0 +1,73 @@
+#!/bin/bash
+
+# Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+# Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Runs the delta OTA host test: tools/host_tests/ota_delta/run.sh
+#
+# Diffs two firmware images with tools/ota_diff.py, then applies the patch
+# with ota_delta.c between file-backed partitions. Also checks that a patch
+# for another image, a truncated patch and a corrupted one are refused.
+# Needs python3 and openssl's libcrypto.
+set -e
+cd "$(dirname "$0")"
+S=../stubs
+gcc -std=gnu99 -g -w -I$S -I$S/generated/log -o /tmp/sgo_ota_delta test.c $S/fake_flash.c $S/fake_idf.c -lcrypto
+
+W=$(mktemp -d /tmp/sgo_ota_delta_XXXXXX)
+trap 'rm -rf $W' EXIT
+
+# the new image is the old one with code inserted, removed and changed, so
+# everything after the first edit moves
+python3 - $W/old.bin $W/new.bin <<'PY'
+import random, sys
+random.seed(1)
+blocks = [bytes(random.randrange(256) for _ in range(random.randrange(64, 2048))) for _ in range(600)]
+old = b''.join(blocks)
+new = bytearray(b''.join(blocks[:100] + [b'\x00new code' * 300] + blocks[100:400] + blocks[420:]))
+for _ in range(200):
+    new[random.randrange(len(new))] = random.randrange(256)
+open(sys.argv[1], 'wb').write(old)
+open(sys.argv[2], 'wb').write(new)
+PY
+python3 ../../ota_diff.py diff $W/old.bin $W/new.bin $W/patch
+echo "patch: $(stat -c %s $W/patch) bytes for a $(stat -c %s $W/new.bin) bytes image"
+
+# run CASE RUNNING_IMAGE PATCH EXPECTED_ERR
+run() {
+  rm -f $W/flash
+  if ! /tmp/sgo_ota_delta $W/flash $2 $3 $W/new.bin $4 > $W/out.log; then
+    echo "$1: failed"
+    cat $W/out.log
+    exit 1
+  fi
+}
+
+run apply $W/old.bin $W/patch 0
+
+# OTA_DELTA_ERR_SOURCE_MISMATCH
+run wrong-base $W/new.bin $W/patch 0x10A
+
+head -c $(($(stat -c %s $W/patch) - 100)) $W/patch > $W/truncated.patch
+# ESP_ERR_INVALID_SIZE
+run truncated-patch $W/old.bin $W/truncated.patch 0x104
+
+# the expected result hash, in the header, doesn't match what the patch builds
+python3 -c "import sys; p = bytearray(open(sys.argv[1], 'rb').read()); p[60] ^= 1; open(sys.argv[2], 'wb').write(p)" $W/patch $W/corrupt.patch
+# ESP_ERR_INVALID_CRC
+run corrupt-patch $W/old.bin $W/corrupt.patch 0x109
+
+echo "ota_delta: OK"
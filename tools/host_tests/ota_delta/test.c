@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// applies an ota_diff.py patch with ota_delta.c on Linux, see run.sh
+#include "../../../main/core/ota/ota_delta.c"
+
+#include "fake_flash.h"
+
+#define PARTITION_SIZE (1024 * 1024)
+
+static const esp_partition_t running = {.type = 0, .subtype = 0x10, .address = 0, .size = PARTITION_SIZE};
+static const esp_partition_t update = {.type = 0, .subtype = 0x11, .address = PARTITION_SIZE, .size = PARTITION_SIZE};
+
+static uint8_t *read_file(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    perror(path);
+    exit(2);
+  }
+  fseek(f, 0, SEEK_END);
+  *len = ftell(f);
+  rewind(f);
+  uint8_t *data = malloc(*len);
+  if (fread(data, 1, *len, f) != *len) {
+    exit(2);
+  }
+  fclose(f);
+  return data;
+}
+
+static bool partition_is(const esp_partition_t *p, const uint8_t *expected, size_t len) {
+  static uint8_t data[PARTITION_SIZE];
+  return esp_partition_read(p, 0, data, len) == ESP_OK && memcmp(data, expected, len) == 0;
+}
+
+// usage: test FLASH RUNNING_IMAGE PATCH NEW_IMAGE EXPECTED_ERR
+int main(int argc, char **argv) {
+  if (argc < 6) {
+    fprintf(stderr, "usage: %s FLASH RUNNING_IMAGE PATCH NEW_IMAGE EXPECTED_ERR\n", argv[0]);
+    return 2;
+  }
+  size_t base_len, patch_len, new_len;
+  uint8_t *base = read_file(argv[2], &base_len);
+  uint8_t *patch = read_file(argv[3], &patch_len);
+  uint8_t *new_image = read_file(argv[4], &new_len);
+  esp_err_t expected_err = strtol(argv[5], NULL, 0);
+
+  fake_flash_open(argv[1], 2 * PARTITION_SIZE);
+  esp_partition_erase_range(&running, 0, PARTITION_SIZE);
+  esp_partition_write(&running, 0, base, base_len);
+  static uint8_t untouched[PARTITION_SIZE];
+  esp_partition_read(&update, 0, untouched, PARTITION_SIZE);
+
+  // streamed in pieces of any size, like packets
+  ota_delta *d = malloc(sizeof(ota_delta));
+  ota_delta_begin(d, &running, &update);
+  srand(1);
+  esp_err_t err = ESP_OK;
+  for (size_t i = 0; i < patch_len && err == ESP_OK;) {
+    size_t n = 1 + rand() % 5000;
+    n = n < patch_len - i ? n : patch_len - i;
+    err = ota_delta_write(d, &patch[i], n);
+    i += n;
+  }
+  if (err == ESP_OK) {
+    err = ota_delta_end(d);
+  } else {
+    ota_delta_abort(d);
+  }
+  printf("*** err=%s, expected %s\n", esp_err_to_name(err), argv[5]);
+  if (err != expected_err) {
+    return 1;
+  }
+
+  if (err == ESP_OK && !partition_is(&update, new_image, new_len)) {
+    printf("*** patched image differs\n");
+    return 1;
+  }
+  // a patch for another image doesn't even erase the update partition
+  if (err == OTA_DELTA_ERR_SOURCE_MISMATCH && !partition_is(&update, untouched, PARTITION_SIZE)) {
+    printf("*** update partition changed\n");
+    return 1;
+  }
+  return 0;
+}
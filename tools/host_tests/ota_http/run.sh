@@ -0,0 +1,52 @@
+#!/bin/bash
+
+# Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+# Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Runs the OTA http client host test: tools/host_tests/ota_http/run.sh
+#
+# ota_http.c built for Linux against server.py, checks the parser, Range,
+# chunked bodies, 304s, headers split in one byte packets, and that all of it
+# goes through one keep-alive connection. Prints the download speed of a
+# 4 MB image over loopback, next to plain recv calls on the same link.
+# Needs python3.
+set -e
+cd "$(dirname "$0")"
+S=../stubs
+# lwIP's sys/socket.h also declares inet_aton and inet_ntoa, glibc's doesn't
+gcc -std=gnu99 -O2 -g -w -include arpa/inet.h -I$S -I$S/generated/log -o /tmp/sgo_ota_http test.c $S/fake_idf.c
+
+W=$(mktemp -d /tmp/sgo_ota_http_XXXXXX)
+SERVER=
+trap '[ -n "$SERVER" ] && kill $SERVER; rm -rf $W' EXIT
+
+head -c $((4 * 1024 * 1024)) /dev/urandom > $W/firmware.bin
+echo 200 > $W/last_timestamp
+
+python3 server.py $W $W/port > $W/server.log &
+SERVER=$!
+while [ ! -s $W/port ]; do sleep 0.1; done
+
+if ! /tmp/sgo_ota_http $W $(cat $W/port); then
+  cat $W/server.log
+  exit 1
+fi
+# the plain recv download, then everything else
+if [ "$(grep -c '^connection' $W/server.log)" != 2 ]; then
+  echo "ota_http: expected two connections"
+  cat $W/server.log
+  exit 1
+fi
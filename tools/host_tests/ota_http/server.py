@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+# Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Stands in for the OTA server in the ota_http host test, serves ROOT over
+# HTTP/1.1 with keep-alive, Range, ETag/If-None-Match, and chunked bodies
+# for files without an extension. Paths under /slow/ get their headers one
+# byte per send.
+#
+#   server.py ROOT PORT_FILE
+#
+# Listens on a free port and writes it to PORT_FILE, logs one line per request.
+
+import hashlib
+import os
+import re
+import socket
+import sys
+import time
+
+
+def read_request(conn, pending):
+    while b'\r\n\r\n' not in pending:
+        data = conn.recv(4096)
+        if not data:
+            return None, b''
+        pending += data
+    req, rest = pending.split(b'\r\n\r\n', 1)
+    return req.decode(), rest
+
+
+def send_headers(conn, headers, slow):
+    if not slow:
+        conn.sendall(headers)
+        return
+    conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    for i in range(len(headers)):
+        conn.sendall(headers[i:i + 1])
+        time.sleep(0.001)
+
+
+def respond(conn, root, req):
+    path = req.split(' ')[1]
+    slow = path.startswith('/slow/')
+    file_path = os.path.join(root, path[len('/slow/') if slow else 1:])
+    if not os.path.isfile(file_path):
+        print('%s: 404' % path, flush=True)
+        conn.sendall(b'HTTP/1.1 404 Not Found\r\nContent-Length: 9\r\n\r\nnot found')
+        return
+    with open(file_path, 'rb') as f:
+        data = f.read()
+    etag = '"%s"' % hashlib.sha256(data).hexdigest()[:16]
+
+    m = re.search(r'If-None-Match: (.*)', req)
+    if m and m.group(1).strip() == etag:
+        print('%s: 304' % path, flush=True)
+        send_headers(conn, ('HTTP/1.1 304 Not Modified\r\nETag: %s\r\n\r\n' % etag).encode(), slow)
+        return
+
+    m = re.search(r'Range: bytes=(\d+)-', req)
+    start = int(m.group(1)) if m else 0
+    body = data[start:]
+    if m:
+        headers = 'HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %d-%d/%d\r\n' % (start, len(data) - 1, len(data))
+    else:
+        headers = 'HTTP/1.1 200 OK\r\n'
+    headers += 'ETag: %s\r\nX-Padding: %s\r\n' % (etag, 'x' * 300)
+    if '.' not in os.path.basename(path):
+        headers += 'Transfer-Encoding: chunked\r\n\r\n'
+        body = b''.join(b'%x\r\n%s\r\n' % (len(c), c) for c in (body[:1], body[1:]) if c) + b'0\r\n\r\n'
+    else:
+        headers += 'Content-Length: %d\r\n\r\n' % len(body)
+    print('%s from %d: %d bytes%s' % (path, start, len(body), ', slow headers' if slow else ''), flush=True)
+    send_headers(conn, headers.encode(), slow)
+    conn.sendall(body)
+
+
+def main():
+    root, port_file = sys.argv[1], sys.argv[2]
+    s = socket.socket()
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    s.bind(('127.0.0.1', 0))
+    s.listen(5)
+    with open(port_file, 'w') as f:
+        f.write('%d\n' % s.getsockname()[1])
+    while True:
+        conn, _ = s.accept()
+        print('connection', flush=True)
+        pending = b''
+        try:
+            while True:
+                req, pending = read_request(conn, pending)
+                if req is None:
+                    break
+                respond(conn, root, req)
+        except OSError:
+            pass
+        conn.close()
+
+
+if __name__ == '__main__':
+    main()
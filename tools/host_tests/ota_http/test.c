@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// runs ota_http.c on Linux against server.py, see run.sh
+#include "../../../main/core/ota/ota_http.c"
+
+#include <assert.h>
+#include <time.h>
+
+static uint16_t server_port = 0;
+
+void get_ota_server_ip(char *dst, size_t len) { snprintf(dst, len, "127.0.0.1"); }
+void get_ota_server_hostname(char *dst, size_t len) { snprintf(dst, len, "localhost"); }
+uint16_t get_ota_server_port() { return server_port; }
+
+static uint8_t *read_file(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  assert(f);
+  fseek(f, 0, SEEK_END);
+  *len = ftell(f);
+  rewind(f);
+  uint8_t *data = malloc(*len);
+  assert(fread(data, 1, *len, f) == *len);
+  fclose(f);
+  return data;
+}
+
+// reads the whole body into dst, returns its length
+static int read_body(ota_http *h, uint8_t *dst, size_t len) {
+  size_t received = 0;
+  const char *data;
+  int n;
+  while ((n = ota_http_read(h, &data)) > 0) {
+    assert(received + n <= len);
+    memcpy(&dst[received], data, n);
+    received += n;
+  }
+  assert(n == 0);
+  return received;
+}
+
+static double now_s() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the same download with plain recv calls and no parsing, what the link can do
+static double raw_download_s(size_t firmware_len) {
+  ota_http h;
+  ota_http_init(&h);
+  assert(connect_to_server(&h));
+  double started = now_s();
+  const char req[] = "GET /firmware.bin HTTP/1.1\r\n\r\n";
+  assert(send(h.sock, req, sizeof(req) - 1, 0) == sizeof(req) - 1);
+  size_t received = 0;
+  int n;
+  while (received < firmware_len && (n = recv(h.sock, h.buf, sizeof(h.buf), 0)) > 0) {
+    received += n;
+  }
+  double elapsed = now_s() - started;
+  ota_http_close(&h);
+  return elapsed;
+}
+
+// the parser keeps its state between calls, headers can come split anywhere
+static void test_parse_byte_at_a_time(ota_http *h) {
+  char long_header[OTA_HTTP_MAX_LINE * 2] = {0};
+  memset(long_header, 'a', sizeof(long_header) - 1);
+  char resp[1024];
+  snprintf(resp, sizeof(resp),
+    "HTTP/1.1 206 Partial Content\r\n"
+    "X-Long: %s\r\n"
+    "content-length:  42\r\n"
+    "Content-Range: bytes 100-141/142\r\n"
+    "ETag: \"abc\"\r\n"
+    "\r\n"
+    "BODY", long_header);
+
+  ota_http_init(h);
+  reset_response(h);
+  size_t i = 0, len = strlen(resp);
+  while (i < len && h->state != OTA_HTTP_BODY) {
+    size_t n = ota_http_parse(h, &resp[i], 1);
+    assert(n == 1);
+    i += n;
+  }
+  assert(h->state == OTA_HTTP_BODY);
+  assert(h->status == 206);
+  assert(h->content_length == 42);
+  assert(h->range_start == 100);
+  assert(h->total_length == 142);
+  assert(strcmp(h->etag, "\"abc\"") == 0);
+  assert(strcmp(&resp[i], "BODY") == 0);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s ROOT PORT\n", argv[0]);
+    return 2;
+  }
+  char path[256];
+  size_t firmware_len;
+  snprintf(path, sizeof(path), "%s/firmware.bin", argv[1]);
+  uint8_t *firmware = read_file(path, &firmware_len);
+  uint8_t *body = malloc(firmware_len);
+  server_port = atoi(argv[2]);
+
+  ota_http *h = malloc(sizeof(ota_http));
+  test_parse_byte_at_a_time(h);
+
+  double raw_elapsed = raw_download_s(firmware_len);
+
+  // the rest shares one connection, run.sh checks the server saw only two,
+  // with the raw download
+  ota_http_init(h);
+
+  // full image
+  double started = now_s();
+  assert(ota_http_get(h, "/firmware.bin", 0, NULL));
+  assert(h->status == 200 && h->content_length == (int)firmware_len && h->total_length == (int)firmware_len);
+  assert(read_body(h, body, firmware_len) == (int)firmware_len);
+  double elapsed = now_s() - started;
+  assert(memcmp(body, firmware, firmware_len) == 0);
+  ota_http_end(h);
+  printf("*** %zu bytes in %.3fs, %.1f MB/s, plain recv %.1f MB/s\n", firmware_len, elapsed,
+      firmware_len / elapsed / 1e6, firmware_len / raw_elapsed / 1e6);
+
+  // the end of it
+  assert(ota_http_get(h, "/firmware.bin", 1000, NULL));
+  assert(h->status == 206 && h->range_start == 1000 && h->total_length == (int)firmware_len);
+  assert(read_body(h, body, firmware_len) == (int)firmware_len - 1000);
+  assert(memcmp(body, &firmware[1000], firmware_len - 1000) == 0);
+  ota_http_end(h);
+
+  // chunked
+  char etag[OTA_HTTP_MAX_ETAG];
+  assert(ota_http_get(h, "/last_timestamp", 0, NULL));
+  assert(h->status == 200 && h->chunked);
+  assert(read_body(h, body, firmware_len) == 4 && memcmp(body, "200\n", 4) == 0);
+  strcpy(etag, h->etag);
+  ota_http_end(h);
+
+  // not modified, no body
+  assert(ota_http_get(h, "/last_timestamp", 0, etag));
+  assert(h->status == 304);
+  assert(read_body(h, body, firmware_len) == 0);
+  ota_http_end(h);
+
+  // headers one byte per packet
+  assert(ota_http_get(h, "/slow/last_timestamp", 0, NULL));
+  assert(h->status == 200 && h->chunked && strcmp(h->etag, etag) == 0);
+  assert(read_body(h, body, firmware_len) == 4 && memcmp(body, "200\n", 4) == 0);
+  ota_http_end(h);
+  assert(ota_http_get(h, "/slow/firmware.bin", 1000, NULL));
+  assert(h->status == 206 && h->range_start == 1000 && h->content_length == (int)firmware_len - 1000);
+  assert(read_body(h, body, firmware_len) == (int)firmware_len - 1000);
+  assert(memcmp(body, &firmware[1000], firmware_len - 1000) == 0);
+  ota_http_end(h);
+
+  // an error page is skipped, the connection is kept
+  assert(ota_http_get(h, "/firmware.1.patch", 0, NULL));
+  assert(h->status == 404);
+  ota_http_end(h);
+  assert(h->sock >= 0);
+
+  ota_http_close(h);
+  free(h);
+  printf("ota_http: OK\n");
+  return 0;
+}
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+# Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# OTA server for the host tests, serves ROOT over HTTP/1.0 with Range
+# support and drops connections to .bin files at random offsets.
+#
+#   flaky_server.py ROOT PORT_FILE DROP_PROBABILITY SEED
+#
+# Listens on a free port and writes it to PORT_FILE, logs one line per request.
+
+import os
+import random
+import re
+import socket
+import sys
+
+
+def read_request(conn):
+    req = b''
+    while b'\r\n\r\n' not in req:
+        data = conn.recv(4096)
+        if not data:
+            return None
+        req += data
+    return req.decode()
+
+
+def serve(conn, root, drop):
+    req = read_request(conn)
+    if req is None:
+        return
+    path = req.split(' ')[1]
+    file_path = os.path.join(root, path.lstrip('/'))
+    if not os.path.isfile(file_path):
+        print('%s: 404' % path, flush=True)
+        conn.sendall(b'HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n')
+        return
+    with open(file_path, 'rb') as f:
+        data = f.read()
+
+    m = re.search(r'Range: bytes=(\d+)-', req)
+    start = int(m.group(1)) if m else 0
+    if m and start >= len(data):
+        print('%s from %d: 416' % (path, start), flush=True)
+        conn.sendall(b'HTTP/1.0 416 Range Not Satisfiable\r\nContent-Length: 0\r\n\r\n')
+        return
+    body = data[start:]
+    if m:
+        header = 'HTTP/1.0 206 Partial Content\r\nContent-Range: bytes %d-%d/%d\r\n' % (start, len(data) - 1, len(data))
+    else:
+        header = 'HTTP/1.0 200 OK\r\n'
+    header += 'Content-Length: %d\r\n\r\n' % len(body)
+
+    if path.endswith('.bin') and random.random() < drop:
+        cut = random.randrange(len(body))
+        print('%s from %d: dropped after %d bytes' % (path, start, cut), flush=True)
+        body = body[:cut]
+    else:
+        print('%s from %d: %d bytes' % (path, start, len(body)), flush=True)
+    conn.sendall(header.encode() + body)
+
+
+def main():
+    root, port_file, drop, seed = sys.argv[1], sys.argv[2], float(sys.argv[3]), int(sys.argv[4])
+    random.seed(seed)
+    s = socket.socket()
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    s.bind(('127.0.0.1', 0))
+    s.listen(5)
+    with open(port_file, 'w') as f:
+        f.write('%d\n' % s.getsockname()[1])
+    while True:
+        conn, _ = s.accept()
+        try:
+            serve(conn, root, drop)
+        except OSError:
+            pass
+        conn.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,99 @@
+#!/bin/bash
+
+# Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+# Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Runs the OTA resume host test: tools/host_tests/ota_resume/run.sh
+#
+# A full image download against flaky_server.py that survives dropped
+# connections, a power cut halfway, and a checkpoint that no longer matches
+# the partition. Needs python3 and openssl's libcrypto.
+set -e
+cd "$(dirname "$0")"
+S=../stubs
+# lwIP's sys/socket.h also declares inet_aton and inet_ntoa, glibc's doesn't
+gcc -std=gnu99 -g -w -include arpa/inet.h -I$S -I$S/generated/log -o /tmp/sgo_ota_resume test.c unused.c ../../../main/core/ota/ota_http.c $S/fake_flash.c $S/fake_kv.c $S/fake_idf.c -lcrypto
+
+W=$(mktemp -d /tmp/sgo_ota_resume_XXXXXX)
+SERVER=
+trap '[ -n "$SERVER" ] && kill $SERVER; rm -rf $W' EXIT
+
+# 9 checkpoints and a bit
+mkdir -p $W/srv/rel/200
+head -c 600000 /dev/urandom > $W/srv/rel/200/firmware.bin
+sha256sum $W/srv/rel/200/firmware.bin | cut -d' ' -f1 > $W/srv/rel/200/firmware.sha256
+echo 200 > $W/srv/rel/last_timestamp
+
+start_server() {
+  [ -n "$SERVER" ] && kill $SERVER && wait $SERVER 2>/dev/null || true
+  rm -f $W/port $W/server.log
+  python3 flaky_server.py $W/srv $W/port $1 1 > $W/server.log &
+  SERVER=$!
+  while [ ! -s $W/port ]; do sleep 0.1; done
+}
+
+# flash and kv from scratch, like a device that never tried this update
+reset_device() {
+  rm -f $W/flash $W/kv
+}
+
+# run EXIT_STATUS [POWER_CUT_AFTER], 0 is a restart into the new image, 3 a power cut
+run() {
+  local status=0
+  /tmp/sgo_ota_resume $W/flash $W/kv $W/srv/rel/200/firmware.bin $(cat $W/port) $2 > $W/out.log || status=$?
+  if [ $status != $1 ]; then
+    echo "$CASE: exited with $status instead of $1"
+    cat $W/out.log
+    exit 1
+  fi
+}
+
+expect() {
+  if ! grep -q "$2" $W/$1; then
+    echo "$CASE: expected \"$2\" in $1"
+    cat $W/$1
+    exit 1
+  fi
+}
+
+CASE=resume
+start_server 0.5
+reset_device
+run 0
+expect out.log "Download interrupted"
+expect out.log "image MATCHES"
+expect server.log "dropped after"
+
+CASE=reboot-resume
+start_server 0
+reset_device
+run 3 300000
+expect out.log "power cut"
+run 0
+expect out.log "Resuming download at 262144"
+expect server.log "firmware.bin from 262144"
+expect out.log "image MATCHES"
+
+CASE=corrupt-checkpoint
+reset_device
+run 3 300000
+# a byte of the update partition, before the checkpoint, changes under it
+printf '\x00' | dd of=$W/flash bs=1 seek=$((1024 * 1024 + 1000)) conv=notrunc 2>/dev/null
+run 0
+expect out.log "doesn't match the partition, starting over"
+expect out.log "image MATCHES"
+
+echo "ota_resume: OK"
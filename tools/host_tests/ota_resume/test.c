@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// runs ota.c's full image download on Linux, see run.sh
+#include "../../../main/core/ota/ota.c"
+
+#include <time.h>
+
+#include "fake_flash.h"
+#include "fake_kv.h"
+
+#define PARTITION_SIZE (1024 * 1024)
+
+static const esp_partition_t running = {.type = 0, .subtype = 0x10, .address = 0, .size = PARTITION_SIZE};
+static const esp_partition_t update = {.type = 0, .subtype = 0x11, .address = PARTITION_SIZE, .size = PARTITION_SIZE};
+
+static const char *expected_image = NULL;
+static uint16_t server_port = 0;
+
+void get_ota_basedir(char *dst, size_t len) { snprintf(dst, len, "/rel"); }
+void get_ota_server_ip(char *dst, size_t len) { snprintf(dst, len, "127.0.0.1"); }
+void get_ota_server_hostname(char *dst, size_t len) { snprintf(dst, len, "localhost"); }
+uint16_t get_ota_server_port() { return server_port; }
+int32_t get_ota_timestamp() { return 100; }
+void set_ota_timestamp(int32_t value) {}
+void set_ota_status(int8_t value) {}
+void set_ota_progress(int8_t value) {}
+void set_ota_received(uint32_t value) {}
+void set_ota_speed(uint32_t value) {}
+
+void vTaskDelay(TickType_t ticks) {}
+
+TickType_t xTaskGetTickCount(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / portTICK_PERIOD_MS;
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void) { return &running; }
+const esp_partition_t *esp_ota_get_running_partition(void) { return &running; }
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *from) { return &update; }
+
+// the real one checks the image, this one compares it with the served file
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *p) {
+  static uint8_t expected[PARTITION_SIZE], actual[PARTITION_SIZE];
+  FILE *f = fopen(expected_image, "rb");
+  size_t len = fread(expected, 1, sizeof(expected), f);
+  fclose(f);
+  esp_partition_read(p, 0, actual, len);
+  bool match = memcmp(expected, actual, len) == 0;
+  printf("*** image %s\n", match ? "MATCHES" : "CORRUPT");
+  return match ? ESP_OK : ESP_FAIL;
+}
+
+void esp_restart(void) {
+  printf("*** restart\n");
+  exit(0);
+}
+
+// usage: test FLASH KV IMAGE PORT [POWER_CUT_AFTER]
+int main(int argc, char **argv) {
+  if (argc < 5) {
+    fprintf(stderr, "usage: %s FLASH KV IMAGE PORT [POWER_CUT_AFTER]\n", argv[0]);
+    return 2;
+  }
+  fake_flash_open(argv[1], 2 * PARTITION_SIZE);
+  fake_kv_open(argv[2]);
+  expected_image = argv[3];
+  server_port = atoi(argv[4]);
+  if (argc > 5) {
+    fake_flash_power_cut_after(atol(argv[5]));
+  }
+
+  ota_http *h = malloc(sizeof(ota_http));
+  ota_http_init(h);
+  char new_timestamp[15] = {0};
+  if (!check_new_version(h, new_timestamp, sizeof(new_timestamp) - 1)) {
+    printf("*** no new version\n");
+    return 1;
+  }
+  // restarts on success
+  try_ota(h, new_timestamp);
+  printf("*** update failed\n");
+  return 1;
+}
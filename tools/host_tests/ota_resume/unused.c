@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// referenced by the parts of ota.c the test doesn't run, only to link,
+// the server has no bundles or patches
+#include <stdlib.h>
+
+#define UNUSED(name) void name() { abort(); }
+
+UNUSED(ota_bundle_abort) UNUSED(ota_bundle_apply_staged) UNUSED(ota_bundle_begin) UNUSED(ota_bundle_end) UNUSED(ota_bundle_write)
+UNUSED(ota_delta_abort) UNUSED(ota_delta_begin) UNUSED(ota_delta_end) UNUSED(ota_delta_write)
+UNUSED(xQueueCreate) UNUSED(xQueueReceive) UNUSED(xQueueSend) UNUSED(xTaskCreatePinnedToCore)
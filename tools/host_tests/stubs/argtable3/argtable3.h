@@ -0,0 +1,15 @@
+#pragma once
+#include <stdio.h>
+struct arg_hdr { int x; };
+struct arg_str { struct arg_hdr hdr; int count; const char **sval; };
+struct arg_int { struct arg_hdr hdr; int count; int *ival; };
+struct arg_lit { struct arg_hdr hdr; int count; };
+struct arg_end { struct arg_hdr hdr; int count; };
+struct arg_str *arg_str0(const char*, const char*, const char*, const char*);
+struct arg_str *arg_str1(const char*, const char*, const char*, const char*);
+struct arg_int *arg_int0(const char*, const char*, const char*, const char*);
+struct arg_int *arg_int1(const char*, const char*, const char*, const char*);
+struct arg_lit *arg_lit0(const char*, const char*, const char*);
+struct arg_end *arg_end(int);
+int arg_parse(int, char **, void **);
+void arg_print_errors(FILE *, struct arg_end *, const char *);
@@ -0,0 +1,9 @@
+#pragma once
+#include "esp_err.h"
+void esp_restart(void);
+int esp_reset_reason(void);
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+esp_err_t esp_efuse_mac_get_default(uint8_t *mac);
+int esp_reset_reason(void);
+void esp_fill_random(void *buf, size_t len);
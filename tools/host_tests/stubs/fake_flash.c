@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// flash in a file with NOR semantics: erases set whole sectors to 0xff,
+// writes can only clear bits. Partitions are wherever the test puts them,
+// their address is the offset in the file.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_spi_flash.h"
+#include "fake_flash.h"
+
+static FILE *flash = NULL;
+static long written = 0;
+static long power_cut_at = -1;
+
+void fake_flash_open(const char *path, size_t size) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    FILE *f = fopen(path, "wb");
+    for (size_t i = 0; i < size; ++i) {
+      fputc(0x5a, f);
+    }
+    fclose(f);
+  }
+  flash = fopen(path, "r+b");
+  if (flash == NULL) {
+    perror(path);
+    exit(1);
+  }
+}
+
+void fake_flash_power_cut_after(long bytes) {
+  power_cut_at = bytes;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset, void *dst, size_t len) {
+  if (offset + len > p->size) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  fseek(flash, p->address + offset, SEEK_SET);
+  return fread(dst, 1, len, flash) == len ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t offset, const void *src, size_t len) {
+  uint8_t buf[1024];
+  while (len) {
+    size_t n = len < sizeof(buf) ? len : sizeof(buf);
+    esp_err_t err = esp_partition_read(p, offset, buf, n);
+    if (err != ESP_OK) {
+      return err;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      buf[i] &= ((const uint8_t *)src)[i];
+    }
+    fseek(flash, p->address + offset, SEEK_SET);
+    fwrite(buf, 1, n, flash);
+    fflush(flash);
+    written += n;
+    if (power_cut_at >= 0 && written >= power_cut_at) {
+      printf("*** power cut after %ld bytes\n", written);
+      exit(3);
+    }
+    offset += n;
+    src = (const uint8_t *)src + n;
+    len -= n;
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t len) {
+  if (offset % SPI_FLASH_SEC_SIZE || len % SPI_FLASH_SEC_SIZE || offset + len > p->size) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  uint8_t sector[SPI_FLASH_SEC_SIZE];
+  memset(sector, 0xff, sizeof(sector));
+  fseek(flash, p->address + offset, SEEK_SET);
+  for (size_t i = 0; i < len; i += sizeof(sector)) {
+    fwrite(sector, 1, sizeof(sector), flash);
+  }
+  fflush(flash);
+  return ESP_OK;
+}
+
+// one update at a time, written from the start of the partition like the real one
+static const esp_partition_t *ota_partition = NULL;
+static size_t ota_written = 0;
+
+esp_err_t esp_ota_begin(const esp_partition_t *p, size_t image_size, esp_ota_handle_t *handle) {
+  if (ota_partition != NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  size_t len = image_size == OTA_SIZE_UNKNOWN ? p->size : (image_size + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+  esp_err_t err = esp_partition_erase_range(p, 0, len);
+  if (err != ESP_OK) {
+    return err;
+  }
+  ota_partition = p;
+  ota_written = 0;
+  *handle = 1;
+  return ESP_OK;
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void *data, size_t len) {
+  if (ota_partition == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  esp_err_t err = esp_partition_write(ota_partition, ota_written, data, len);
+  ota_written += len;
+  return err;
+}
+
+esp_err_t esp_ota_end(esp_ota_handle_t handle) {
+  if (ota_partition == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  ota_partition = NULL;
+  return ESP_OK;
+}
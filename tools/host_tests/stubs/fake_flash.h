@@ -0,0 +1,8 @@
+#pragma once
+// file-backed flash for the OTA host tests, see fake_flash.c
+#include <stddef.h>
+
+// opens the flash file, creates it filled with 0x5a if it doesn't exist
+void fake_flash_open(const char *path, size_t size);
+// exits with status 3 once that many bytes were written, like a power cut
+void fake_flash_power_cut_after(long bytes);
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// the parts of ESP-IDF the host tests link against, logs go to stdout
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+const char *esp_err_to_name(esp_err_t err) {
+  static char name[16];
+  snprintf(name, sizeof(name), "0x%x", err);
+  return name;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+uint32_t esp_log_timestamp(void) {
+  return 0;
+}
+
+void portENTER_CRITICAL(portMUX_TYPE *mux) {}
+void portEXIT_CRITICAL(portMUX_TYPE *mux) {}
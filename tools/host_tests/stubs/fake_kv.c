@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// kv store in a text file, one "key value" per line, so it survives the
+// test process exiting like NVS survives a reboot
+#include <stdio.h>
+#include <string.h>
+
+#include "fake_kv.h"
+#include "generated/kv/kv.h"
+
+#define MAX_KEYS 32
+
+static const char *kv_path = NULL;
+static char keys[MAX_KEYS][32];
+static char values[MAX_KEYS][80];
+static int n_keys = 0;
+
+static void save() {
+  FILE *f = fopen(kv_path, "w");
+  for (int i = 0; i < n_keys; ++i) {
+    fprintf(f, "%s %s\n", keys[i], values[i]);
+  }
+  fclose(f);
+}
+
+static int find(const char *key) {
+  for (int i = 0; i < n_keys; ++i) {
+    if (strcmp(keys[i], key) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void set(const char *key, const char *value) {
+  int i = find(key);
+  if (i < 0) {
+    if (n_keys == MAX_KEYS) {
+      abort();
+    }
+    i = n_keys++;
+    snprintf(keys[i], sizeof(keys[i]), "%s", key);
+  }
+  snprintf(values[i], sizeof(values[i]), "%s", value);
+  save();
+}
+
+void fake_kv_open(const char *path) {
+  kv_path = path;
+  n_keys = 0;
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return;
+  }
+  while (n_keys < MAX_KEYS && fscanf(f, "%31s %79s", keys[n_keys], values[n_keys]) == 2) {
+    ++n_keys;
+  }
+  fclose(f);
+}
+
+void begin_kv_batch() {}
+esp_err_t end_kv_batch() { return ESP_OK; }
+
+bool hasi32(const char *key) {
+  return find(key) >= 0;
+}
+
+int32_t geti32(const char *key) {
+  int i = find(key);
+  return i < 0 ? 0 : atoi(values[i]);
+}
+
+void seti32(const char *key, int32_t value) {
+  char str[16];
+  snprintf(str, sizeof(str), "%d", value);
+  set(key, str);
+}
+
+bool hasstr(const char *key) {
+  return find(key) >= 0;
+}
+
+void getstr(const char *key, char *value, const size_t length) {
+  int i = find(key);
+  snprintf(value, length, "%s", i < 0 ? "" : values[i]);
+}
+
+void setstr(const char *key, const char *value) {
+  set(key, value);
+}
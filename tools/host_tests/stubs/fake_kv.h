@@ -0,0 +1,5 @@
+#pragma once
+// file-backed kv for the host tests, see fake_kv.c
+
+// loads the kv file, the store starts empty if it doesn't exist
+void fake_kv_open(const char *path);
@@ -0,0 +1,26 @@
+#pragma once
+#include "esp_err.h"
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffff
+#define portTICK_PERIOD_MS 10
+#define portTICK_RATE_MS 10
+#define pdMS_TO_TICKS(x) ((x)/10)
+#define tskIDLE_PRIORITY 0
+#define configMAX_PRIORITIES 25
+#define BIT0 1
+#define BIT1 2
+#define BIT2 4
+typedef struct { int x; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+void portENTER_CRITICAL(portMUX_TYPE *);
+void portEXIT_CRITICAL(portMUX_TYPE *);
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+#define DRAM_ATTR
@@ -0,0 +1,11 @@
+#pragma once
+#include "FreeRTOS.h"
+typedef void * QueueHandle_t;
+QueueHandle_t xQueueCreate(UBaseType_t, UBaseType_t);
+BaseType_t xQueueSend(QueueHandle_t, const void *, TickType_t);
+BaseType_t xQueueSendToBack(QueueHandle_t, const void *, TickType_t);
+BaseType_t xQueueReceive(QueueHandle_t, void *, TickType_t);
+BaseType_t xQueuePeek(QueueHandle_t, void *, TickType_t);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t);
+BaseType_t xQueueReset(QueueHandle_t);
@@ -0,0 +1,11 @@
+#pragma once
+#include "FreeRTOS.h"
+typedef void * RingbufHandle_t;
+typedef enum { RINGBUF_TYPE_NOSPLIT = 0, RINGBUF_TYPE_ALLOWSPLIT, RINGBUF_TYPE_BYTEBUF } ringbuf_type_t;
+RingbufHandle_t xRingbufferCreate(size_t, ringbuf_type_t);
+UBaseType_t xRingbufferSend(RingbufHandle_t, const void *, size_t, TickType_t);
+void *xRingbufferReceive(RingbufHandle_t, size_t *, TickType_t);
+void vRingbufferReturnItem(RingbufHandle_t, void *);
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t);
+size_t xRingbufferGetMaxItemSize(RingbufHandle_t);
+void vRingbufferGetInfo(RingbufHandle_t, UBaseType_t *, UBaseType_t *, UBaseType_t *, UBaseType_t *);
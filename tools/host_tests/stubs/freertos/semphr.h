@@ -0,0 +1,11 @@
+#pragma once
+#include "queue.h"
+typedef void * SemaphoreHandle_t;
+typedef struct { int x; } StaticSemaphore_t;
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t, UBaseType_t);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t);
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t);
@@ -0,0 +1,32 @@
+#pragma once
+// stands in for the kv.h generated from main/core/kv/kv.h.template, only
+// what the host tests use
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define MAX_KVALUE_SIZE 517
+
+void begin_kv_batch();
+esp_err_t end_kv_batch();
+
+int32_t geti32(const char *key);
+void seti32(const char *key, int32_t value);
+bool hasi32(const char *key);
+void getstr(const char *key, char *value, const size_t length);
+void setstr(const char *key, const char *value);
+bool hasstr(const char *key);
+
+int8_t get_cmd_boot_script_delete();
+
+void get_ota_basedir(char *dst, size_t len);
+void get_ota_server_ip(char *dst, size_t len);
+void get_ota_server_hostname(char *dst, size_t len);
+uint16_t get_ota_server_port();
+int32_t get_ota_timestamp();
+void set_ota_timestamp(int32_t value);
+void set_ota_status(int8_t value);
+void set_ota_progress(int8_t value);
+void set_ota_received(uint32_t value);
+void set_ota_speed(uint32_t value);
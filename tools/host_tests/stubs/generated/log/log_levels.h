@@ -0,0 +1,11 @@
+#pragma once
+// stands in for the log_levels.h generated from main/core/log/log_levels.h.template
+
+typedef enum {
+  SGO_LOG_MODULE_CMD,
+  SGO_LOG_MODULE_OTA,
+  SGO_LOG_MODULE_COUNT,
+} sgo_log_module;
+
+#define SGO_LOG_LEVEL_CMD ESP_LOG_VERBOSE
+#define SGO_LOG_LEVEL_OTA ESP_LOG_VERBOSE
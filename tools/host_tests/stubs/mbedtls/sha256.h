@@ -0,0 +1,11 @@
+#pragma once
+// backed by openssl, link with -lcrypto
+#include <string.h>
+#include <openssl/sha.h>
+typedef SHA256_CTX mbedtls_sha256_context;
+#define mbedtls_sha256_init(c) memset(c, 0, sizeof(*(c)))
+#define mbedtls_sha256_free(c) (void)0
+#define mbedtls_sha256_clone(d, s) (*(d) = *(s))
+#define mbedtls_sha256_starts_ret(c, is224) (SHA256_Init(c) ? 0 : -1)
+#define mbedtls_sha256_update_ret(c, d, l) (SHA256_Update(c, d, l) ? 0 : -1)
+#define mbedtls_sha256_finish_ret(c, h) (SHA256_Final(h, c) ? 0 : -1)
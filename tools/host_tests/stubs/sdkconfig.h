@@ -0,0 +1,10 @@
+#define CONFIG_VERSION "x"
+#define CONFIG_SPIFFS_OBJ_NAME_LEN 32
+#define CONFIG_CONSOLE_UART_NUM 0
+#define CONFIG_CONSOLE_UART_BAUDRATE 115200
+#define CONFIG_SGO_LOG_BUFFER_SIZE 6400
+#define CONFIG_SGO_LOG_MAX_RECORD_SIZE 512
+#define CONFIG_SGO_LOG_BATCH_SIZE 4096
+#define CONFIG_TCP_MSS 1436
+#define CONFIG_SGO_CMD_BUFFER_SIZE 4096
+#define CONFIG_SGO_TERM_ECHO 1
@@ -0,0 +1,8 @@
+#pragma once
+#include <stdio.h>
+static inline char *sodium_bin2hex(char *hex, size_t hex_len, const unsigned char *bin, size_t bin_len) {
+  for (size_t i = 0; i < bin_len && 2 * i + 2 < hex_len; ++i) {
+    sprintf(&hex[2 * i], "%02x", bin[i]);
+  }
+  return hex;
+}
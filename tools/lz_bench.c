@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+ * Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmarks the MQTT log compression (main/core/mqtt/lz.c) over a capture
+ * of real log traffic, batching records the same way the firmware does.
+ *
+ * The capture has one record per line, either as text or as hex, which is
+ * what `mosquitto_sub -t <channel> -F %x` prints.
+ *
+ * Build: gcc -O2 -o lz_bench tools/lz_bench.c main/core/mqtt/lz.c
+ * USAGE: ./lz_bench captured_log.txt [batch_size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "../main/core/mqtt/lz.h"
+
+#define MAX_RECORD_SIZE 512
+#define N_RUNS 20
+
+static size_t lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len) {
+  const uint8_t *ip = src, *end = src + len;
+  uint8_t *op = dst, *oend = dst + dst_len;
+
+  while (ip < end) {
+    uint8_t token = *ip++;
+    size_t n = token >> 4;
+    if (n == 15) {
+      do { n += *ip; } while (*ip++ == 255 && ip < end);
+    }
+    if (ip + n > end || op + n > oend) return 0;
+    memcpy(op, ip, n);
+    op += n;
+    ip += n;
+    if (ip >= end) break;
+
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    n = (token & 15);
+    if (n == 15) {
+      do { n += *ip; } while (*ip++ == 255 && ip < end);
+    }
+    n += 4;
+    if (offset == 0 || offset > op - dst || op + n > oend) return 0;
+    for (; n; --n, ++op) {
+      *op = op[-offset];
+    }
+  }
+  return op - dst;
+}
+
+static size_t parse_record(char *line, uint8_t *record) {
+  size_t len = strlen(line);
+  while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = 0;
+
+  int hex = len >= 16 && len % 2 == 0;
+  for (size_t i = 0; hex && i < len; ++i) hex = isxdigit((unsigned char)line[i]);
+  if (hex) {
+    len = len / 2 > MAX_RECORD_SIZE ? MAX_RECORD_SIZE : len / 2;
+    for (size_t i = 0; i < len; ++i) sscanf(&line[i * 2], "%2hhx", &record[i]);
+    return len;
+  }
+  if (len > MAX_RECORD_SIZE - 1) len = MAX_RECORD_SIZE - 1;
+  memcpy(record, line, len);
+  record[len++] = '\n';
+  return len;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "USAGE: %s captured_log.txt [batch_size]\n", argv[0]);
+    return 1;
+  }
+  size_t batch_size = argc > 2 ? atoi(argv[2]) : 4096;
+  if (batch_size < MAX_RECORD_SIZE + 2 || batch_size > LZ_MAX_INPUT_SIZE) {
+    fprintf(stderr, "batch_size must be between %d and %d\n", MAX_RECORD_SIZE + 2, LZ_MAX_INPUT_SIZE);
+    return 1;
+  }
+
+  FILE *f = fopen(argv[1], "r");
+  if (!f) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  // Batches, as the firmware builds them: u16 length + record, back to back
+  size_t n_batches = 0, cap = 16, n_records = 0;
+  uint8_t **batches = malloc(cap * sizeof(uint8_t *));
+  size_t *batch_lens = malloc(cap * sizeof(size_t));
+  uint8_t *batch = malloc(batch_size);
+  size_t batch_len = 0;
+
+  char line[MAX_RECORD_SIZE * 2 + 16];
+  uint8_t record[MAX_RECORD_SIZE];
+  while (fgets(line, sizeof(line), f)) {
+    size_t len = parse_record(line, record);
+    if (batch_len + 2 + len > batch_size) {
+      if (n_batches == cap) {
+        cap *= 2;
+        batches = realloc(batches, cap * sizeof(uint8_t *));
+        batch_lens = realloc(batch_lens, cap * sizeof(size_t));
+      }
+      batches[n_batches] = batch;
+      batch_lens[n_batches++] = batch_len;
+      batch = malloc(batch_size);
+      batch_len = 0;
+    }
+    batch[batch_len++] = len & 0xff;
+    batch[batch_len++] = len >> 8;
+    memcpy(&batch[batch_len], record, len);
+    batch_len += len;
+    ++n_records;
+  }
+  fclose(f);
+  if (batch_len) {
+    batches[n_batches] = batch;
+    batch_lens[n_batches++] = batch_len;
+  }
+
+  uint16_t table[LZ_HASH_SIZE];
+  size_t frame_size = LZ_COMPRESS_BOUND(batch_size);
+  uint8_t *frame = malloc(frame_size);
+  uint8_t *check = malloc(batch_size);
+
+  size_t raw_bytes = 0, frame_bytes = 0, n_compressed = 0;
+  for (size_t i = 0; i < n_batches; ++i) {
+    size_t len = lz_compress(batches[i], batch_lens[i], frame, frame_size, table);
+    raw_bytes += batch_lens[i];
+    // 3 bytes frame header, raw batches are sent as-is when compression doesn't help
+    frame_bytes += 3 + (len ? len : batch_lens[i]);
+    if (!len) continue;
+    ++n_compressed;
+    if (lz_decompress(frame, len, check, batch_size) != batch_lens[i] || memcmp(check, batches[i], batch_lens[i])) {
+      fprintf(stderr, "round trip failed on batch %zu\n", i);
+      return 1;
+    }
+  }
+
+  clock_t start = clock();
+  for (int r = 0; r < N_RUNS; ++r) {
+    for (size_t i = 0; i < n_batches; ++i) {
+      lz_compress(batches[i], batch_lens[i], frame, frame_size, table);
+    }
+  }
+  double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  printf("records:      %zu\n", n_records);
+  printf("batches:      %zu (%zu compressed, batch size %zu)\n", n_batches, n_compressed, batch_size);
+  printf("raw bytes:    %zu\n", raw_bytes);
+  printf("frame bytes:  %zu\n", frame_bytes);
+  printf("ratio:        %.2fx\n", frame_bytes ? (double)raw_bytes / frame_bytes : 0);
+  printf("compression:  %.1f MB/s (host)\n", secs > 0 ? raw_bytes * N_RUNS / secs / 1e6 : 0);
+  return 0;
+}
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+# Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Makes the OTA bundles read by main/core/ota/ota_bundle.c, see ota_bundle.h
+# for the format.
+#
+# USAGE:
+#   tools/ota_bundle.py pack out.sgob timestamp firmware [files...]
+#   tools/ota_bundle.py list in.sgob
+#
+# firmware is either firmware.bin or a patch from tools/ota_diff.py. Files
+# are stored under their base name, as they are on SPIFFS (already gzipped).
+# Releases are served as <basedir>/<timestamp>/bundle.<from timestamp>.sgob
+# and <basedir>/<timestamp>/bundle.sgob.
+
+import hashlib
+import os
+import struct
+import sys
+
+MAGIC = b'SGOB'
+VERSION = 1
+HEADER = struct.Struct('<4sBB2xI')
+ENTRY = struct.Struct('<B3xI32s32s')
+
+FIRMWARE = 0
+PATCH = 1
+FILE = 2
+TYPES = {FIRMWARE: 'firmware', PATCH: 'patch', FILE: 'file'}
+
+PATCH_MAGIC = b'SGOP'
+MAX_ENTRIES = 8
+# CONFIG_SPIFFS_OBJ_NAME_LEN, minus "/staged/" and the terminating NUL
+MAX_NAME = 32 - len('/staged/') - 1
+
+
+def pack(timestamp, firmware, files):
+  entries = [(PATCH if firmware.startswith(PATCH_MAGIC) else FIRMWARE, 'firmware', firmware)]
+  for name, data in files:
+    if not name or name.startswith('.') or '/' in name or len(name) > MAX_NAME:
+      raise ValueError('invalid file name %s' % name)
+    entries.append((FILE, name, data))
+  if len(entries) > MAX_ENTRIES:
+    raise ValueError('%d entries, max %d' % (len(entries), MAX_ENTRIES))
+
+  out = bytearray(HEADER.pack(MAGIC, VERSION, len(entries), timestamp))
+  for kind, name, data in entries:
+    out += ENTRY.pack(kind, len(data), name.encode(), hashlib.sha256(data).digest())
+  for _, _, data in entries:
+    out += data
+  return bytes(out)
+
+
+def parse(bundle):
+  magic, version, n, timestamp = HEADER.unpack_from(bundle, 0)
+  if magic != MAGIC or version != VERSION:
+    raise ValueError('not a bundle, or unsupported version')
+  pos = HEADER.size + n * ENTRY.size
+  entries = []
+  for i in range(n):
+    kind, size, name, sha = ENTRY.unpack_from(bundle, HEADER.size + i * ENTRY.size)
+    data = bundle[pos:pos + size]
+    if len(data) != size or hashlib.sha256(data).digest() != sha:
+      raise ValueError('entry %d hash mismatch' % i)
+    entries.append((kind, name.rstrip(b'\0').decode(), data))
+    pos += size
+  if pos != len(bundle):
+    raise ValueError('trailing data after the end of the bundle')
+  return timestamp, entries
+
+
+def read(path):
+  with open(path, 'rb') as f:
+    return f.read()
+
+
+def write(path, data):
+  with open(path, 'wb') as f:
+    f.write(data)
+
+
+def main(argv):
+  if len(argv) >= 5 and argv[1] == 'pack':
+    files = [(os.path.basename(p), read(p)) for p in argv[5:]]
+    write(argv[2], pack(int(argv[3]), read(argv[4]), files))
+  elif len(argv) == 3 and argv[1] == 'list':
+    timestamp, entries = parse(read(argv[2]))
+    print('release %d' % timestamp)
+    for kind, name, data in entries:
+      print('  %-8s %-24s %d bytes' % (TYPES.get(kind, kind), name, len(data)))
+  else:
+    print(open(__file__).read().split('# USAGE:')[1].split('\n\n')[0])
+    return 1
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main(sys.argv))
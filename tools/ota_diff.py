@@ -0,0 +1,191 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2021  SuperGreenLab <towelie@supergreenlab.com>
+# Author: Constantin Clauzel <constantin.clauzel@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Makes and applies the delta OTA patches read by main/core/ota/ota_delta.c,
+# see ota_delta.h for the format.
+#
+# USAGE:
+#   tools/ota_diff.py diff old.bin new.bin out.patch
+#   tools/ota_diff.py apply old.bin in.patch out.bin
+#   tools/ota_diff.py check old.bin new.bin    diffs, applies, compares
+#
+# Releases are served as <basedir>/<timestamp>/firmware.<from timestamp>.patch,
+# devices without a matching patch download firmware.bin.
+
+import hashlib
+import struct
+import sys
+
+MAGIC = b'SGOP'
+VERSION = 1
+HEADER = struct.Struct('<4sB3xI32sI32s')
+
+OP_END = 0
+OP_COPY = 1
+OP_INSERT = 2
+
+# matches are looked up by blocks of this size, a copy is never shorter
+BLOCK = 16
+
+
+def varint(v):
+  out = bytearray()
+  while v >= 0x80:
+    out.append((v & 0x7f) | 0x80)
+    v >>= 7
+  out.append(v)
+  return out
+
+
+def zigzag(v):
+  return (v << 1) if v >= 0 else ((-v << 1) - 1)
+
+
+def match_length(old, o, new, n):
+  length = 0
+  step = 256
+  while step:
+    while o + length + step <= len(old) and n + length + step <= len(new) \
+        and old[o + length:o + length + step] == new[n + length:n + length + step]:
+      length += step
+    step //= 16
+  return length
+
+
+def diff(old, new):
+  index = {}
+  for i in range(len(old) - BLOCK, -1, -1):
+    index[old[i:i + BLOCK]] = i
+
+  out = bytearray(HEADER.pack(MAGIC, VERSION, len(old), hashlib.sha256(old).digest(),
+                              len(new), hashlib.sha256(new).digest()))
+  source_pos = 0
+  literal_start = 0
+  i = 0
+
+  def insert(end):
+    if end > literal_start:
+      out.append(OP_INSERT)
+      out.extend(varint(end - literal_start))
+      out.extend(new[literal_start:end])
+
+  while i + BLOCK <= len(new):
+    block = new[i:i + BLOCK]
+    # after a short change, the old image usually lines up again right there
+    expected = source_pos + i - literal_start
+    if old[expected:expected + BLOCK] == block:
+      offset = expected
+    else:
+      offset = index.get(block)
+      if offset is None:
+        i += 1
+        continue
+    length = match_length(old, offset, new, i)
+    back = 0
+    while i - back > literal_start and offset - back > 0 and new[i - back - 1] == old[offset - back - 1]:
+      back += 1
+    insert(i - back)
+    out.append(OP_COPY)
+    out.extend(varint(length + back))
+    out.extend(varint(zigzag(offset - back - source_pos)))
+    source_pos = offset + length
+    i += length
+    literal_start = i
+
+  insert(len(new))
+  out.append(OP_END)
+  return bytes(out)
+
+
+def read_varint(patch, pos):
+  value = shift = 0
+  while True:
+    c = patch[pos]
+    pos += 1
+    value |= (c & 0x7f) << shift
+    shift += 7
+    if not c & 0x80:
+      return value, pos
+
+
+def apply(old, patch):
+  magic, version, source_size, source_hash, target_size, target_hash = HEADER.unpack_from(patch)
+  if magic != MAGIC or version != VERSION:
+    raise ValueError('not a patch, or unsupported version')
+  if source_size != len(old) or hashlib.sha256(old).digest() != source_hash:
+    raise ValueError('patch was not made from this image')
+
+  new = bytearray()
+  source_pos = 0
+  pos = HEADER.size
+  while True:
+    op = patch[pos]
+    pos += 1
+    if op == OP_END:
+      break
+    length, pos = read_varint(patch, pos)
+    if op == OP_COPY:
+      offset, pos = read_varint(patch, pos)
+      offset = source_pos + ((offset >> 1) ^ -(offset & 1))
+      if offset < 0 or offset + length > len(old):
+        raise ValueError('copy outside of the source image')
+      new.extend(old[offset:offset + length])
+      source_pos = offset + length
+    elif op == OP_INSERT:
+      new.extend(patch[pos:pos + length])
+      pos += length
+    else:
+      raise ValueError('unknown op 0x%02x' % op)
+
+  if pos != len(patch):
+    raise ValueError('trailing data after the end of the patch')
+  if len(new) != target_size or hashlib.sha256(new).digest() != target_hash:
+    raise ValueError('patched image hash mismatch')
+  return bytes(new)
+
+
+def read(path):
+  with open(path, 'rb') as f:
+    return f.read()
+
+
+def write(path, data):
+  with open(path, 'wb') as f:
+    f.write(data)
+
+
+def main(argv):
+  if len(argv) == 5 and argv[1] == 'diff':
+    write(argv[4], diff(read(argv[2]), read(argv[3])))
+  elif len(argv) == 5 and argv[1] == 'apply':
+    write(argv[4], apply(read(argv[2]), read(argv[3])))
+  elif len(argv) == 4 and argv[1] == 'check':
+    old, new = read(argv[2]), read(argv[3])
+    patch = diff(old, new)
+    if apply(old, patch) != new:
+      print('round trip FAILED')
+      return 1
+    print('round trip OK, %d bytes image, %d bytes patch (%.1f%%)' % (len(new), len(patch), len(patch) * 100.0 / len(new)))
+  else:
+    print(open(__file__).read().split('# USAGE:')[1].split('\n\n')[0])
+    return 1
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main(sys.argv))
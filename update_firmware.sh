@@ -46,6 +46,19 @@ cp $i $DEST/
 echo -e "Copying $i to $DEST/$i: ${GREEN}Done${NC}"
 done
 
+# checked by the device once the image is downloaded
+sha256sum $DEST/firmware.bin | cut -d' ' -f1 > $DEST/firmware.sha256
+echo -e "Created $DEST/firmware.sha256: ${GREEN}Done${NC}"
+
+# delta OTA patches from the last 5 releases, see tools/ota_diff.py
+for PREV in $(ls -d releases/$NAME/*/ | grep -v "/$TS/" | sort -r | head -5); do
+  PREV_TS=`basename $PREV`
+  if [ -f "$PREV/firmware.bin" ]; then
+    ./tools/ota_diff.py diff $PREV/firmware.bin $DEST/firmware.bin $DEST/firmware.$PREV_TS.patch
+    echo -e "Created $DEST/firmware.$PREV_TS.patch: ${GREEN}Done${NC}"
+  fi
+done
+
 echo $TS > "releases/$NAME/last_timestamp"
 echo $TS > "$DEST/timestamp"
 
@@ -65,6 +78,17 @@ for i in $(ls ./spiffs_fs); do
 done
 mkspiffs -c spiffs_fs_gz/ -b 4096 -p 256 -s 0x8000 $DEST/spiffs.bin
 cp -r spiffs_fs_gz $DEST/html_app
+
+# firmware and web app in one download, see tools/ota_bundle.py, tester.html
+# stays out as it starts the test mode
+BUNDLE_FILES=$(ls spiffs_fs_gz/* | grep -v "/tester.html$")
+./tools/ota_bundle.py pack $DEST/bundle.sgob $TS $DEST/firmware.bin $BUNDLE_FILES
+echo -e "Created $DEST/bundle.sgob: ${GREEN}Done${NC}"
+for PATCH in $(ls $DEST/firmware.*.patch 2>/dev/null); do
+  PREV_TS=`basename $PATCH .patch | cut -d. -f2`
+  ./tools/ota_bundle.py pack $DEST/bundle.$PREV_TS.sgob $TS $PATCH $BUNDLE_FILES
+  echo -e "Created $DEST/bundle.$PREV_TS.sgob: ${GREEN}Done${NC}"
+done
 rm -rf spiffs_fs_gz
 
 echo -e "Created $DEST/spiffs.bin: ${GREEN}Done${NC}"
@@ -24,6 +24,5 @@ if [ ! -f "$DATA" ]; then
 fi
 
 pushd html_app/
-ejs-cli -O "../$DATA" -f ../html_app/config.json > ../spiffs_fs/config.json
 ejs-cli -O "../$DATA" -f ../html_app/index.html > ../spiffs_fs/app.html
 popd
@@ -41,3 +41,10 @@ do
   #fi
   echo -e "Processing $i: ${GREEN}Done${NC}"
 done
+
+# the schema is embedded gzipped in the firmware, -n keeps it (and its ETag) stable across runs
+SCHEMA="$DIR/core/httpd/schema.json"
+if [ -f "$SCHEMA" ]; then
+  gzip -9 -n -c "$SCHEMA" > "$SCHEMA.gz"
+  echo -e "Compressing $SCHEMA: ${GREEN}Done${NC}"
+fi
@@ -11,5 +11,10 @@ else
   exit
 fi
 
-curl -XPOST --upload-file $HTML_APP_DIR/config.json -vvv http://$NAME/fs/config.json
-curl -XPOST --upload-file $HTML_APP_DIR/app.html -vvv http://$NAME/fs/app.html
+# The device checks the upload against X-Content-SHA256 before replacing the file
+upload() {
+  SHA256=$(shasum -a 256 "$HTML_APP_DIR/$1" | cut -d' ' -f1)
+  curl -XPOST -H "X-Content-SHA256: $SHA256" --upload-file "$HTML_APP_DIR/$1" -vvv http://$NAME/fs/$1
+}
+
+upload app.html